@@ -27,6 +27,7 @@ namespace {
 void register_common_func(pybind11::module& m) {
   namespace py = pybind11;
 
+  using comm::Priority;
   using comm::ReplyStatus;
   using elf::AnyP;
   using elf::Context;
@@ -43,6 +44,10 @@ void register_common_func(pybind11::module& m) {
       .value("UNKNOWN", ReplyStatus::UNKNOWN)
       .export_values();
 
+  py::enum_<Priority>(m, "Priority")
+      .value("NORMAL", Priority::NORMAL)
+      .value("HIGH", Priority::HIGH);
+
   py::class_<Context>(m, "Context")
       .def(
           "wait",
@@ -59,6 +64,9 @@ void register_common_func(pybind11::module& m) {
       .def("stop", &Context::stop)
       .def("version", &Context::version)
       .def("allocateSharedMem", &Context::allocateSharedMem, ref)
+      .def("getSharedMem", &Context::getSharedMem, ref)
+      .def("batchingInfo", &Context::batchingInfo)
+      .def("collectorInfo", &Context::collectorInfo)
       .def("createSharedMemOptions", &Context::createSharedMemOptions);
 
   py::class_<Size>(m, "Size").def("vec", &Size::vec, ref);
@@ -67,7 +75,12 @@ void register_common_func(pybind11::module& m) {
       .def("idx", &SharedMemOptions::getIdx)
       .def("batchsize", &SharedMemOptions::getBatchSize)
       .def("label", &SharedMemOptions::getLabel, ref)
-      .def("setTimeout", &SharedMemOptions::setTimeout);
+      .def("setTimeout", &SharedMemOptions::setTimeout)
+      .def("setParallelTransfer", &SharedMemOptions::setParallelTransfer)
+      .def("numBuffers", &SharedMemOptions::getNumBuffers)
+      .def("setNumBuffers", &SharedMemOptions::setNumBuffers)
+      .def("setAdaptive", &SharedMemOptions::setAdaptive)
+      .def("setPriority", &SharedMemOptions::setPriority);
 
   py::class_<SharedMem>(m, "SharedMem")
       .def("__getitem__", &SharedMem::get, ref)
@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Heap allocations per NN request on the Context path (game thread ->
+// collector -> consumer and back), counted by replacing operator new.
+// Only the steady state is measured: bindings, nodes and scratch vectors
+// are created during warm up.
+//
+// Usage: CommAllocBench [num_batches]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "elf/base/context.h"
+
+namespace {
+
+std::atomic<bool> counting(false);
+std::atomic<int64_t> num_allocs(0);
+
+constexpr int kBatchSize = 16;
+constexpr int kNumGames = 32;
+constexpr int kWarmUpBatches = 500;
+
+struct State {
+  int64_t in = 0;
+  int64_t out = 0;
+};
+
+void extractIn(const State& s, int64_t* p) {
+  *p = s.in;
+}
+
+void replyOut(State& s, const int64_t* p) {
+  s.out = *p;
+}
+
+void run(elf::SharedMemOptions::TransferType type, int num_batches) {
+  elf::Context ctx;
+  auto& e = ctx.getExtractor();
+  e.addField<int64_t>("in").addExtent(kBatchSize).addFunction<State>(
+      extractIn);
+  e.addField<int64_t>("out").addExtent(kBatchSize).addFunction<State>(
+      replyOut);
+
+  elf::SharedMemOptions opts = ctx.createSharedMemOptions("actor", kBatchSize);
+  opts.setTimeout(100);
+  opts.setTransferType(type);
+  elf::SharedMem& smem = ctx.allocateSharedMem(opts, {"in", "out"});
+  std::vector<int64_t> in(kBatchSize), out(kBatchSize);
+  smem["in"]->setAddress((uint64_t)in.data(), {(int)sizeof(int64_t)});
+  smem["out"]->setAddress((uint64_t)out.data(), {(int)sizeof(int64_t)});
+
+  std::atomic<int64_t> num_requests(0);
+  ctx.setStartCallback(kNumGames, [&](int, elf::GameClient* client) {
+    const std::vector<std::string> targets{"actor"};
+    State s;
+    auto funcs = client->BindStateToFunctions(targets, &s);
+    while (!client->DoStopGames()) {
+      s.in++;
+      client->sendWait(targets, &funcs);
+      if (counting) {
+        num_requests++;
+      }
+    }
+  });
+  ctx.start();
+
+  std::chrono::steady_clock::time_point start;
+  for (int i = 0; i < kWarmUpBatches + num_batches; ++i) {
+    if (i == kWarmUpBatches) {
+      num_allocs = 0;
+      counting = true;
+      start = std::chrono::steady_clock::now();
+    }
+    const elf::SharedMem* batch = ctx.wait();
+    const int n = batch->getEffectiveBatchSize();
+    for (int j = 0; j < n; ++j) {
+      out[j] = in[j] + 1;
+    }
+    ctx.step();
+  }
+  counting = false;
+  const double usec = std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  const int64_t allocs = num_allocs;
+  const int64_t requests = num_requests;
+  ctx.stop();
+
+  printf(
+      "%s: %.4f allocs/request (%ld allocs, %ld requests), %.1f us/batch\n",
+      type == elf::SharedMemOptions::SERVER ? "SERVER" : "CLIENT",
+      (double)allocs / std::max<int64_t>(requests, 1),
+      (long)allocs,
+      (long)requests,
+      usec / num_batches);
+}
+
+} // namespace
+
+// Out of line, so that the compiler does not pair the malloc and free below
+// with new and delete expressions.
+__attribute__((noinline)) void* operator new(size_t size) {
+  if (counting.load(std::memory_order_relaxed)) {
+    num_allocs++;
+  }
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+int main(int argc, char** argv) {
+  const int num_batches = argc > 1 ? atoi(argv[1]) : 5000;
+  run(elf::SharedMemOptions::SERVER, num_batches);
+  run(elf::SharedMemOptions::CLIENT, num_batches);
+  return 0;
+}
@@ -0,0 +1,379 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Latency and throughput of the request path every NN call goes through.
+//
+// Context: N game threads call sendWait (or sendBatchWait) with a dummy
+// extractor, and a C++ loop calling wait()/step() stands in for Python, or
+// the batches are served in process by an Evaluator.
+// Swept over game threads, batch sizes, collector timeouts and number of
+// collectors (shards) of the label, whose stats are printed as well. Many
+// games are also run as fibers on a few threads (Context::setFiberMode).
+//
+// CommT: the same pattern directly on comm::CommT for each ConcurrentQueue
+// implementation (Context itself always uses the default one).
+//
+// Reported per run: round trip percentiles seen by the game threads,
+// requests/s, batches/s and batch fill ratio (states per batch / batchsize).
+//
+// Usage: ContextBench [seconds_per_run]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "elf/base/context.h"
+#include "elf/base/evaluator.h"
+#include "elf/comm/comm.h"
+#include "elf/concurrency/ConcurrentQueue.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double kWarmUpSeconds = 0.2;
+// Round trips kept per game thread for the percentiles.
+constexpr size_t kMaxSamples = 20000;
+
+struct State {
+  int64_t in = 0;
+  int64_t out = 0;
+};
+
+void extractIn(const State& s, int64_t* p) {
+  *p = s.in;
+}
+
+void replyOut(State& s, const int64_t* p) {
+  s.out = *p;
+}
+
+// Filled by the game threads while `measuring`.
+struct Recorder {
+  std::atomic<bool> measuring{false};
+  std::atomic<int64_t> requests{0};
+  std::vector<std::vector<float>> samples;
+
+  explicit Recorder(int num_threads) : samples(num_threads) {
+    for (auto& s : samples) {
+      s.reserve(kMaxSamples);
+    }
+  }
+
+  // Time one request of game thread i.
+  template <typename F>
+  void request(int i, F f) {
+    const auto start = Clock::now();
+    f();
+    if (measuring) {
+      requests++;
+      auto& s = samples[i];
+      if (s.size() < kMaxSamples) {
+        s.push_back(
+            std::chrono::duration<float, std::micro>(Clock::now() - start)
+                .count());
+      }
+    }
+  }
+
+  void report(
+      const std::string& name,
+      double seconds,
+      int64_t batches,
+      int64_t states,
+      int batchsize) {
+    std::vector<float> all;
+    for (const auto& s : samples) {
+      all.insert(all.end(), s.begin(), s.end());
+    }
+    auto pct = [&](double p) -> float {
+      if (all.empty()) {
+        return 0;
+      }
+      auto it = all.begin() + (size_t)(p * (all.size() - 1));
+      std::nth_element(all.begin(), it, all.end());
+      return *it;
+    };
+    const float p50 = pct(0.5), p90 = pct(0.9), p99 = pct(0.99);
+    const float pmax = pct(1.0);
+    printf(
+        "%-42s p50 %8.1f p90 %8.1f p99 %8.1f max %9.1f us | "
+        "%9.0f req/s %8.0f batch/s fill %.2f\n",
+        name.c_str(),
+        p50,
+        p90,
+        p99,
+        pmax,
+        requests / seconds,
+        batches / seconds,
+        batches > 0 ? (double)states / (batches * batchsize) : 0.0);
+  }
+};
+
+void sleepSeconds(double seconds) {
+  std::this_thread::sleep_for(
+      std::chrono::microseconds((int64_t)(seconds * 1e6)));
+}
+
+// Replies out = in, counting batches while measuring. Serves the batches
+// either from a wait()/step() loop, or in process as the Evaluator.
+class Echo : public elf::Evaluator {
+ public:
+  explicit Echo(const Recorder& recorder) : recorder_(recorder) {}
+
+  comm::ReplyStatus evaluate(elf::SharedMem& smem) override {
+    const int n = smem.getEffectiveBatchSize();
+    const int64_t* in = smem["in"]->getAddress<int64_t>(0);
+    int64_t* out = smem["out"]->getAddress<int64_t>(0);
+    std::copy(in, in + n, out);
+    if (recorder_.measuring) {
+      batches++;
+      states += n;
+    }
+    return comm::SUCCESS;
+  }
+
+  std::atomic<int64_t> batches{0};
+  std::atomic<int64_t> states{0};
+
+ private:
+  const Recorder& recorder_;
+};
+
+// states_per_request > 1 uses sendBatchWait. With in_process, batches are
+// served by an Evaluator instead of the wait()/step() loop. fiber_workers > 0
+// runs the games as fibers on that many threads.
+void runContext(
+    int num_games,
+    int batchsize,
+    int timeout_usec,
+    int states_per_request,
+    int num_shards,
+    bool in_process,
+    int fiber_workers,
+    double seconds) {
+  elf::Context ctx;
+  if (fiber_workers > 0) {
+    ctx.setFiberMode(fiber_workers);
+  }
+  auto& e = ctx.getExtractor();
+  e.addField<int64_t>("in").addExtent(batchsize).addFunction<State>(
+      extractIn);
+  e.addField<int64_t>("out").addExtent(batchsize).addFunction<State>(
+      replyOut);
+
+  elf::SharedMemOptions opts = ctx.createSharedMemOptions("actor", batchsize);
+  opts.setTimeout(timeout_usec);
+  // Memory of each shard.
+  std::vector<std::vector<int64_t>> in(num_shards), out(num_shards);
+  for (int k = 0; k < num_shards; ++k) {
+    elf::SharedMem& smem = ctx.allocateSharedMem(opts, {"in", "out"});
+    in[k].resize(batchsize);
+    out[k].resize(batchsize);
+    smem["in"]->setAddress((uint64_t)in[k].data(), {(int)sizeof(int64_t)});
+    smem["out"]->setAddress((uint64_t)out[k].data(), {(int)sizeof(int64_t)});
+  }
+
+  Recorder recorder(num_games);
+  auto owned = std::make_unique<Echo>(recorder);
+  Echo* echo = owned.get();
+  if (in_process) {
+    ctx.setEvaluator("actor", std::move(owned));
+  }
+  ctx.setStartCallback(
+      num_games,
+      [&](int i, elf::GameClient* client) {
+        const std::vector<std::string> targets{"actor"};
+        std::vector<State> states(states_per_request);
+        std::vector<State*> ptrs;
+        for (auto& s : states) {
+          ptrs.push_back(&s);
+        }
+        auto funcs = client->BindStateToFunctions(targets, ptrs);
+        std::vector<elf::FuncsWithState*> funcs_ptrs;
+        for (auto& f : funcs) {
+          funcs_ptrs.push_back(&f);
+        }
+
+        while (!client->DoStopGames()) {
+          recorder.request(i, [&]() {
+            if (states_per_request == 1) {
+              client->sendWait(targets, funcs_ptrs[0]);
+            } else {
+              client->sendBatchWait(targets, funcs_ptrs);
+            }
+          });
+        }
+      },
+      true);
+  ctx.start();
+
+  const auto start = Clock::now();
+  auto measure_start = start;
+  if (in_process) {
+    sleepSeconds(kWarmUpSeconds);
+    recorder.measuring = true;
+    measure_start = Clock::now();
+    sleepSeconds(seconds);
+  } else {
+    double elapsed = 0;
+    while (elapsed < kWarmUpSeconds + seconds) {
+      const elf::SharedMem* batch = ctx.wait();
+      echo->evaluate(
+          *ctx.getSharedMem(batch->getSharedMemOptions().getIdx()));
+      ctx.step();
+
+      elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+      if (!recorder.measuring && elapsed >= kWarmUpSeconds) {
+        recorder.measuring = true;
+        measure_start = Clock::now();
+      }
+    }
+  }
+  recorder.measuring = false;
+  const double measured =
+      std::chrono::duration<double>(Clock::now() - measure_start).count();
+  const std::string collectors = ctx.collectorInfo();
+  ctx.stop();
+
+  std::string name = "Context games=" + std::to_string(num_games) +
+      " bs=" + std::to_string(batchsize) + " t=" +
+      std::to_string(timeout_usec);
+  if (states_per_request > 1) {
+    name += " x" + std::to_string(states_per_request);
+  }
+  if (num_shards > 1) {
+    name += " shards=" + std::to_string(num_shards);
+  }
+  if (in_process) {
+    name += " in-process";
+  }
+  if (fiber_workers > 0) {
+    name += " fibers=" + std::to_string(fiber_workers);
+  }
+  recorder.report(name, measured, echo->batches, echo->states, batchsize);
+  if (num_shards > 1) {
+    printf("%s", collectors.c_str());
+  }
+}
+
+template <
+    template <typename> class ClientQueue,
+    template <typename> class ServerQueue>
+void runComm(
+    const std::string& queue,
+    int num_games,
+    int batchsize,
+    int timeout_usec,
+    double seconds) {
+  using Comm = comm::CommT<int*, true, ClientQueue, ServerQueue>;
+  Comm comm;
+  auto server = comm.getServer();
+  auto client = comm.getClient();
+
+  Recorder recorder(num_games);
+  std::atomic<bool> stop(false);
+  std::atomic<int> num_done(0);
+  std::atomic<int64_t> batches(0), num_states(0);
+
+  std::thread consumer([&]() {
+    server->RegServer("actor");
+    comm::RecvOptions options("actor", batchsize, timeout_usec);
+    // Finite timeout while stopping, so that the last batches go out.
+    comm::RecvOptions stopping("actor", batchsize, 1000);
+    std::vector<typename Comm::Message> batch;
+    while (num_done < num_games) {
+      server->waitBatch(stop ? stopping : options, &batch);
+      if (recorder.measuring) {
+        batches++;
+        for (const auto& m : batch) {
+          num_states += m.data.size();
+        }
+      }
+      server->ReleaseBatch(batch, comm::SUCCESS);
+    }
+  });
+  server->waitForRegs(1);
+
+  std::vector<std::thread> games;
+  for (int i = 0; i < num_games; ++i) {
+    games.emplace_back([&, i]() {
+      const std::vector<std::string> labels{"actor"};
+      int data = 0;
+      while (!stop) {
+        recorder.request(i, [&]() { client->sendWait(&data, labels); });
+      }
+      num_done++;
+    });
+  }
+
+  sleepSeconds(kWarmUpSeconds);
+  recorder.measuring = true;
+  const auto start = Clock::now();
+  sleepSeconds(seconds);
+  recorder.measuring = false;
+  const double measured =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  stop = true;
+  for (auto& t : games) {
+    t.join();
+  }
+  consumer.join();
+
+  recorder.report(
+      "CommT " + queue + " games=" + std::to_string(num_games) +
+          " bs=" + std::to_string(batchsize),
+      measured,
+      batches,
+      num_states,
+      batchsize);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+
+  for (int num_games : {16, 64, 256}) {
+    for (int batchsize : {16, 64}) {
+      for (int timeout_usec : {10, 1000}) {
+        runContext(
+            num_games, batchsize, timeout_usec, 1, 1, false, 0, seconds);
+      }
+    }
+  }
+  runContext(64, 64, 1000, 4, 1, false, 0, seconds);
+  for (int num_shards : {2, 4}) {
+    runContext(256, 64, 1000, 1, num_shards, false, 0, seconds);
+  }
+  for (int num_games : {64, 256}) {
+    runContext(num_games, 64, 1000, 1, 1, true, 0, seconds);
+  }
+  for (int num_games : {256, 2048}) {
+    runContext(num_games, 64, 1000, 1, 1, false, 4, seconds);
+    runContext(num_games, 64, 1000, 1, 1, true, 4, seconds);
+  }
+
+  using namespace elf::concurrency;
+  for (int num_games : {16, 256}) {
+    runComm<ConcurrentQueueMoodyCamel, ConcurrentQueueMoodyCamel>(
+        "moodycamel", num_games, 16, 1000, seconds);
+    runComm<ConcurrentQueueRingSmall, ConcurrentQueueRing>(
+        "ring", num_games, 16, 1000, seconds);
+    runComm<ConcurrentQueueTBB, ConcurrentQueueTBB>(
+        "tbb", num_games, 16, 1000, seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,314 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "evaluator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "context.h"
+
+namespace elf {
+
+namespace {
+
+constexpr int kInputSize = 4;
+constexpr int kOutputSize = 3;
+
+struct State {
+  std::vector<float> x = std::vector<float>(kInputSize);
+  std::vector<float> pi = std::vector<float>(kOutputSize);
+  float v = 0;
+  int64_t a = -1;
+};
+
+// Fails each batch, after a while.
+class SlowFailingEvaluator : public Evaluator {
+ public:
+  comm::ReplyStatus evaluate(SharedMem&) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return comm::FAILED;
+  }
+};
+
+// A Context whose "actor" batches are served by an Evaluator, with game
+// threads checking each reply.
+class EvaluatorTest : public ::testing::Test {
+ protected:
+  static constexpr int kBatchSize = 8;
+  static constexpr int kNumGames = 16;
+  static constexpr int kNumFiberGames = 256;
+  static constexpr int kRequestsPerGame = 50;
+
+  Context ctx_;
+  std::vector<std::vector<float>> x_, pi_, v_;
+  std::vector<std::vector<int64_t>> a_;
+  std::atomic<int> numRequests_{0};
+  std::atomic<int> numFailed_{0};
+
+  void SetUp() override {
+    auto& e = ctx_.getExtractor();
+    e.addField<float>("x")
+        .addExtents(kBatchSize, {kBatchSize, kInputSize})
+        .addFunction<State>([](const State& s, float* p) {
+          std::copy(s.x.begin(), s.x.end(), p);
+        });
+    e.addField<float>("pi")
+        .addExtents(kBatchSize, {kBatchSize, kOutputSize})
+        .addFunction<State>([](State& s, const float* p) {
+          std::copy(p, p + kOutputSize, s.pi.begin());
+        });
+    e.addField<float>("v").addExtent(kBatchSize).addFunction<State>(
+        [](State& s, const float* p) { s.v = *p; });
+    e.addField<int64_t>("a").addExtent(kBatchSize).addFunction<State>(
+        [](State& s, const int64_t* p) { s.a = *p; });
+  }
+
+  void allocate(
+      int num_shards,
+      int num_buffers,
+      const std::string& label = "actor") {
+    SharedMemOptions opts = ctx_.createSharedMemOptions(label, kBatchSize);
+    opts.setTimeout(100);
+    opts.setNumBuffers(num_buffers);
+    for (int k = 0; k < num_shards; ++k) {
+      const int first =
+          ctx_.allocateSharedMem(opts, {"x", "pi", "v", "a"})
+              .getSharedMemOptions()
+              .getIdx();
+      for (int i = first; i < first + num_buffers; ++i) {
+        SharedMem& smem = *ctx_.getSharedMem(i);
+        x_.emplace_back(kBatchSize * kInputSize);
+        pi_.emplace_back(kBatchSize * kOutputSize);
+        v_.emplace_back(kBatchSize);
+        a_.emplace_back(kBatchSize);
+        const int elem = sizeof(float);
+        smem["x"]->setAddress(
+            (uint64_t)x_.back().data(), {kInputSize * elem, elem});
+        smem["pi"]->setAddress(
+            (uint64_t)pi_.back().data(), {kOutputSize * elem, elem});
+        smem["v"]->setAddress((uint64_t)v_.back().data(), {elem});
+        smem["a"]->setAddress(
+            (uint64_t)a_.back().data(), {(int)sizeof(int64_t)});
+      }
+    }
+  }
+
+  // Run the games until they have sent kRequestsPerGame requests each on
+  // average. As Context::stop() expects, they keep sending until stopped.
+  void run(
+      std::function<bool(int game_idx, const State&)> check,
+      int num_games = kNumGames) {
+    ctx_.setStartCallback(
+        num_games,
+        [&, check](int i, GameClient* client) {
+          State s;
+          auto funcs = client->BindStateToFunctions({"actor"}, &s);
+          for (int n = 0; !client->DoStopGames(); ++n) {
+            for (int k = 0; k < kInputSize; ++k) {
+              s.x[k] = i + n + k;
+            }
+            s.a = -1;
+            if (client->sendWait({"actor"}, &funcs) != comm::SUCCESS ||
+                !check(i, s)) {
+              numFailed_++;
+            }
+            numRequests_++;
+          }
+        },
+        true);
+    ctx_.start();
+    while (numRequests_ < num_games * kRequestsPerGame) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ctx_.stop();
+  }
+};
+
+} // namespace
+
+TEST_F(EvaluatorTest, Constant) {
+  allocate(1, 1);
+  auto evaluator = std::make_unique<ConstantEvaluator<float>>();
+  evaluator->set("v", 0.5).set("pi", 0.25);
+  ctx_.setEvaluator("actor", std::move(evaluator));
+
+  run([](int, const State& s) {
+    return s.v == 0.5 && s.pi == std::vector<float>(kOutputSize, 0.25);
+  });
+  EXPECT_EQ(numFailed_, 0);
+}
+
+TEST_F(EvaluatorTest, Random) {
+  allocate(1, 1);
+  auto evaluator = std::make_unique<RandomEvaluator<int64_t>>(1);
+  evaluator->set("a", 3, 5);
+  ctx_.setEvaluator("actor", std::move(evaluator));
+
+  run([](int, const State& s) { return s.a >= 3 && s.a <= 5; });
+  EXPECT_EQ(numFailed_, 0);
+}
+
+TEST_F(EvaluatorTest, Dense) {
+  allocate(1, 1);
+  // pi = relu(x) summed in pairs, (x0 + x1, x2 + x3, 1).
+  auto evaluator = std::make_unique<DenseEvaluator>(
+      "x", kInputSize, "pi", kOutputSize, kInputSize);
+  std::vector<float> w1(kInputSize * kInputSize, 0);
+  for (int k = 0; k < kInputSize; ++k) {
+    w1[k * kInputSize + k] = 1;
+  }
+  evaluator->setWeights(
+      w1,
+      std::vector<float>(kInputSize, 0),
+      {1, 1, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0},
+      {0, 0, 1});
+  ctx_.setEvaluator("actor", std::move(evaluator));
+
+  run([](int, const State& s) {
+    return s.pi[0] == s.x[0] + s.x[1] && s.pi[1] == s.x[2] + s.x[3] &&
+        s.pi[2] == 1;
+  });
+  EXPECT_EQ(numFailed_, 0);
+}
+
+TEST_F(EvaluatorTest, SequentialOverShardsAndBuffers) {
+  allocate(2, 2);
+  auto evaluator = std::make_unique<SequentialEvaluator>();
+  evaluator->add(std::make_unique<DenseEvaluator>(
+      "x", kInputSize, "pi", kOutputSize, 16, true, 7));
+  auto value = std::make_unique<ConstantEvaluator<float>>();
+  value->set("v", -1);
+  evaluator->add(std::move(value));
+  ctx_.setEvaluator("actor", std::move(evaluator));
+
+  run([](int, const State& s) {
+    float total = 0;
+    for (float p : s.pi) {
+      if (p < 0) {
+        return false;
+      }
+      total += p;
+    }
+    return std::abs(total - 1) < 1e-5 && s.v == -1;
+  });
+  EXPECT_EQ(numFailed_, 0);
+  // Both shards served batches.
+  const std::string info = ctx_.collectorInfo();
+  EXPECT_NE(info.find("actor[1]"), std::string::npos);
+  EXPECT_EQ(info.find("#batches: 0,"), std::string::npos);
+}
+
+TEST_F(EvaluatorTest, FiberGames) {
+  allocate(2, 1);
+  auto evaluator = std::make_unique<DenseEvaluator>(
+      "x", kInputSize, "pi", kOutputSize, kInputSize);
+  std::vector<float> w1(kInputSize * kInputSize, 0);
+  for (int k = 0; k < kInputSize; ++k) {
+    w1[k * kInputSize + k] = 1;
+  }
+  evaluator->setWeights(
+      w1,
+      std::vector<float>(kInputSize, 0),
+      {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0},
+      {0, 0, (float)kNumFiberGames});
+  ctx_.setEvaluator("actor", std::move(evaluator));
+  ctx_.setFiberMode(3, 64 * 1024);
+
+  // Each game gets the reply to its own state.
+  run(
+      [](int, const State& s) {
+        return s.pi[0] == s.x[0] && s.pi[1] == s.x[1] &&
+            s.pi[2] == kNumFiberGames;
+      },
+      kNumFiberGames);
+  EXPECT_EQ(numFailed_, 0);
+}
+
+TEST_F(EvaluatorTest, FiberGamesOverShards) {
+  allocate(2, 1);
+  auto evaluator = std::make_unique<ConstantEvaluator<float>>();
+  evaluator->set("v", 0.5);
+  ctx_.setEvaluator("actor", std::move(evaluator));
+  // All games share a thread, but each one picks its own shard.
+  ctx_.setFiberMode(1, 64 * 1024);
+
+  run([](int, const State& s) { return s.v == 0.5; }, kNumFiberGames);
+  EXPECT_EQ(numFailed_, 0);
+  const std::string info = ctx_.collectorInfo();
+  EXPECT_NE(info.find("actor[1]"), std::string::npos);
+  EXPECT_EQ(info.find("#batches: 0,"), std::string::npos);
+}
+
+TEST_F(EvaluatorTest, FiberGamesMixedLabels) {
+  allocate(1, 1);
+  allocate(1, 1, "critic");
+  auto actor = std::make_unique<ConstantEvaluator<float>>();
+  actor->set("v", 0.5);
+  ctx_.setEvaluator("actor", std::move(actor));
+  ctx_.setEvaluator("critic", std::make_unique<SlowFailingEvaluator>());
+  ctx_.setFiberMode(2, 64 * 1024);
+
+  // Even games ask the actor, odd ones the slow critic, on the same
+  // workers. Each game gets the status of its own request, and the actor
+  // games do not wait for the critic.
+  const std::vector<std::string> labels = {"actor", "critic"};
+  std::atomic<int> num_requests[2];
+  num_requests[0] = num_requests[1] = 0;
+  ctx_.setStartCallback(
+      kNumFiberGames,
+      [&](int i, GameClient* client) {
+        const int k = i % 2;
+        State s;
+        auto funcs = client->BindStateToFunctions({labels[k]}, &s);
+        while (!client->DoStopGames()) {
+          s.v = 0;
+          const comm::ReplyStatus status =
+              client->sendWait({labels[k]}, &funcs);
+          if (k == 0 ? status != comm::SUCCESS || s.v != 0.5
+                     : status != comm::FAILED) {
+            numFailed_++;
+          }
+          num_requests[k]++;
+        }
+      },
+      true);
+  ctx_.start();
+  while (num_requests[1] < kNumFiberGames / 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  const int num_actor = num_requests[0];
+  const int num_critic = num_requests[1];
+  ctx_.stop();
+  EXPECT_EQ(numFailed_, 0);
+  EXPECT_GT(num_actor, 4 * num_critic);
+}
+
+TEST_F(EvaluatorTest, FiberModeNeedsFiberSafeGames) {
+  allocate(1, 1);
+  ctx_.setFiberMode(1, 64 * 1024);
+  ctx_.setStartCallback(1, [](int, GameClient*) {});
+  EXPECT_THROW(ctx_.start(), std::logic_error);
+}
+
+} // namespace elf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
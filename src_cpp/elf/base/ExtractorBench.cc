@@ -0,0 +1,223 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Cost of running the extractor functions of a batch (state2mem and
+// mem2state), with no comm involved.
+//
+// plan:   FuncsWithState::transfer, i.e. the bindings resolved by
+//         BindStateToFunctions and fields looked up by id.
+// legacy: the path transfers took before, rebuilt here: per state, a
+//         string-keyed map of std::bind'ed std::function wrappers around
+//         the functions, and a SharedMem lookup by key per field.
+//
+// Run with Go-like fields, either small ones only or with AGZ features.
+//
+// Usage: ExtractorBench [num_batches]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "elf/base/context.h"
+
+namespace {
+
+constexpr int kNumActions = 19 * 19 + 1;
+
+struct State {
+  std::vector<float> s;
+  float v = 0.5;
+  int32_t rv = 1;
+  int64_t hash = 42;
+  std::vector<float> pi = std::vector<float>(kNumActions);
+  float V = 0;
+  int64_t a = 0;
+};
+
+using S2M = elf::FuncStateToMem;
+using M2S = elf::FuncMemToState;
+
+// The bindings of one state in the legacy path.
+struct Legacy {
+  std::unordered_map<std::string, S2M::OutputFuncType> s2m;
+  std::unordered_map<std::string, M2S::OutputFuncType> m2s;
+};
+
+// Registers fields with the Context, and keeps what the legacy path needs
+// to bind them the way it did.
+class Fields {
+ public:
+  Fields(elf::Context* ctx, int batchsize) : ctx_(ctx), bs_(batchsize) {}
+
+  template <typename T>
+  void s2m(
+      const std::string& key,
+      int size,
+      std::function<void(const State&, T*)> f) {
+    ctx_->getExtractor()
+        .addField<T>(key)
+        .addExtents(bs_, {bs_, size})
+        .template addFunction<State>(f);
+    s2m_.emplace_back(key, [f](const State& s, elf::AnyP& anyp, int i) {
+      f(s, anyp.template getAddress<T>({i}));
+    });
+    keys_.push_back(key);
+    strides_.push_back({(int)(size * sizeof(T)), (int)sizeof(T)});
+  }
+
+  template <typename T>
+  void m2s(
+      const std::string& key,
+      int size,
+      std::function<void(State&, const T*)> f) {
+    ctx_->getExtractor()
+        .addField<T>(key)
+        .addExtents(bs_, {bs_, size})
+        .template addFunction<State>(f);
+    m2s_.emplace_back(key, [f](State& s, const elf::AnyP& anyp, int i) {
+      f(s, anyp.template getAddress<T>({i}));
+    });
+    keys_.push_back(key);
+    strides_.push_back({(int)(size * sizeof(T)), (int)sizeof(T)});
+  }
+
+  elf::SharedMem& allocate() {
+    elf::SharedMem& smem = ctx_->allocateSharedMem(
+        ctx_->createSharedMemOptions("actor", bs_), keys_);
+    for (size_t k = 0; k < keys_.size(); ++k) {
+      mem_.emplace_back(bs_ * strides_[k][0]);
+      smem[keys_[k]]->setAddress((uint64_t)mem_.back().data(), strides_[k]);
+    }
+    return smem;
+  }
+
+  Legacy bind(State& s) const {
+    using namespace std::placeholders;
+    Legacy l;
+    for (const auto& p : s2m_) {
+      l.s2m[p.first] = std::bind(p.second, std::cref(s), _1, _2);
+    }
+    for (const auto& p : m2s_) {
+      l.m2s[p.first] = std::bind(p.second, std::ref(s), _1, _2);
+    }
+    return l;
+  }
+
+ private:
+  elf::Context* ctx_;
+  int bs_;
+  std::vector<std::string> keys_;
+  std::vector<std::vector<int>> strides_;
+  std::vector<std::vector<char>> mem_;
+  std::vector<std::pair<std::string, S2M::FuncAnyPType<State>>> s2m_;
+  std::vector<std::pair<std::string, M2S::FuncAnyPType<State>>> m2s_;
+};
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kNumRounds = 5;
+
+// Best of kNumRounds, each averaged over num_batches.
+template <typename F>
+double usecPerBatch(int num_batches, F f) {
+  double best = 0;
+  for (int round = 0; round < kNumRounds; ++round) {
+    f();
+    const auto start = Clock::now();
+    for (int i = 0; i < num_batches; ++i) {
+      f();
+    }
+    const double usec =
+        std::chrono::duration<double, std::micro>(Clock::now() - start)
+            .count() /
+        num_batches;
+    best = round == 0 ? usec : std::min(best, usec);
+  }
+  return best;
+}
+
+void run(int batchsize, int feature_size, int num_batches) {
+  elf::Context ctx;
+  Fields fields(&ctx, batchsize);
+  if (feature_size > 0) {
+    fields.s2m<float>("s", feature_size, [](const State& s, float* p) {
+      std::copy(s.s.begin(), s.s.end(), p);
+    });
+  }
+  fields.s2m<float>("v", 1, [](const State& s, float* p) { *p = s.v; });
+  fields.s2m<int32_t>(
+      "rv", 1, [](const State& s, int32_t* p) { *p = s.rv; });
+  fields.s2m<int64_t>(
+      "hash", 1, [](const State& s, int64_t* p) { *p = s.hash; });
+  fields.m2s<float>("pi", kNumActions, [](State& s, const float* p) {
+    std::copy(p, p + kNumActions, s.pi.begin());
+  });
+  fields.m2s<float>("V", 1, [](State& s, const float* p) { s.V = *p; });
+  fields.m2s<int64_t>("a", 1, [](State& s, const int64_t* p) { s.a = *p; });
+  elf::SharedMem& smem = fields.allocate();
+
+  std::vector<State> states(batchsize);
+  std::vector<State*> ptrs;
+  for (auto& s : states) {
+    s.s.resize(feature_size, 1.0);
+    ptrs.push_back(&s);
+  }
+  auto funcs = ctx.getClient()->BindStateToFunctions({"actor"}, ptrs);
+  std::vector<Legacy> legacy;
+  for (auto& s : states) {
+    legacy.push_back(fields.bind(s));
+  }
+
+  const double plan = usecPerBatch(num_batches, [&]() {
+    for (int i = 0; i < batchsize; ++i) {
+      funcs[i].state_to_mem_funcs.transfer(i, smem);
+    }
+    for (int i = 0; i < batchsize; ++i) {
+      funcs[i].mem_to_state_funcs.transfer(i, smem);
+    }
+  });
+  const double old = usecPerBatch(num_batches, [&]() {
+    for (int i = 0; i < batchsize; ++i) {
+      for (const auto& p : legacy[i].s2m) {
+        p.second(*smem[p.first], i);
+      }
+    }
+    for (int i = 0; i < batchsize; ++i) {
+      for (const auto& p : legacy[i].m2s) {
+        p.second(*smem[p.first], i);
+      }
+    }
+  });
+
+  printf(
+      "bs=%-5d features=%-5d plan %9.1f us/batch, legacy %9.1f us/batch, "
+      "x%.2f\n",
+      batchsize,
+      feature_size,
+      plan,
+      old,
+      old / plan);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const int num_batches = argc > 1 ? atoi(argv[1]) : 200;
+
+  for (int batchsize : {256, 1024}) {
+    // Small fields only, then with AGZ input planes.
+    run(batchsize, 0, num_batches);
+    run(batchsize, 18 * 19 * 19, num_batches);
+  }
+  return 0;
+}
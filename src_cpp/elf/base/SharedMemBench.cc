@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Batch latency of the SharedMem transfer modes (SERVER, CLIENT, PARALLEL):
+// game threads send AGZ-sized float features, the consumer returns a policy.
+//
+// Usage: SharedMemBench [batchsize] [transfer_threads] [num_batches]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "elf/base/context.h"
+
+namespace {
+
+constexpr int kNumPlanes = 18;
+constexpr int kBoardRegion = 19 * 19;
+constexpr int kStateSize = kNumPlanes * kBoardRegion;
+constexpr int kNumActions = kBoardRegion + 1;
+constexpr int kNumGameThreads = 8;
+
+struct State {
+  std::vector<float> features = std::vector<float>(kStateSize, 1.0);
+  std::vector<float> pi = std::vector<float>(kNumActions);
+};
+
+void extractFeatures(const State& s, float* f) {
+  std::copy(s.features.begin(), s.features.end(), f);
+}
+
+void replyPi(State& s, const float* pi) {
+  std::copy(pi, pi + kNumActions, s.pi.begin());
+}
+
+// Average usec per batch, from the consumer's point of view.
+double run(
+    elf::SharedMemOptions::TransferType type,
+    int batchsize,
+    int transfer_threads,
+    int num_batches) {
+  elf::Context ctx;
+  auto& e = ctx.getExtractor();
+  e.addField<float>("s")
+      .addExtents(batchsize, {batchsize, kNumPlanes, kBoardRegion})
+      .addFunction<State>(extractFeatures);
+  e.addField<float>("pi")
+      .addExtents(batchsize, {batchsize, kNumActions})
+      .addFunction<State>(replyPi);
+
+  elf::SharedMemOptions opts = ctx.createSharedMemOptions("actor", batchsize);
+  if (type == elf::SharedMemOptions::PARALLEL) {
+    opts.setParallelTransfer(transfer_threads);
+  } else {
+    opts.setTransferType(type);
+  }
+  elf::SharedMem& smem = ctx.allocateSharedMem(opts, {"s", "pi"});
+
+  std::vector<float> s(batchsize * kStateSize);
+  std::vector<float> pi(batchsize * kNumActions, 0.5);
+  const int elem = sizeof(float);
+  smem["s"]->setAddress(
+      (uint64_t)s.data(), {kStateSize * elem, kBoardRegion * elem, elem});
+  smem["pi"]->setAddress((uint64_t)pi.data(), {kNumActions * elem, elem});
+
+  // Each game thread sends its share of the batch in one message.
+  const int per_thread = batchsize / kNumGameThreads;
+  ctx.setStartCallback(kNumGameThreads, [&](int, elf::GameClient* client) {
+    std::vector<State> states(per_thread);
+    std::vector<State*> ptrs;
+    for (auto& state : states) {
+      ptrs.push_back(&state);
+    }
+    auto funcs = client->BindStateToFunctions({"actor"}, ptrs);
+    std::vector<elf::FuncsWithState*> funcs_ptrs;
+    for (auto& f : funcs) {
+      funcs_ptrs.push_back(&f);
+    }
+    while (!client->DoStopGames()) {
+      client->sendBatchWait({"actor"}, funcs_ptrs);
+    }
+  });
+  ctx.start();
+
+  // Warm up.
+  for (int i = 0; i < 3; ++i) {
+    ctx.wait();
+    ctx.step();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_batches; ++i) {
+    ctx.wait();
+    ctx.step();
+  }
+  auto end = std::chrono::steady_clock::now();
+  ctx.stop();
+  return std::chrono::duration<double, std::micro>(end - start).count() /
+      num_batches;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const int batchsize = argc > 1 ? atoi(argv[1]) : 1024;
+  const int transfer_threads = argc > 2 ? atoi(argv[2]) : 4;
+  const int num_batches = argc > 3 ? atoi(argv[3]) : 100;
+
+  if (batchsize % kNumGameThreads != 0) {
+    printf("batchsize must be a multiple of %d\n", kNumGameThreads);
+    return 1;
+  }
+
+  printf(
+      "batchsize %d, %d floats/state, %d game threads\n",
+      batchsize,
+      kStateSize,
+      kNumGameThreads);
+  printf(
+      "SERVER:   %10.1f us/batch\n",
+      run(elf::SharedMemOptions::SERVER, batchsize, 1, num_batches));
+  printf(
+      "CLIENT:   %10.1f us/batch\n",
+      run(elf::SharedMemOptions::CLIENT, batchsize, 1, num_batches));
+  printf(
+      "PARALLEL: %10.1f us/batch (%d threads)\n",
+      run(elf::SharedMemOptions::PARALLEL,
+          batchsize,
+          transfer_threads,
+          num_batches),
+      transfer_threads);
+  return 0;
+}
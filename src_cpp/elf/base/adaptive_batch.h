@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "elf/comm/broadcast.h"
+
+namespace elf {
+
+// Bounds and goal of AdaptiveBatchController. The upper bound of the batch
+// size is the batchsize the SharedMem was allocated with.
+struct AdaptiveBatchOptions {
+  bool enabled = false;
+  int min_batchsize = 1;
+  int min_timeout_usec = 0;
+  int max_timeout_usec = 10000;
+  // > 0: keep the request latency (waiting for the batch to fill plus
+  // service) around this.
+  // <= 0: throughput. Gather about as many requests as arrive during one
+  // service, so the next batch is ready when the consumer is.
+  int target_latency_usec = 0;
+  // Weight of the newest sample in the moving averages.
+  float smoothing = 0.1;
+
+  std::string info() const {
+    std::stringstream ss;
+    ss << "[min_bs=" << min_batchsize << "][timeout_usec=" << min_timeout_usec
+       << "-" << max_timeout_usec << "]";
+    if (target_latency_usec > 0) {
+      ss << "[target_latency_usec=" << target_latency_usec << "]";
+    } else {
+      ss << "[target=throughput]";
+    }
+    return ss.str();
+  }
+};
+
+// Picks the batch size and timeout of a collector's next batch from the
+// observed request arrival rate and consumer service time. Thread-safe:
+// batches may be collected and served on different threads.
+class AdaptiveBatchController {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Stats {
+    // Last decision.
+    int batchsize = 0;
+    int timeout_usec = 0;
+    // Moving averages.
+    float arrival_per_msec = 0.0;
+    float service_usec = 0.0;
+    int64_t num_batches = 0;
+  };
+
+  AdaptiveBatchController(
+      const AdaptiveBatchOptions& options,
+      const comm::WaitOptions& initial)
+      : options_(options), max_batchsize_(initial.batchsize) {
+    options_.min_batchsize =
+        std::min(std::max(options_.min_batchsize, 1), max_batchsize_);
+    stats_.batchsize = initial.batchsize;
+    stats_.timeout_usec = initial.timeout_usec;
+  }
+
+  // A batch of n requests was collected.
+  void onBatchCollected(int n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = Clock::now();
+    if (stats_.num_batches > 0) {
+      // Requests per usec since the previous batch. When the consumer is
+      // the bottleneck this is the service rate, hence the growth rule in
+      // decide() for full batches.
+      const float elapsed = std::max<float>(
+          1.0,
+          std::chrono::duration<float, std::micro>(now - last_collected_)
+              .count());
+      average(&arrival_per_usec_, n / elapsed, stats_.num_batches == 1);
+    }
+    last_collected_ = now;
+    last_full_ = n >= stats_.batchsize;
+    stats_.num_batches++;
+  }
+
+  // The consumer returned a batch after service_usec.
+  void onBatchServed(float service_usec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    average(&stats_.service_usec, service_usec, num_served_ == 0);
+    num_served_++;
+  }
+
+  // Decide the next batch and write it into opt.
+  void apply(comm::WaitOptions* opt) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    decide();
+    opt->batchsize = stats_.batchsize;
+    opt->timeout_usec = stats_.timeout_usec;
+    // At least 1: the timeout only runs once a request has arrived, so an
+    // idle collector still blocks instead of sending empty batches.
+    opt->min_batchsize = options_.min_batchsize;
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s = stats_;
+    s.arrival_per_msec = arrival_per_usec_ * 1000;
+    return s;
+  }
+
+  std::string info() const {
+    const Stats s = stats();
+    std::stringstream ss;
+    ss << options_.info() << " bs: " << s.batchsize
+       << ", timeout_usec: " << s.timeout_usec
+       << ", arrival/msec: " << s.arrival_per_msec
+       << ", service_usec: " << s.service_usec
+       << ", #batches: " << s.num_batches;
+    return ss.str();
+  }
+
+ private:
+  AdaptiveBatchOptions options_;
+  const int max_batchsize_;
+
+  mutable std::mutex mutex_;
+  Stats stats_;
+  float arrival_per_usec_ = 0.0;
+  int64_t num_served_ = 0;
+  Clock::time_point last_collected_;
+  bool last_full_ = false;
+
+  void average(float* avg, float sample, bool first) const {
+    *avg = first ? sample : *avg + options_.smoothing * (sample - *avg);
+  }
+
+  void decide() {
+    // Keep the initial setting until both rates have been seen.
+    if (stats_.num_batches < 2 || num_served_ == 0 ||
+        arrival_per_usec_ <= 0) {
+      return;
+    }
+
+    // Time we can afford to wait for requests.
+    float budget = stats_.service_usec;
+    if (options_.target_latency_usec > 0) {
+      budget = std::max<float>(
+          options_.target_latency_usec - stats_.service_usec, 0.0);
+    }
+
+    int batchsize = (int)std::lround(arrival_per_usec_ * budget);
+    if (last_full_) {
+      // The batch filled up, so requests may be queueing: grow.
+      batchsize = std::max(batchsize, stats_.batchsize + stats_.batchsize / 4);
+      batchsize = std::max(batchsize, stats_.batchsize + 1);
+    }
+    stats_.batchsize =
+        std::min(std::max(batchsize, options_.min_batchsize), max_batchsize_);
+
+    // The timeout is the longest gap between two requests before an
+    // incomplete batch is sent: a couple of mean inter-arrival times, but
+    // no more than the budget. Never 0, which would mean no timeout.
+    const float gap = std::min(2 / arrival_per_usec_, std::max(budget, 1.0f));
+    stats_.timeout_usec = std::min(
+        std::max((int)gap, std::max(options_.min_timeout_usec, 1)),
+        options_.max_timeout_usec);
+  }
+};
+
+} // namespace elf
@@ -11,11 +11,16 @@
 #include <assert.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -25,7 +30,9 @@
 #include "elf/concurrency/ConcurrentQueue.h"
 #include "elf/concurrency/Counter.h"
 #include "elf/logging/IndexedLoggerFactory.h"
+#include "evaluator.h"
 #include "extractor.h"
+#include "fiber_worker.h"
 #include "sharedmem.h"
 
 namespace elf {
@@ -71,16 +78,30 @@ class GameClient {
       const std::vector<std::string>& smem_names,
       const std::vector<S*>& batch_s);
 
+  // HIGH priority requests (e.g. interactive play) go ahead of the NORMAL
+  // ones into the next batch of each target.
+  // Games run by a FiberWorker (see Context::setFiberMode) suspend here
+  // instead of blocking their thread.
   comm::ReplyStatus sendWait(
       const std::vector<std::string>& targets,
-      FuncsWithState* funcs) {
-    return client_->sendWait(funcs, targets);
+      FuncsWithState* funcs,
+      comm::Priority priority = comm::NORMAL) {
+    FiberWorker* worker = FiberWorker::current();
+    if (worker != nullptr) {
+      return worker->sendWait(targets, &funcs, 1, priority);
+    }
+    return client_->sendWait(funcs, targets, priority);
   }
 
   comm::ReplyStatus sendBatchWait(
       const std::vector<std::string>& targets,
-      const std::vector<FuncsWithState*>& funcs) {
-    return client_->sendBatchWait(funcs, targets);
+      const std::vector<FuncsWithState*>& funcs,
+      comm::Priority priority = comm::NORMAL) {
+    FiberWorker* worker = FiberWorker::current();
+    if (worker != nullptr) {
+      return worker->sendWait(targets, funcs.data(), funcs.size(), priority);
+    }
+    return client_->sendBatchWait(funcs, targets, priority);
   }
 
  private:
@@ -114,13 +135,57 @@ class Context {
     GameStateCollector(
         Server* server,
         BatchClient* batchClient,
-        std::unique_ptr<SharedMem>&& smem)
-        : server_(server), batchClient_(batchClient), smem_(std::move(smem)) {
-      assert(smem_.get() != nullptr);
+        std::vector<std::unique_ptr<SharedMem>>&& smems)
+        : server_(server), batchClient_(batchClient) {
+      assert(!smems.empty());
+      for (auto& smem : smems) {
+        assert(smem.get() != nullptr);
+        buffers_.emplace_back(new Buffer(std::move(smem)));
+      }
+
+      SharedMem& first = *buffers_[0]->smem;
+      batchsize_ = first.getSharedMemOptions().getBatchSize();
+      const auto& adaptive = first.getSharedMemOptions().getAdaptiveOptions();
+      if (adaptive.enabled) {
+        controller_.reset(new AdaptiveBatchController(
+            adaptive, first.getSharedMemOptions().getRecvOptions().wait_opt));
+      }
+    }
+
+    SharedMem& smem(size_t i = 0) {
+      return *buffers_[i]->smem;
+    }
+
+    size_t numBuffers() const {
+      return buffers_.size();
     }
 
-    SharedMem& smem() {
-      return *smem_;
+    const std::string& label() const {
+      return buffers_[0]->smem->getSharedMemOptions().getRecvOptions().label;
+    }
+
+    // nullptr unless the SharedMemOptions asked for adaptive batching.
+    const AdaptiveBatchController* controller() const {
+      return controller_.get();
+    }
+
+    // Serve batches with evaluator instead of the consumer of
+    // Context::wait(). Before start().
+    void setEvaluator(Evaluator* evaluator) {
+      evaluator_ = evaluator;
+    }
+
+    // Since start: number of batches, fill ratio (states / allocated
+    // batchsize), and mean usec spent gathering and filling a batch and
+    // waiting for the consumer to return it.
+    std::string statsInfo() const {
+      const int64_t batches = std::max<int64_t>(stats_.batches, 1);
+      std::stringstream ss;
+      ss << "#batches: " << stats_.batches << ", fill: "
+         << (double)stats_.states / (batches * batchsize_)
+         << ", collect_usec: " << stats_.collect_usec / batches
+         << ", serve_usec: " << stats_.serve_usec / batches;
+      return ss.str();
     }
 
     void start() {
@@ -146,11 +211,45 @@ class Context {
 
    private:
     enum _Msg { PREPARE_TO_STOP, STOP };
+    enum _Job { SEND, QUIT };
+
+    // One SharedMem of the ring. With more than one buffer, each has a
+    // sender thread that hands the filled batch to the consumer and
+    // releases it, while the collector thread fills the next buffer.
+    struct Buffer {
+      std::unique_ptr<SharedMem> smem;
+      std::unique_ptr<std::thread> th;
+      concurrency::ConcurrentQueue<_Job> jobs;
+      // True from fill until release.
+      concurrency::Switch busy;
+
+      explicit Buffer(std::unique_ptr<SharedMem>&& smem)
+          : smem(std::move(smem)) {}
+    };
 
     Server* server_;
     BatchClient* batchClient_;
-    std::unique_ptr<SharedMem> smem_;
+    // The consumer side of BatchComm has the empty label.
+    const std::vector<std::string> batchTargets_{""};
+    std::vector<std::unique_ptr<Buffer>> buffers_;
     std::unique_ptr<std::thread> th_;
+    std::unique_ptr<AdaptiveBatchController> controller_;
+    Evaluator* evaluator_ = nullptr;
+    // As allocated, before any adaptation.
+    int batchsize_ = 0;
+
+    // Written by the collector and sender threads, read by statsInfo().
+    struct Stats {
+      std::atomic<int64_t> batches{0};
+      std::atomic<int64_t> states{0};
+      std::atomic<int64_t> collect_usec{0};
+      std::atomic<int64_t> serve_usec{0};
+    };
+    Stats stats_;
+
+    // Serializes sessions on our server node (fill and release) across
+    // buffers.
+    std::mutex serverMutex_;
 
     concurrency::Switch completedSwitch_;
 
@@ -164,35 +263,140 @@ class Context {
       // Initialize collector. For now just use 1.
       // Each collector has its own shared memory.
       // min_batchsize = 1 and wait indefinitely (timeout = 0).
-      const SharedMemOptions& smem_opts = smem_->getSharedMemOptions();
+      const SharedMemOptions& smem_opts = smem().getSharedMemOptions();
       server_->RegServer(smem_opts.getRecvOptions().label);
 
+      if (buffers_.size() > 1) {
+        for (auto& b : buffers_) {
+          Buffer* buffer = b.get();
+          buffer->th.reset(
+              new std::thread([this, buffer]() { sendAndRelease(buffer); }));
+        }
+      }
+
+      // Once stopping, batches are flushed with the short timeout below and
+      // are no longer adapted.
+      bool adapt = controller_ != nullptr;
+
+      size_t next = 0;
       while (true) {
         _Msg msg;
         if (msgQueue_.pop(&msg, std::chrono::microseconds(0))) {
           if (msg == PREPARE_TO_STOP) {
             // << smem_opts.info() << std::endl;
 
-            smem_->setMinBatchSize(0);
-            smem_->setTimeout(2);
+            for (auto& b : buffers_) {
+              b->smem->setMinBatchSize(0);
+              b->smem->setTimeout(2);
+            }
+            adapt = false;
             completedSwitch_.set(true);
           } else if (msg == STOP) {
+            stopSenders();
             completedSwitch_.set(true);
             break;
           }
         }
-        smem_->waitBatchFillMem(server_);
+
+        if (buffers_.size() > 1) {
+          // Fill the next buffer in the ring once it has been released.
+          Buffer* buffer = buffers_[next].get();
+          next = (next + 1) % buffers_.size();
+
+          buffer->busy.waitUntilFalse();
+          if (adapt) {
+            controller_->apply(&buffer->smem->getWaitOptions());
+          }
+          const auto start = std::chrono::steady_clock::now();
+          buffer->smem->waitBatch(server_);
+          if (adapt) {
+            controller_->onBatchCollected(
+                buffer->smem->getEffectiveBatchSize());
+          }
+          {
+            std::lock_guard<std::mutex> lock(serverMutex_);
+            buffer->smem->fillMem(server_);
+          }
+          onCollected(*buffer->smem, start);
+          buffer->busy.set(true);
+          buffer->jobs.push(SEND);
+          continue;
+        }
+
+        SharedMem* smem = buffers_[0]->smem.get();
+        if (adapt) {
+          controller_->apply(&smem->getWaitOptions());
+        }
+        const auto start = std::chrono::steady_clock::now();
+        smem->waitBatchFillMem(server_);
         // received. #batch = "
-        //          << smem_->getEffectiveBatchSize() << std::endl;
+        //          << smem->getEffectiveBatchSize() << std::endl;
+        if (adapt) {
+          controller_->onBatchCollected(smem->getEffectiveBatchSize());
+        }
+        onCollected(*smem, start);
 
-        comm::ReplyStatus batch_status =
-            batchClient_->sendWait(smem_.get(), {""});
+        comm::ReplyStatus batch_status = send(smem);
 
         // releasing. #batch = "
-        //          << smem_->getEffectiveBatchSize() << std::endl;
+        //          << smem->getEffectiveBatchSize() << std::endl;
 
         // LOG(INFO) << "Receiver: Release batch" << std::endl;
-        smem_->waitReplyReleaseBatch(server_, batch_status);
+        smem->waitReplyReleaseBatch(server_, batch_status);
+      }
+    }
+
+    void sendAndRelease(Buffer* buffer) {
+      while (true) {
+        _Job job;
+        buffer->jobs.pop(&job);
+        if (job == QUIT) {
+          break;
+        }
+
+        comm::ReplyStatus batch_status = send(buffer->smem.get());
+        {
+          std::lock_guard<std::mutex> lock(serverMutex_);
+          buffer->smem->waitReplyReleaseBatch(server_, batch_status);
+        }
+        buffer->busy.set(false);
+      }
+    }
+
+    void onCollected(
+        const SharedMem& smem,
+        std::chrono::steady_clock::time_point start) {
+      stats_.batches++;
+      stats_.states += smem.getEffectiveBatchSize();
+      stats_.collect_usec +=
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+    }
+
+    // Hand the batch to the consumer (or the evaluator) and wait for it to
+    // come back, timing the round trip for the stats and the controller.
+    comm::ReplyStatus send(SharedMem* smem) {
+      auto start = std::chrono::steady_clock::now();
+      comm::ReplyStatus status = evaluator_ != nullptr
+          ? evaluator_->evaluate(*smem)
+          : batchClient_->sendWait(smem, batchTargets_, smem->getPriority());
+      const float usec = std::chrono::duration<float, std::micro>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+      stats_.serve_usec += (int64_t)usec;
+      if (controller_ != nullptr) {
+        controller_->onBatchServed(usec);
+      }
+      return status;
+    }
+
+    void stopSenders() {
+      for (auto& b : buffers_) {
+        if (b->th != nullptr) {
+          b->jobs.push(QUIT);
+          b->th->join();
+        }
       }
     }
   };
@@ -223,9 +427,27 @@ class Context {
     return client_.get();
   }
 
-  void setStartCallback(int num_games, GameCallback cb) {
+  // fiber_safe: the games only block in the requests of their GameClient
+  // (sendWait, sendBatchWait), so they may run as fibers (setFiberMode).
+  void setStartCallback(
+      int num_games,
+      GameCallback cb,
+      bool fiber_safe = false) {
     num_games_ = num_games;
     game_cb_ = cb;
+    gamesFiberSafe_ = fiber_safe;
+  }
+
+  // Run the games as fibers on num_workers threads (game i on worker
+  // i % num_workers) instead of one thread each, see FiberWorker. Only for
+  // games started as fiber-safe (see setStartCallback): start() throws
+  // otherwise. The Go games are not, their MCTS waits on condition
+  // variables. Call before start().
+  void setFiberMode(
+      int num_workers,
+      size_t stack_size = concurrency::Fiber::kDefaultStackSize) {
+    numFiberWorkers_ = num_workers;
+    fiberStackSize_ = stack_size;
   }
 
   void setCBAfterGameStart(std::function<void()> cb) {
@@ -251,14 +473,62 @@ class Context {
     smem2keys_[options.getRecvOptions().label] = keys;
     auto anyps = extractor_.getAnyP(keys);
 
+    // Buffers of one collector get consecutive indices, see getSharedMem().
+    std::vector<std::unique_ptr<SharedMem>> buffers;
+    for (int i = 0; i < std::max(options.getNumBuffers(), 1); ++i) {
+      buffers.emplace_back(new SharedMem(smems_.size(), options, anyps));
+      smems_.push_back(buffers.back().get());
+    }
+
     collectors_.emplace_back(new GameStateCollector(
-        server_.get(),
-        batchClient_.get(),
-        std::unique_ptr<SharedMem>(
-            new SharedMem(collectors_.size(), options, anyps))));
+        server_.get(), batchClient_.get(), std::move(buffers)));
     return collectors_.back()->smem();
   }
 
+  // SharedMem by index (SharedMemOptions::getIdx()). allocateSharedMem
+  // returns the first buffer only; the others follow it.
+  SharedMem* getSharedMem(int idx) {
+    if (idx < 0 || idx >= (int)smems_.size()) {
+      return nullptr;
+    }
+    return smems_[idx];
+  }
+
+  // What the adaptive controllers decided, one line per collector that has
+  // one.
+  std::string batchingInfo() const {
+    std::stringstream ss;
+    for (const auto& c : collectors_) {
+      if (c->controller() != nullptr) {
+        ss << c->label() << ": " << c->controller()->info() << std::endl;
+      }
+    }
+    return ss.str();
+  }
+
+  // Batches of label (all its shards) are then served by evaluator, on the
+  // collector threads, and no longer show up in wait(). This gives a path
+  // with no Python in the loop for tests and benchmarks of Context. No game
+  // sets one yet: the Go games still have their batches served by Python.
+  // Call before start().
+  void setEvaluator(
+      const std::string& label,
+      std::unique_ptr<Evaluator> evaluator) {
+    evaluators_[label] = std::move(evaluator);
+  }
+
+  // Stats of each collector, one line per collector. Collectors of the
+  // same label are its shards, numbered in order of allocation.
+  std::string collectorInfo() const {
+    std::unordered_map<std::string, int> num_shards;
+    std::stringstream ss;
+    for (const auto& c : collectors_) {
+      ss << c->label() << "[" << num_shards[c->label()]++
+         << "]: " << c->statsInfo() << std::endl;
+    }
+    return ss.str();
+  }
+
   const std::vector<std::string>* getSMemKeys(
       const std::string& smem_name) const {
     auto it = smem2keys_.find(smem_name);
@@ -271,7 +541,15 @@ class Context {
   }
 
   void start() {
+    if (numFiberWorkers_ > 0 && !gamesFiberSafe_) {
+      // A game blocking its thread would block all the games of its worker.
+      throw std::logic_error("Context: fiber mode needs fiber-safe games");
+    }
     for (auto& r : collectors_) {
+      auto it = evaluators_.find(r->label());
+      if (it != evaluators_.end()) {
+        r->setEvaluator(it->second.get());
+      }
       r->start();
     }
     server_->waitForRegs(collectors_.size());
@@ -281,13 +559,28 @@ class Context {
 
     game_threads_.clear();
     auto* client = getClient();
-    for (int i = 0; i < num_games_; ++i) {
-      game_threads_.emplace_back([i, client, this]() {
-        // assert(nice(19) == 19);
-        client->start();
-        game_cb_(i, client);
-        client->End();
-      });
+    auto run_game = [client, this](int i) {
+      client->start();
+      game_cb_(i, client);
+      client->End();
+    };
+    if (numFiberWorkers_ > 0) {
+      for (int w = 0; w < numFiberWorkers_; ++w) {
+        game_threads_.emplace_back([w, client, run_game, this]() {
+          FiberWorker worker(client->client_.get(), fiberStackSize_);
+          for (int i = w; i < num_games_; i += numFiberWorkers_) {
+            worker.add([i, run_game]() { run_game(i); }, i);
+          }
+          worker.run();
+        });
+      }
+    } else {
+      for (int i = 0; i < num_games_; ++i) {
+        game_threads_.emplace_back([i, run_game]() {
+          // assert(nice(19) == 19);
+          run_game(i);
+        });
+      }
     }
 
     if (cb_after_game_start_ != nullptr) {
@@ -372,6 +665,7 @@ class Context {
  private:
   Extractor extractor_;
   std::vector<std::unique_ptr<GameStateCollector>> collectors_;
+  std::vector<SharedMem*> smems_;
 
   Comm comm_;
   std::unique_ptr<Server> server_;
@@ -384,11 +678,16 @@ class Context {
   std::vector<BatchMessage> smem_batch_;
 
   std::unordered_map<std::string, std::vector<std::string>> smem2keys_;
+  std::unordered_map<std::string, std::unique_ptr<Evaluator>> evaluators_;
 
   int num_games_ = 0;
   GameCallback game_cb_ = nullptr;
   std::function<void()> cb_after_game_start_ = nullptr;
+  // Game threads, or fiber worker threads with setFiberMode.
   std::vector<std::thread> game_threads_;
+  bool gamesFiberSafe_ = false;
+  int numFiberWorkers_ = 0;
+  size_t fiberStackSize_ = concurrency::Fiber::kDefaultStackSize;
 
   std::shared_ptr<spdlog::logger> logger_;
 };
@@ -421,13 +720,13 @@ inline FuncsWithState GameClient::BindStateToFunctions(
       }
 
       if (funcsWithState.state_to_mem_funcs.addFunction(
-              key, funcs->BindStateToStateToMemFunc(*s))) {
+              funcs->getId(), funcs->bindStateToMem(*s))) {
         // LOG(INFO) << "GetPackage: key: " << key << "Add s2m "
         //           << std:: endl;
       }
 
       if (funcsWithState.mem_to_state_funcs.addFunction(
-              key, funcs->BindStateToMemToStateFunc(*s))) {
+              funcs->getId(), funcs->bindMemToState(*s))) {
         // LOG(INFO) << "GetPackage: key: " << key << "Add m2s "
         //           << std::endl;
       }
@@ -469,13 +768,13 @@ inline std::vector<FuncsWithState> GameClient::BindStateToFunctions(
         S* s = batch_s[i];
 
         if (funcsWithState.state_to_mem_funcs.addFunction(
-                key, funcs->BindStateToStateToMemFunc(*s))) {
+                funcs->getId(), funcs->bindStateToMem(*s))) {
           // LOG(INFO) << "GetPackage: key: " << key << "Add s2m "
           //           << std:: endl;
         }
 
         if (funcsWithState.mem_to_state_funcs.addFunction(
-                key, funcs->BindStateToMemToStateFunc(*s))) {
+                funcs->getId(), funcs->bindMemToState(*s))) {
           // LOG(INFO) << "GetPackage: key: " << key << "Add m2s "
           //           << std::endl;
         }
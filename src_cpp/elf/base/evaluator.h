@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sharedmem.h"
+
+namespace elf {
+
+// Serves the batches of a label in process, in place of the consumer of
+// Context::wait() (see Context::setEvaluator). The reference evaluators
+// below are for tests and benchmarks; they are not a model of any game.
+class Evaluator {
+ public:
+  virtual ~Evaluator() = default;
+
+  // Fill the reply fields of the first smem.getEffectiveBatchSize() entries
+  // of smem from its input fields. This may be called concurrently, for
+  // different SharedMems of the label (buffers or shards).
+  virtual comm::ReplyStatus evaluate(SharedMem& smem) = 0;
+};
+
+namespace evaluator_detail {
+
+// The reference evaluators below need each entry of a field to be
+// contiguous, as with the default (continuous) strides.
+template <typename T>
+T* entry(SharedMem& smem, const std::string& key, int i, size_t* n) {
+  AnyP* anyp = smem[key];
+  assert(anyp != nullptr);
+  const FuncMapBase& field = anyp->field();
+  *n = field.getSize().nelement() / field.getBatchSize();
+  return anyp->getAddress<T>({i});
+}
+
+} // namespace evaluator_detail
+
+// Fills reply fields with constants.
+template <typename T>
+class ConstantEvaluator : public Evaluator {
+ public:
+  ConstantEvaluator& set(const std::string& key, T value) {
+    values_.emplace_back(key, value);
+    return *this;
+  }
+
+  comm::ReplyStatus evaluate(SharedMem& smem) override {
+    for (const auto& kv : values_) {
+      for (int i = 0; i < (int)smem.getEffectiveBatchSize(); ++i) {
+        size_t n = 0;
+        T* p = evaluator_detail::entry<T>(smem, kv.first, i, &n);
+        std::fill(p, p + n, kv.second);
+      }
+    }
+    return comm::SUCCESS;
+  }
+
+ private:
+  std::vector<std::pair<std::string, T>> values_;
+};
+
+// Fills reply fields with values drawn uniformly from [lo, hi) ([lo, hi] for
+// integers).
+template <typename T>
+class RandomEvaluator : public Evaluator {
+ public:
+  explicit RandomEvaluator(uint64_t seed = 0) : rng_(seed) {}
+
+  RandomEvaluator& set(const std::string& key, T lo, T hi) {
+    ranges_.push_back({key, Distribution(lo, hi)});
+    return *this;
+  }
+
+  comm::ReplyStatus evaluate(SharedMem& smem) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& range : ranges_) {
+      for (int i = 0; i < (int)smem.getEffectiveBatchSize(); ++i) {
+        size_t n = 0;
+        T* p = evaluator_detail::entry<T>(smem, range.key, i, &n);
+        for (size_t j = 0; j < n; ++j) {
+          p[j] = range.dist(rng_);
+        }
+      }
+    }
+    return comm::SUCCESS;
+  }
+
+ private:
+  using Distribution = typename std::conditional<
+      std::is_integral<T>::value,
+      std::uniform_int_distribution<T>,
+      std::uniform_real_distribution<T>>::type;
+
+  struct Range {
+    std::string key;
+    Distribution dist;
+  };
+
+  std::mutex mutex_;
+  std::mt19937 rng_;
+  std::vector<Range> ranges_;
+};
+
+// A network with one hidden layer, on float fields:
+//   output = W2 * relu(W1 * input + b1) + b2,
+// followed by a softmax if asked for (e.g. for a policy). The weights are
+// random, drawn from the seed, unless set.
+class DenseEvaluator : public Evaluator {
+ public:
+  DenseEvaluator(
+      const std::string& input,
+      int input_size,
+      const std::string& output,
+      int output_size,
+      int hidden_size,
+      bool softmax = false,
+      uint64_t seed = 0)
+      : input_(input),
+        output_(output),
+        inputSize_(input_size),
+        outputSize_(output_size),
+        hiddenSize_(hidden_size),
+        softmax_(softmax),
+        w1_(hidden_size * input_size),
+        b1_(hidden_size),
+        w2_(output_size * hidden_size),
+        b2_(output_size) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> dist(0.0, 1.0);
+    const float scale1 = 1.0 / std::sqrt((float)input_size);
+    const float scale2 = 1.0 / std::sqrt((float)hidden_size);
+    for (auto& w : w1_) {
+      w = dist(rng) * scale1;
+    }
+    for (auto& w : w2_) {
+      w = dist(rng) * scale2;
+    }
+  }
+
+  // Row major: w1 is hidden_size x input_size, w2 output_size x hidden_size.
+  void setWeights(
+      const std::vector<float>& w1,
+      const std::vector<float>& b1,
+      const std::vector<float>& w2,
+      const std::vector<float>& b2) {
+    assert(w1.size() == w1_.size() && b1.size() == b1_.size());
+    assert(w2.size() == w2_.size() && b2.size() == b2_.size());
+    w1_ = w1;
+    b1_ = b1;
+    w2_ = w2;
+    b2_ = b2;
+  }
+
+  comm::ReplyStatus evaluate(SharedMem& smem) override {
+    // Per thread, since we may be called concurrently.
+    thread_local std::vector<float> hidden;
+    hidden.resize(hiddenSize_);
+
+    for (int i = 0; i < (int)smem.getEffectiveBatchSize(); ++i) {
+      size_t n_in = 0, n_out = 0;
+      const float* x = evaluator_detail::entry<float>(smem, input_, i, &n_in);
+      float* y = evaluator_detail::entry<float>(smem, output_, i, &n_out);
+      assert((int)n_in == inputSize_ && (int)n_out == outputSize_);
+      (void)n_in;
+      (void)n_out;
+
+      for (int h = 0; h < hiddenSize_; ++h) {
+        const float* w = &w1_[h * inputSize_];
+        float sum = b1_[h];
+        for (int k = 0; k < inputSize_; ++k) {
+          sum += w[k] * x[k];
+        }
+        hidden[h] = std::max(sum, 0.0f);
+      }
+
+      for (int o = 0; o < outputSize_; ++o) {
+        const float* w = &w2_[o * hiddenSize_];
+        float sum = b2_[o];
+        for (int h = 0; h < hiddenSize_; ++h) {
+          sum += w[h] * hidden[h];
+        }
+        y[o] = sum;
+      }
+
+      if (softmax_) {
+        const float max = *std::max_element(y, y + outputSize_);
+        float total = 0;
+        for (int o = 0; o < outputSize_; ++o) {
+          y[o] = std::exp(y[o] - max);
+          total += y[o];
+        }
+        for (int o = 0; o < outputSize_; ++o) {
+          y[o] /= total;
+        }
+      }
+    }
+    return comm::SUCCESS;
+  }
+
+ private:
+  std::string input_;
+  std::string output_;
+  int inputSize_;
+  int outputSize_;
+  int hiddenSize_;
+  bool softmax_;
+
+  std::vector<float> w1_;
+  std::vector<float> b1_;
+  std::vector<float> w2_;
+  std::vector<float> b2_;
+};
+
+// Runs several evaluators in turn, e.g. a DenseEvaluator for the policy and
+// a ConstantEvaluator for the value.
+class SequentialEvaluator : public Evaluator {
+ public:
+  SequentialEvaluator& add(std::unique_ptr<Evaluator> evaluator) {
+    evaluators_.push_back(std::move(evaluator));
+    return *this;
+  }
+
+  comm::ReplyStatus evaluate(SharedMem& smem) override {
+    for (auto& e : evaluators_) {
+      comm::ReplyStatus status = e->evaluate(smem);
+      if (status != comm::SUCCESS) {
+        return status;
+      }
+    }
+    return comm::SUCCESS;
+  }
+
+ private:
+  std::vector<std::unique_ptr<Evaluator>> evaluators_;
+};
+
+} // namespace elf
@@ -15,6 +15,7 @@
 #include <type_traits>
 #include <typeinfo>
 #include <unordered_map>
+#include <vector>
 
 #include "common.h"
 
@@ -52,12 +53,20 @@ struct FuncStateMemT {
 
   using OutputFuncType = std::function<void(AnyPType, int)>;
 
+  using StateP = typename std::conditional<use_const, const void*, void*>::type;
+
+  // The function bound to a state, resolved once so that transfers only
+  // call thunk(state, func, anyp, batch_idx): no lookup, cast or wrapper
+  // left. thunk is null if there is no function for the state's type.
+  struct Binding {
+    StateP state = nullptr;
+    const void* func = nullptr;
+    void (*thunk)(StateP, const void*, AnyPType, int) = nullptr;
+  };
+
   template <typename S, typename T>
   void Init(FuncType<S, T> func) {
-    auto f = [func](SType<S> s, AnyPType anyp, int batch_idx) {
-      func(s, anyp.template getAddress<T>({batch_idx}));
-    };
-    Init<S>(f);
+    func_.reset(new _TypedFunc<S, T>(func));
   }
 
   template <typename S>
@@ -65,29 +74,73 @@ struct FuncStateMemT {
     func_.reset(new _Func<S>(func));
   }
 
+  template <typename S>
+  Binding BindState(SType<S> s) const {
+    if (func_ == nullptr || func_->stateType != typeid(S)) {
+      return Binding();
+    }
+    return Binding{&s, func_->self, func_->thunk};
+  }
+
   template <typename S>
   OutputFuncType Bind(SType<S> s) const {
-    auto* p = dynamic_cast<_Func<S>*>(func_.get());
+    const Binding b = BindState<S>(s);
 
-    if (p == nullptr) {
+    if (b.thunk == nullptr) {
       return nullptr;
     }
 
-    return std::bind(
-        p->func, std::ref(s), std::placeholders::_1, std::placeholders::_2);
+    return [b](AnyPType anyp, int batch_idx) {
+      b.thunk(b.state, b.func, anyp, batch_idx);
+    };
   }
 
  private:
+  template <typename S>
+  using SPtr = typename std::conditional<use_const, const S*, S*>::type;
+
+  using Thunk = void (*)(StateP, const void*, AnyPType, int);
+
   class _FuncBase {
    public:
+    _FuncBase(const std::type_info& state_type, Thunk thunk)
+        : stateType(state_type), thunk(thunk) {}
     virtual ~_FuncBase() = default;
+
+    const std::type_info& stateType;
+    Thunk thunk;
+    // The derived object, as passed to thunk.
+    const void* self = nullptr;
   };
 
   template <typename S>
   class _Func : public _FuncBase {
    public:
     FuncAnyPType<S> func;
-    _Func(FuncAnyPType<S> func) : func(func) {}
+    _Func(FuncAnyPType<S> func) : _FuncBase(typeid(S), &call), func(func) {
+      this->self = this;
+    }
+
+    static void call(StateP s, const void* f, AnyPType anyp, int batch_idx) {
+      static_cast<const _Func*>(f)->func(
+          *static_cast<SPtr<S>>(s), anyp, batch_idx);
+    }
+  };
+
+  // Functions of a typed address are called with it directly.
+  template <typename S, typename T>
+  class _TypedFunc : public _FuncBase {
+   public:
+    FuncType<S, T> func;
+    _TypedFunc(FuncType<S, T> func)
+        : _FuncBase(typeid(S), &call), func(func) {
+      this->self = this;
+    }
+
+    static void call(StateP s, const void* f, AnyPType anyp, int batch_idx) {
+      static_cast<const _TypedFunc*>(f)->func(
+          *static_cast<SPtr<S>>(s), anyp.template getAddress<T>(batch_idx));
+    }
   };
 
   std::unique_ptr<_FuncBase> func_;
@@ -101,12 +154,17 @@ class FuncMapT;
 
 struct FuncMapBase {
  public:
-  FuncMapBase(const std::string& name) : name_(name) {}
+  FuncMapBase(const std::string& name, int id = -1) : name_(name), id_(id) {}
 
   const std::string& getName() const {
     return name_;
   }
 
+  // Index of the field in its Extractor, see SharedMem::field().
+  int getId() const {
+    return id_;
+  }
+
   int getBatchSize() const {
     return batchsize_;
   }
@@ -144,6 +202,30 @@ struct FuncMapBase {
     return *this;
   }
 
+  template <typename S>
+  FuncStateToMem::Binding bindStateToMem(const S& s) const {
+    auto it = state_to_mem_funcs_.find(typeid(S).name());
+    if (it == state_to_mem_funcs_.end()) {
+      return FuncStateToMem::Binding();
+    }
+    return it->second.BindState<S>(s);
+  }
+
+  // Const states (e.g. BindStateToFunctions on a const S*) cannot be
+  // written to, so they get no mem-to-state binding.
+  template <typename S>
+  FuncMemToState::Binding bindMemToState(S& s) const {
+    if constexpr (std::is_const<S>::value) {
+      return FuncMemToState::Binding();
+    } else {
+      auto it = mem_to_state_funcs_.find(typeid(S).name());
+      if (it == mem_to_state_funcs_.end()) {
+        return FuncMemToState::Binding();
+      }
+      return it->second.BindState<S>(s);
+    }
+  }
+
   template <typename S>
   FuncStateToMem::OutputFuncType BindStateToStateToMemFunc(const S& s) const {
     auto it = state_to_mem_funcs_.find(typeid(S).name());
@@ -166,6 +248,7 @@ struct FuncMapBase {
 
  protected:
   std::string name_;
+  int id_;
   int batchsize_ = 0;
   Size extents_;
 
@@ -179,7 +262,7 @@ class FuncMapT : public FuncMapBase {
  public:
   using FuncMap = FuncMapT<T>;
 
-  FuncMapT(const std::string& name) : FuncMapBase(name) {}
+  FuncMapT(const std::string& name, int id = -1) : FuncMapBase(name, id) {}
 
   std::string getTypeName() const override {
     return TypeNameT<T>::name();
@@ -367,75 +450,55 @@ class FuncsWithStateT {
  public:
   using FuncsWithState = FuncsWithStateT<use_const>;
 
-  template <typename T>
-  using PointerFunc = std::function<void(
-      typename std::conditional<use_const, T*, const T*>::type)>;
-
   using AnyP_t = typename std::conditional<use_const, AnyP, const AnyP>::type&;
-  using Func = std::function<void(AnyP_t, int batch_idx)>;
+  using Binding = typename FuncStateMemT<use_const>::Binding;
   using SharedMem_t =
       typename std::conditional<use_const, SharedMem, const SharedMem>::type&;
 
   FuncsWithStateT() {}
 
-  bool addFunction(const std::string& key, Func func) {
-    if (func != nullptr) {
-      funcs_[key] = func;
-      return true;
+  // field is the FuncMapBase::getId() of the key. Returns false (and adds
+  // nothing) for a null binding.
+  bool addFunction(int field, const Binding& binding) {
+    if (binding.thunk == nullptr) {
+      return false;
     }
-    return false;
-  }
-
-#if 0
-    template <typename T>
-    bool add(const std::string &key, PointerFunc<T> func) {
-        if (func == nullptr) {
-            return false;
-        }
-
-        auto f = [func](AnyP_t anyp, int batch_idx) {
-            func(anyp.template get<T>({batch_idx}));
-        };
-        return addFunc(key, f);
+    Entry* e = find(field);
+    if (e != nullptr) {
+      e->binding = binding;
+    } else {
+      entries_.push_back({field, binding});
     }
-#endif
+    return true;
+  }
 
   void transfer(int batch_idx, SharedMem_t smem) const;
 
-#if 0
-    Func getFunction(const std::string &key) const {
-        auto it = funcs_.find(key);
-
-        if (it == funcs_.end()) {
-            return nullptr;
-        } else {
-            return it->second;
-        }
-    }
-#endif
-
-#if 0
-    friend FuncsWithState _MergePackage(const FuncsWithState &pkg1, const FuncsWithState &pkg2) {
-        FuncsWithState funcs;
-        for (const auto &p : pkg1.funcs_) {
-            funcs.funcs_.insert(p);
-        }
-
-        for (const auto &p : pkg2.funcs_) {
-            funcs.funcs_.insert(p);
-        }
-        return funcs;
-    }
-#endif
-
   void add(const FuncsWithState& funcs) {
-    for (const auto& p : funcs.funcs_) {
-      funcs_.insert(p);
+    for (const Entry& e : funcs.entries_) {
+      if (find(e.field) == nullptr) {
+        entries_.push_back(e);
+      }
     }
   }
 
  private:
-  std::unordered_map<std::string, Func> funcs_;
+  struct Entry {
+    int field;
+    Binding binding;
+  };
+
+  // The plan run by transfer(), in the order the functions were added.
+  std::vector<Entry> entries_;
+
+  Entry* find(int field) {
+    for (Entry& e : entries_) {
+      if (e.field == field) {
+        return &e;
+      }
+    }
+    return nullptr;
+  }
 };
 
 using FuncStateToMemWithState = FuncsWithStateT<true>;
@@ -445,20 +508,6 @@ struct FuncsWithState {
   FuncStateToMemWithState state_to_mem_funcs;
   FuncMemToStateWithState mem_to_state_funcs;
 
-#if 0
-    static FuncsWithState MergePkg(const FuncsWithState &pkg1,
-                                   const FuncsWithState &pkg2) {
-        FuncsWithState funcs;
-        funcs.state_to_mem_funcs =
-            _MergePackage(pkg1.state_to_mem_funcs,
-                          pkg2.state_to_mem_funcs);
-        funcs.mem_to_state_funcs =
-            _MergePackage(pkg1.mem_to_state_funcs,
-                          pkg2.mem_to_state_funcs);
-        return funcs;
-    }
-#endif
-
   void add(const FuncsWithState& funcs) {
     state_to_mem_funcs.add(funcs.state_to_mem_funcs);
     mem_to_state_funcs.add(funcs.mem_to_state_funcs);
@@ -477,7 +526,9 @@ class Extractor {
   template <typename T>
   FuncMapT<T>& addField(const std::string& key) {
     auto& f = fields_[key];
-    auto* p = new FuncMapT<T>(key);
+    // Keys are never removed, so ids stay dense.
+    const int id = f != nullptr ? f->getId() : (int)fields_.size() - 1;
+    auto* p = new FuncMapT<T>(key, id);
     f.reset(p);
     return *p;
   }
@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <assert.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "elf/concurrency/Fiber.h"
+#include "sharedmem.h"
+
+namespace elf {
+
+// Runs many games on one thread, each in a fiber (see concurrency::Fiber).
+// A game blocking in sendWait sends its request right away and suspends.
+// It resumes, with the status of its own request, once the servers of the
+// request have all released it, whatever the other games wait for.
+// Thousands of games then need only as many threads as workers (see
+// Context::setFiberMode).
+//
+// Games must not block on anything else than the requests of their
+// GameClient, which route here while a worker runs them.
+class FiberWorker {
+ public:
+  FiberWorker(
+      Client* client,
+      size_t stack_size = concurrency::Fiber::kDefaultStackSize)
+      : client_(client), stackSize_(stack_size) {}
+
+  FiberWorker(const FiberWorker&) = delete;
+  FiberWorker& operator=(const FiberWorker&) = delete;
+
+  // shard_key picks the shard of each label for the requests of the game,
+  // e.g. its index among all games, to spread them as game threads are.
+  void add(std::function<void()> game, size_t shard_key) {
+    games_.emplace_back(
+        new Game(games_.size(), shard_key, std::move(game), stackSize_));
+  }
+
+  // Run the games on this thread until all have returned.
+  void run() {
+    assert(current() == nullptr);
+    current() = this;
+    runnable_.clear();
+    for (auto& game : games_) {
+      runnable_.push_back(game.get());
+    }
+    size_t remaining = games_.size();
+    while (remaining > 0) {
+      if (runnable_.empty()) {
+        // All games wait for replies.
+        runReplies(-1);
+        continue;
+      }
+      Game* game = runnable_.front();
+      runnable_.pop_front();
+      running_ = game;
+      if (!game->fiber.resume()) {
+        remaining--;
+      }
+      running_ = nullptr;
+      // A server waits for its replies to be run before its next batch:
+      // hold it up for no more than a game step.
+      runReplies(0);
+    }
+    client_->waitReleased();
+    current() = nullptr;
+  }
+
+  // Called from a game: the same as Client::sendBatchWait, for funcs[0 ..
+  // n), which must stay valid until this returns.
+  comm::ReplyStatus sendWait(
+      const std::vector<std::string>& targets,
+      FuncsWithState* const* funcs,
+      size_t n,
+      comm::Priority priority) {
+    Game* game = running_;
+    assert(game != nullptr && n > 0);
+    game->pending = client_->sendTagged(
+        {&targets, funcs, n, priority, game->shard_key}, game->index);
+    // As in Client::sendBatchWait, a request without servers succeeds.
+    game->status = comm::SUCCESS;
+    if (game->pending > 0) {
+      concurrency::Fiber::suspend();
+    }
+    return game->status;
+  }
+
+  // The worker running on this thread, if any.
+  static FiberWorker*& current() {
+    thread_local FiberWorker* worker = nullptr;
+    return worker;
+  }
+
+ private:
+  struct Game {
+    // In games_, tagging its requests.
+    size_t index;
+    size_t shard_key;
+    concurrency::Fiber fiber;
+    // Messages of the request not released yet, and its status so far,
+    // combined as for the servers of a single request.
+    size_t pending = 0;
+    comm::ReplyStatus status = comm::UNKNOWN;
+
+    Game(
+        size_t index,
+        size_t shard_key,
+        std::function<void()> f,
+        size_t stack_size)
+        : index(index), shard_key(shard_key), fiber(std::move(f), stack_size) {}
+  };
+
+  Client* client_;
+  size_t stackSize_;
+  std::vector<std::unique_ptr<Game>> games_;
+  Game* running_ = nullptr;
+  std::deque<Game*> runnable_;
+  std::vector<Client::Release> released_;
+
+  // Run the replies at hand, first waiting for one if timeout_usec < 0,
+  // and make the games whose requests they release runnable.
+  void runReplies(int timeout_usec) {
+    released_.clear();
+    while (client_->runReply(timeout_usec, &released_)) {
+      timeout_usec = 0;
+    }
+    for (const Client::Release& r : released_) {
+      Game* game = games_[r.tag].get();
+      assert(game->pending > 0);
+      if (r.status == comm::FAILED || r.status == comm::UNKNOWN) {
+        game->status = r.status;
+      }
+      if (--game->pending == 0) {
+        runnable_.push_back(game);
+      }
+    }
+  }
+};
+
+} // namespace elf
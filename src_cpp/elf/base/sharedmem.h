@@ -8,14 +8,19 @@
 
 #pragma once
 
+#include <algorithm>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "elf/comm/comm.h"
 #include "elf/concurrency/ConcurrentQueue.h"
+#include "elf/concurrency/WorkerPool.h"
 #include "elf/logging/IndexedLoggerFactory.h"
 
+#include "adaptive_batch.h"
 #include "extractor.h"
 
 namespace elf {
@@ -32,7 +37,11 @@ using Client = typename Comm::Client;
 
 class SharedMemOptions {
  public:
-  enum TransferType { SERVER = 0, CLIENT };
+  // SERVER: the collector thread runs all transfers.
+  // CLIENT: each game thread runs the transfers of its own states.
+  // PARALLEL: like SERVER, but the batch is split by base_idx range over
+  // getTransferThreads() threads.
+  enum TransferType { SERVER = 0, CLIENT, PARALLEL };
 
   SharedMemOptions(const std::string& label, int batchsize)
       : options_(label, batchsize, 0, 1) {}
@@ -53,6 +62,38 @@ class SharedMemOptions {
     type_ = type;
   }
 
+  // PARALLEL transfer over num_threads threads (collector included).
+  void setParallelTransfer(int num_threads) {
+    type_ = PARALLEL;
+    transfer_threads_ = num_threads;
+  }
+
+  // Number of SharedMem buffers the collector of this label cycles through.
+  // With more than one, the next batch is gathered while the previous ones
+  // are still being consumed.
+  void setNumBuffers(int num_buffers) {
+    num_buffers_ = num_buffers;
+  }
+
+  // Let the collector adapt batchsize (up to the allocated one) and timeout
+  // to the load, see AdaptiveBatchController.
+  void setAdaptive(
+      int min_batchsize,
+      int min_timeout_usec,
+      int max_timeout_usec,
+      int target_latency_usec) {
+    adaptive_.enabled = true;
+    adaptive_.min_batchsize = min_batchsize;
+    adaptive_.min_timeout_usec = min_timeout_usec;
+    adaptive_.max_timeout_usec = max_timeout_usec;
+    adaptive_.target_latency_usec = target_latency_usec;
+  }
+
+  // Batches of this label are handed to the consumer ahead of NORMAL ones.
+  void setPriority(comm::Priority priority) {
+    priority_ = priority;
+  }
+
   int getIdx() const {
     return idx_;
   }
@@ -81,6 +122,22 @@ class SharedMemOptions {
     return type_;
   }
 
+  int getTransferThreads() const {
+    return transfer_threads_;
+  }
+
+  int getNumBuffers() const {
+    return num_buffers_;
+  }
+
+  const AdaptiveBatchOptions& getAdaptiveOptions() const {
+    return adaptive_;
+  }
+
+  comm::Priority getPriority() const {
+    return priority_;
+  }
+
   std::string info() const {
     std::stringstream ss;
     ss << "SMem[" << options_.label << "], idx: " << idx_
@@ -94,6 +151,22 @@ class SharedMemOptions {
       ss << ", transfer_type: " << type_;
     }
 
+    if (type_ == PARALLEL) {
+      ss << ", transfer_threads: " << transfer_threads_;
+    }
+
+    if (num_buffers_ > 1) {
+      ss << ", num_buffers: " << num_buffers_;
+    }
+
+    if (adaptive_.enabled) {
+      ss << ", adaptive: " << adaptive_.info();
+    }
+
+    if (priority_ != comm::NORMAL) {
+      ss << ", priority: " << priority_;
+    }
+
     return ss.str();
   }
 
@@ -101,6 +174,10 @@ class SharedMemOptions {
   int idx_ = -1;
   comm::RecvOptions options_;
   TransferType type_ = CLIENT;
+  int transfer_threads_ = 4;
+  int num_buffers_ = 1;
+  AdaptiveBatchOptions adaptive_;
+  comm::Priority priority_ = comm::NORMAL;
 };
 
 class SharedMem;
@@ -135,13 +212,39 @@ class SharedMem {
         mem_(mem),
         logger_(elf::logging::getIndexedLogger("elf::base::SharedMem-", "")) {
     opts_.setIdx(idx);
+    for (auto& p : mem_) {
+      const int id = p.second.field().getId();
+      assert(id >= 0);
+      if (id >= (int)fields_.size()) {
+        fields_.resize(id + 1, nullptr);
+      }
+      fields_[id] = &p.second;
+    }
+    if (opts_.getTransferType() == SharedMemOptions::PARALLEL) {
+      pool_.reset(new concurrency::WorkerPool(
+          std::max(opts_.getTransferThreads(), 1)));
+    }
   }
 
+  // fields_ points into mem_, so a copy would alias the original's fields.
+  SharedMem(const SharedMem&) = delete;
+  SharedMem& operator=(const SharedMem&) = delete;
+
   void waitBatchFillMem(Server* server) {
+    waitBatch(server);
+    fillMem(server);
+  }
+
+  // The two halves of waitBatchFillMem. Only fillMem (and
+  // waitReplyReleaseBatch) run sessions on the server node, so buffers
+  // sharing a server only need to serialize those.
+  void waitBatch(Server* server) {
     server->waitBatch(opts_.getRecvOptions(), &msgs_from_client_);
     active_batch_size_ = 0;
+    priority_ = opts_.getPriority();
     for (const Message& m : msgs_from_client_) {
       active_batch_size_ += m.data.size();
+      priority_ = std::max(priority_, m.priority);
     }
 
     if ((int)active_batch_size_ > opts_.getBatchSize() ||
@@ -158,9 +261,13 @@ class SharedMem {
 
     // LOG(INFO) << "Receiver: Batch received. #batch = "
     //           << active_batch_size_ << std::endl;
+  }
 
+  void fillMem(Server* server) {
     if (opts_.getTransferType() == SharedMemOptions::SERVER) {
       local_state2mem();
+    } else if (opts_.getTransferType() == SharedMemOptions::PARALLEL) {
+      parallel_transfer([this](const Message& m) { state2mem(m, *this); });
     } else {
       client_state2mem(server);
     }
@@ -169,6 +276,8 @@ class SharedMem {
   void waitReplyReleaseBatch(Server* server, comm::ReplyStatus batch_status) {
     if (opts_.getTransferType() == SharedMemOptions::SERVER) {
       local_mem2state();
+    } else if (opts_.getTransferType() == SharedMemOptions::PARALLEL) {
+      parallel_transfer([this](Message& m) { mem2state(*this, m); });
     } else {
       client_mem2state(server);
     }
@@ -187,6 +296,11 @@ class SharedMem {
     return active_batch_size_;
   }
 
+  // HIGH if the options say so, or if the batch holds a HIGH request.
+  comm::Priority getPriority() const {
+    return priority_;
+  }
+
   void setTimeout(int timeout_usec) {
     opts_.setTimeout(timeout_usec);
   }
@@ -195,6 +309,11 @@ class SharedMem {
     opts_.setMinBatchSize(minbatchsize);
   }
 
+  // For the collector to adjust the next batch.
+  comm::WaitOptions& getWaitOptions() {
+    return opts_.getWaitOptions();
+  }
+
   std::string info() const {
     std::stringstream ss;
     ss << opts_.info() << std::endl;
@@ -219,6 +338,16 @@ class SharedMem {
     return (*this)[key];
   }
 
+  // By FuncMapBase::getId(), as transfers look fields up. nullptr if the
+  // field is not in this SharedMem.
+  AnyP* field(int id) {
+    return id < (int)fields_.size() ? fields_[id] : nullptr;
+  }
+
+  const AnyP* field(int id) const {
+    return id < (int)fields_.size() ? fields_[id] : nullptr;
+  }
+
   const AnyP* operator[](const std::string& key) const {
     auto it = mem_.find(key);
     if (it != mem_.end()) {
@@ -231,15 +360,51 @@ class SharedMem {
  private:
   SharedMemOptions opts_;
   std::unordered_map<std::string, AnyP> mem_;
+  // mem_ indexed by field id, see field().
+  std::vector<AnyP*> fields_;
 
   // We get a batch of messages from client
   // Note that msgs_from_client_.size() is no longer the batchsize, since one
   // Message could contain multiple states.
   std::vector<Message> msgs_from_client_;
   size_t active_batch_size_ = 0;
+  comm::Priority priority_ = comm::NORMAL;
 
   std::shared_ptr<spdlog::logger> logger_;
 
+  // CLIENT transfer, kept to reuse its storage.
+  std::vector<typename Comm::ReplyFunction> closures_;
+
+  // PARALLEL transfer.
+  std::unique_ptr<concurrency::WorkerPool> pool_;
+  // Shard k covers msgs_from_client_[shards_[k], shards_[k + 1]).
+  std::vector<size_t> shards_;
+
+  // Split the batch into contiguous base_idx ranges of about the same
+  // number of states, one per thread, and run f on each message.
+  template <typename F>
+  void parallel_transfer(F f) {
+    const size_t num_shards = std::min<size_t>(
+        pool_->size(), std::max<size_t>(active_batch_size_, 1));
+    shards_.clear();
+    shards_.push_back(0);
+    size_t count = 0;
+    for (size_t i = 0; i < msgs_from_client_.size(); ++i) {
+      count += msgs_from_client_[i].data.size();
+      if (count * num_shards >= shards_.size() * active_batch_size_ &&
+          shards_.size() < num_shards) {
+        shards_.push_back(i + 1);
+      }
+    }
+    shards_.push_back(msgs_from_client_.size());
+
+    pool_->run(shards_.size() - 1, [&](int k) {
+      for (size_t i = shards_[k]; i < shards_[k + 1]; ++i) {
+        f(msgs_from_client_[i]);
+      }
+    });
+  }
+
   void local_state2mem() {
     // Send the state to shared memory.
     for (const Message& m : msgs_from_client_) {
@@ -249,18 +414,18 @@ class SharedMem {
 
   void client_state2mem(Server* server) {
     // Send the state to shared memory.
-    std::vector<typename Comm::ReplyFunction> msgs;
+    closures_.clear();
     for (const Message& m : msgs_from_client_) {
       // LOG(INFO) << "state2mem: Batch " << i << " ptr: " << std::hex
       //           << msgs_from_client_[i].m << std::dec << ", msg address: "
       //           << std::hex << &msgs_from_client_[i] << dec << std::endl;
-      msgs.push_back([&]() {
+      closures_.push_back([&]() {
         state2mem(m, *this);
         // Done one job.
         return comm::DONE_ONE_JOB;
       });
     }
-    server->sendClosuresWaitDone(msgs_from_client_, msgs);
+    server->sendClosuresWaitDone(msgs_from_client_, closures_);
   }
 
   void local_mem2state() {
@@ -272,26 +437,26 @@ class SharedMem {
 
   void client_mem2state(Server* server) {
     // Send the state to shared memory.
-    std::vector<typename Comm::ReplyFunction> msgs;
+    closures_.clear();
     for (Message& m : msgs_from_client_) {
       // LOG(INFO) << "mem2state: Batch " << i << " ptr: " << std::hex
       //           << msgs_from_client_[i].m << dec << std::endl;
-      msgs.push_back([&]() {
+      closures_.push_back([&]() {
         mem2state(*this, m);
         // Done one job.
         return comm::DONE_ONE_JOB;
       });
     }
-    server->sendClosuresWaitDone(msgs_from_client_, msgs);
+    server->sendClosuresWaitDone(msgs_from_client_, closures_);
   }
 };
 
 template <bool use_const>
 void FuncsWithStateT<use_const>::transfer(int msg_idx, SharedMem_t smem) const {
-  for (const auto& p : funcs_) {
-    auto* anyp = smem[p.first];
+  for (const Entry& e : entries_) {
+    auto* anyp = smem.field(e.field);
     assert(anyp != nullptr);
-    p.second(*anyp, msg_idx);
+    e.binding.thunk(e.binding.state, e.binding.func, *anyp, msg_idx);
   }
 }
 
@@ -8,9 +8,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 #include "elf/concurrency/Counter.h"
@@ -24,6 +27,45 @@ template <
     template <typename> class ServerQueue>
 class NodeT;
 
+// Non-owning view of the payload of a message. The sender keeps the payload
+// alive until its session ends, so messages are passed around (and queued)
+// without copying it.
+template <typename Data>
+class DataView {
+ public:
+  DataView() {}
+  DataView(const Data* data, size_t size) : data_(data), size_(size) {}
+
+  const Data* begin() const {
+    return data_;
+  }
+  const Data* end() const {
+    return data_ + size_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  const Data& operator[](size_t i) const {
+    return data_[i];
+  }
+  void clear() {
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+ private:
+  const Data* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// A receiver takes HIGH messages ahead of NORMAL ones, and returns a batch
+// holding one as soon as no other message is at hand, rather than waiting
+// for the batch to fill up.
+enum Priority { NORMAL = 0, HIGH };
+
 template <
     typename Data,
     typename Reply,
@@ -35,15 +77,23 @@ struct MsgT {
 
   ClientToServer* from = nullptr;
   ServerToClient* to = nullptr;
-  std::vector<Data> data;
+  DataView<Data> data;
   size_t base_idx = 0;
+  Priority priority = NORMAL;
+  // Set by the client, and echoed in the replies to the message, so that
+  // they can be told apart when several requests are in flight.
+  size_t tag = 0;
 
   MsgT(ClientToServer* from, ServerToClient* to, const std::vector<Data>& in)
-      : from(from), to(to), data(in) {}
+      : from(from), to(to), data(in.data(), in.size()) {}
 
-  MsgT(ClientToServer* from, ServerToClient* to, Data in) : from(from), to(to) {
-    data.push_back(in);
-  }
+  MsgT(
+      ClientToServer* from,
+      ServerToClient* to,
+      const Data* in,
+      size_t n,
+      Priority priority = NORMAL)
+      : from(from), to(to), data(in, n), priority(priority) {}
 
   MsgT() {}
 };
@@ -54,7 +104,7 @@ struct WaitOptions {
   // If timeout_usec > 0, an incomplete batch of
   // size >= min_batchsize will be returned.
   int timeout_usec = 0;
-  bool min_batchsize = 0;
+  int min_batchsize = 0;
 
   WaitOptions(int batchsize, int timeout_usec = 0, int min_batchsize = 0)
       : batchsize(batchsize),
@@ -82,19 +132,62 @@ class NodeT {
   using SendMsg = MsgT<Data, Reply, MyQueue, PartnerQueue>;
   using RecvMsg = MsgT<Reply, Data, PartnerQueue, MyQueue>;
 
+  // Scratch space for the sessions of the thread owning this node, so that
+  // a steady stream of requests does not allocate. Each call clears it.
+  std::vector<SendMsg>& outgoing() {
+    outgoing_.clear();
+    return outgoing_;
+  }
+
+  std::vector<RecvMsg>& incoming() {
+    incoming_.clear();
+    return incoming_;
+  }
+
+  std::vector<Data>& payload() {
+    payload_.clear();
+    return payload_;
+  }
+
   bool startSession(const std::vector<SendMsg>& targets) {
     if (n_ > 0) {
       return false;
     }
 
-    for (const auto& pa : targets) {
-      pa.to->EnqueueMessage(SendMsg(this, pa.to, pa.data));
+    for (SendMsg msg : targets) {
+      msg.from = this;
+      msg.to->EnqueueMessage(std::move(msg));
     }
 
     n_ = targets.size();
     return true;
   }
 
+  // Outside of sessions, e.g. for several requests in flight at once:
+  // the messages are released one by one, each counted ahead by
+  // onReleased() (the releasing side notifies only after its reply was
+  // run). Not to be mixed with startSession().
+  void sendMessages(const std::vector<SendMsg>& targets) {
+    for (SendMsg msg : targets) {
+      msg.from = this;
+      msg.to->EnqueueMessage(std::move(msg));
+    }
+  }
+
+  void onReleased() {
+    replyCount_.increment(-1);
+  }
+
+  // Wait until the releases counted by onReleased() have been notified.
+  void waitReleasesNotified() {
+    replyCount_.waitUntilCount(0);
+  }
+
+  // A single message, waiting at most timeout_usec (negative: block).
+  bool waitMessage(int timeout_usec, RecvMsg* msg) {
+    return get_msg(timeout_usec, msg);
+  }
+
   void waitSessionEnd(int timeout_usec = 0) {
     (void)timeout_usec;
     replyCount_.waitUntilCount(n_);
@@ -110,13 +203,20 @@ class NodeT {
     messages->clear();
 
     size_t data_count = 0;
+    bool urgent = false;
 
     while (true) {
       RecvMsg message;
 
-      bool use_timeout =
-          ((int)data_count >= opt.min_batchsize && opt.timeout_usec > 0);
-      if (!get_msg(opt, use_timeout, &message))
+      // Negative: block.
+      int timeout_usec = -1;
+      if (urgent) {
+        timeout_usec = 0;
+      } else if (
+          (int)data_count >= opt.min_batchsize && opt.timeout_usec > 0) {
+        timeout_usec = opt.timeout_usec;
+      }
+      if (!get_msg(timeout_usec, &message))
         break;
 
       if ((int)(message.data.size() + data_count) > opt.batchsize) {
@@ -130,6 +230,7 @@ class NodeT {
       message.base_idx = data_count;
       messages->push_back(message);
       data_count += message.data.size();
+      urgent = urgent || message.priority == HIGH;
 
       // LOG(INFO) << "Get a message, #m: "
       //           << data_count << std::endl;
@@ -145,15 +246,29 @@ class NodeT {
   }
 
   void EnqueueMessage(RecvMsg&& msg) {
-    q_.push(msg);
+    if (msg.priority == HIGH) {
+      urgentQ_.push(msg);
+      numUrgent_++;
+      // Empty message, to wake up a receiver blocked on q_.
+      q_.push(RecvMsg());
+    } else {
+      q_.push(msg);
+    }
   }
 
  private:
   int n_ = 0;
 
+  std::vector<SendMsg> outgoing_;
+  std::vector<RecvMsg> incoming_;
+  std::vector<Data> payload_;
+
   RecvMsg unprocessed_msg_;
   // Concurrent Queue.
   MyQueue<RecvMsg> q_;
+  // HIGH priority messages, checked before q_.
+  MyQueue<RecvMsg> urgentQ_;
+  std::atomic<int> numUrgent_{0};
 
   elf::concurrency::Counter<int> replyCount_;
 
@@ -162,26 +277,37 @@ class NodeT {
     unprocessed_msg_ = msg;
   }
 
-  bool get_msg(const WaitOptions& opt, bool use_timeout, RecvMsg* msg) {
+  bool get_msg(int timeout_usec, RecvMsg* msg) {
     if (!unprocessed_msg_.data.empty()) {
       *msg = unprocessed_msg_;
       unprocessed_msg_.data.clear();
       return true;
     }
-    if (use_timeout) {
-      // use timeout.
-      // LOG(INFO) << "Timeout. " << hex << this
-      //           << dec
-      //           << ", opt.timeout_usec = "
-      //           << opt.timeout_usec
-      //           << ", messages->size() = "
-      //           << messages->size()
-      //           << std::endl;
-      return q_.pop(msg, std::chrono::microseconds(opt.timeout_usec));
-    } else {
-      // This will block.
-      q_.pop(msg);
-      return true;
+    // Wake-ups must not stretch the wait past the caller's timeout.
+    const auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds(std::max(timeout_usec, 0));
+    while (true) {
+      if (numUrgent_ > 0 && urgentQ_.pop(msg, std::chrono::microseconds(0))) {
+        numUrgent_--;
+        return true;
+      }
+      if (timeout_usec >= 0) {
+        const auto remaining =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (!q_.pop(
+                msg, std::max(remaining, std::chrono::microseconds(0)))) {
+          return false;
+        }
+      } else {
+        // This will block.
+        q_.pop(msg);
+      }
+      // Empty messages only wake us up for urgent ones, which may have been
+      // taken already.
+      if (!msg->data.empty()) {
+        return true;
+      }
     }
   }
 };
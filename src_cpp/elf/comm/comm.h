@@ -8,10 +8,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <memory>
-#include <random>
 #include <string>
 #include <thread>
 #include <utility>
@@ -33,8 +33,9 @@ namespace comm {
 ///  Workflow (Client side):
 ///     1. Calls `sendWait, to sends a request to a group of Servers and gets
 ///        blocked. The request is an object typed Data.
-///     2. Each Server responds by sending a closure of type
-///        `function<ReplyStatus ()>` to the Client.
+///     2. Each Server responds by sending a Reply to the Client: usually just
+///        a ReplyStatus, sometimes a closure of type
+///        `function<ReplyStatus ()>` to run on the Client's thread.
 ///     3. When all Servers that the Client is waiting for respond, the Client
 ///         gets unblocked and return from `sendWait`.
 ///
@@ -57,6 +58,15 @@ namespace comm {
 ///  Note: All functions are thread-safe and using threads is encouraged for
 ///        parallelism
 ///
+///  Note: A request can be sent with HIGH priority (see Priority), e.g. for
+///        interactive play next to self-play. Servers take it ahead of the
+///        NORMAL ones, and do not wait for its batch to fill up.
+///
+///  Note: Messages only point to their payload (see DataView), which stays
+///        with the sender until the session ends, and the vectors a session
+///        needs are kept in its nodes. Once warmed up, a request does not
+///        allocate.
+///
 ///  // TODO - check this (ssengupta@fb)
 ///  For 3', CommInternalT achieves that by having Client invoking another
 ///  sessions with all the Servers. The Client thus waits for Servers' commands
@@ -97,10 +107,36 @@ template <
 class CommInternalT {
  public:
   using ReplyFunction = std::function<ReplyStatus()>;
-  using ClientNode = NodeT<Data, ReplyFunction, ClientQueue, ServerQueue>;
-  using ServerNode = NodeT<ReplyFunction, Data, ServerQueue, ClientQueue>;
-  using ClientToServerMsg = MsgT<Data, ReplyFunction, ClientQueue, ServerQueue>;
-  using ServerToClientMsg = MsgT<ReplyFunction, Data, ServerQueue, ClientQueue>;
+
+  // What a server sends back to a client. A plain status, or a closure
+  // owned by the server until the session ends.
+  struct Reply {
+    ReplyStatus status = UNKNOWN;
+    const ReplyFunction* func = nullptr;
+
+    ReplyStatus operator()() const {
+      return func != nullptr ? (*func)() : status;
+    }
+  };
+
+  // One message of a request in flight, see Client::sendTagged.
+  struct Outgoing {
+    Id server;
+    const Data* data;
+    size_t size;
+    Priority priority;
+  };
+
+  // A message of sendTagged released by its server, see Client::runReply.
+  struct Release {
+    size_t tag;
+    ReplyStatus status;
+  };
+
+  using ClientNode = NodeT<Data, Reply, ClientQueue, ServerQueue>;
+  using ServerNode = NodeT<Reply, Data, ServerQueue, ClientQueue>;
+  using ClientToServerMsg = MsgT<Data, Reply, ClientQueue, ServerQueue>;
+  using ServerToClientMsg = MsgT<Reply, Data, ServerQueue, ClientQueue>;
   using CommInternal =
       CommInternalT<Id, Data, kExpectReply, ClientQueue, ServerQueue>;
 
@@ -115,24 +151,91 @@ class CommInternalT {
     // data and reply can point to an identical object, since the previous reply
     // can be resent
     // (e.g., the action returned from the reply will be sent for training).
-    ReplyStatus sendWait(Id id, const std::vector<Id>& server_ids, Data data) {
-      return sendBatchWait(id, server_ids, std::vector<Data>{data});
+    ReplyStatus sendWait(
+        Id id,
+        const std::vector<Id>& server_ids,
+        Data data,
+        Priority priority = NORMAL) {
+      return sendBatchWait(id, server_ids, &data, 1, priority);
+    }
+
+    ReplyStatus sendBatchWait(
+        Id id,
+        const std::vector<Id>& server_ids,
+        const std::vector<Data>& data,
+        Priority priority = NORMAL) {
+      return sendBatchWait(id, server_ids, data.data(), data.size(), priority);
     }
 
+    // data[0 .. size) must stay valid until this returns, which it does as
+    // servers only see it before they release us.
     ReplyStatus sendBatchWait(
         Id id,
         const std::vector<Id>& server_ids,
-        const std::vector<Data>& data) {
-      assert(!data.empty());
+        const Data* data,
+        size_t size,
+        Priority priority = NORMAL) {
+      assert(size > 0);
       // Find server that could accept this task.
-      std::vector<ClientToServerMsg> messages;
       ClientNode* node = p_->client(id);
+      std::vector<ClientToServerMsg>& messages = node->outgoing();
       for (Id server_id : server_ids) {
         ServerNode* server = p_->server(server_id);
         // LOG(INFO) <<  "Send to server " << hex
         //           << server << dec << std::endl;
-        messages.push_back(ClientToServerMsg(node, server, data));
+        messages.emplace_back(node, server, data, size, priority);
       }
+      return runSession(node, messages);
+    }
+
+    // Several requests in flight at once (e.g. of games multiplexed on
+    // this thread): unlike sendBatchWait, this returns once the messages
+    // of outgoing are sent, tagged with tag. Their replies are run by
+    // runReply(), and the messages stay valid until they are released.
+    void sendTagged(Id id, const std::vector<Outgoing>& outgoing, size_t tag) {
+      static_assert(kExpectReply, "messages are released by their replies");
+      ClientNode* node = p_->client(id);
+      std::vector<ClientToServerMsg>& messages = node->outgoing();
+      for (const Outgoing& o : outgoing) {
+        assert(o.size > 0);
+        messages.emplace_back(
+            node, p_->server(o.server), o.data, o.size, o.priority);
+        messages.back().tag = tag;
+      }
+      node->sendMessages(messages);
+    }
+
+    // Run the next reply to the messages of sendTagged, waiting at most
+    // timeout_usec for it (negative: block). Returns false if none came.
+    // The messages it releases go to *released.
+    bool runReply(Id id, int timeout_usec, std::vector<Release>* released) {
+      ClientNode* node = p_->client(id);
+      ServerToClientMsg msg;
+      if (!node->waitMessage(timeout_usec, &msg)) {
+        return false;
+      }
+      assert(msg.data.size() == 1);
+      const ReplyStatus res = msg.data[0]();
+      if (res != DONE_ONE_JOB) {
+        node->onReleased();
+        released->push_back({msg.tag, res});
+      }
+      msg.from->notifySessionInvite();
+      return true;
+    }
+
+    // Wait until the servers are done with the messages released so far,
+    // before sending anything else than sendTagged.
+    void waitReleased(Id id) {
+      p_->client(id)->waitReleasesNotified();
+    }
+
+   private:
+    CommInternal* p_;
+
+    ReplyStatus runSession(
+        ClientNode* node,
+        const std::vector<ClientToServerMsg>& messages) {
       node->startSession(messages);
 
       int n = (int)messages.size();
@@ -144,7 +247,8 @@ class CommInternalT {
         final_status = SUCCESS;
 
         WaitOptions opt(1);
-        std::vector<ServerToClientMsg> server_to_client_msgs;
+        std::vector<ServerToClientMsg>& server_to_client_msgs =
+            node->incoming();
 
         while (n > 0 && node->waitSessionInvite(opt, &server_to_client_msgs)) {
           assert(server_to_client_msgs.size() == 1);
@@ -169,9 +273,6 @@ class CommInternalT {
       node->waitSessionEnd();
       return final_status;
     }
-
-   private:
-    CommInternal* p_;
   };
 
   class Server {
@@ -192,6 +293,8 @@ class CommInternalT {
    public:
     explicit Server(CommInternal* p) : p_(p) {}
 
+    // Run functions[i] on the client thread of messages[i], and wait until
+    // all are done.
     bool sendClosuresWaitDone(
         const std::vector<ClientToServerMsg>& messages,
         const std::vector<ReplyFunction>& functions) {
@@ -199,16 +302,11 @@ class CommInternalT {
         return true;
       }
 
-      ServerNode* node = messages[0].to;
-      // assert(node != nullptr);
-
-      std::vector<ServerToClientMsg> server_to_client_msgs;
+      std::vector<Reply>& replies = messages[0].to->payload();
       for (size_t i = 0; i < messages.size(); ++i) {
-        server_to_client_msgs.push_back(
-            ServerToClientMsg(node, messages[i].from, functions[i]));
+        replies.push_back(Reply{UNKNOWN, &functions[i]});
       }
-      node->startSession(server_to_client_msgs);
-      node->waitSessionEnd();
+      sendRepliesWaitDone(messages, replies.data(), 1);
       return true;
     }
 
@@ -217,11 +315,9 @@ class CommInternalT {
     bool ReleaseBatch(
         const std::vector<ClientToServerMsg>& messages,
         ReplyStatus task_result) {
-      if (kExpectReply) {
-        std::vector<ReplyFunction> functions;
-        functions.resize(
-            messages.size(), [task_result]() { return task_result; });
-        sendClosuresWaitDone(messages, functions);
+      if (kExpectReply && !messages.empty()) {
+        const Reply reply{task_result, nullptr};
+        sendRepliesWaitDone(messages, &reply, 0);
       }
 
       for (const ClientToServerMsg& message : messages) {
@@ -232,10 +328,36 @@ class CommInternalT {
 
    private:
     CommInternal* p_;
+
+    // Send replies[i * stride] to the client of messages[i] and wait until
+    // all of them have been run.
+    void sendRepliesWaitDone(
+        const std::vector<ClientToServerMsg>& messages,
+        const Reply* replies,
+        size_t stride) {
+      ServerNode* node = messages[0].to;
+      // assert(node != nullptr);
+
+      std::vector<ServerToClientMsg>& server_to_client_msgs = node->outgoing();
+      for (size_t i = 0; i < messages.size(); ++i) {
+        server_to_client_msgs.emplace_back(
+            node, messages[i].from, replies + i * stride, 1);
+        server_to_client_msgs.back().tag = messages[i].tag;
+      }
+      node->startSession(server_to_client_msgs);
+      node->waitSessionEnd();
+    }
   };
 
  private:
   ClientNode* client(Id id) {
+    // Nodes are never removed, so a read lock suffices once they exist.
+    {
+      typename ClientMap::const_accessor elem;
+      if (clients_.find(elem, id)) {
+        return elem->second.get();
+      }
+    }
     typename ClientMap::accessor elem;
     bool uninitialized = clients_.insert(elem, id);
     if (uninitialized) {
@@ -245,6 +367,12 @@ class CommInternalT {
   }
 
   ServerNode* server(Id id) {
+    {
+      typename ServerMap::const_accessor elem;
+      if (servers_.find(elem, id)) {
+        return elem->second.get();
+      }
+    }
     typename ServerMap::accessor elem;
     bool uninitialized = servers_.insert(elem, id);
     if (uninitialized) {
@@ -297,7 +425,10 @@ struct RecvOptions {
 ///     `RegServer`
 ///  3. When the Client call `sendWait`. it also needs to specify a set of
 ///     server labels. If there are multiple servers with the same label,
-///     a server is chosen by uniform random sampling.
+///     a server is assigned to each client, round robin by its shard key:
+///     the order of its first request for a client thread, or the key of
+///     the request (e.g. the game of a FiberWorker). The servers of a label
+///     are thus shards, each one serving a fixed share of the clients.
 template <
     typename Data,
     bool kExpectReply,
@@ -326,29 +457,75 @@ class CommT : public CommInternalT<
     explicit Client(Comm* pp)
         : CommInternal::Client(pp),
           pp_(pp),
-          rng_(time(NULL)),
           logger_(elf::logging::getIndexedLogger("elf::comm::Client-", "")) {}
 
-    ReplyStatus sendWait(Data data, const std::vector<std::string>& labels) {
+    ReplyStatus sendWait(
+        Data data,
+        const std::vector<std::string>& labels,
+        Priority priority = NORMAL) {
+      const Id id = std::this_thread::get_id();
       return CommInternal::Client::sendWait(
-          std::this_thread::get_id(), label2server(labels), data);
+          id, label2server(labels, pp_->threadKey(id)), data, priority);
     }
 
     ReplyStatus sendBatchWait(
         const std::vector<Data>& data,
-        const std::vector<std::string>& labels) {
+        const std::vector<std::string>& labels,
+        Priority priority = NORMAL) {
+      const Id id = std::this_thread::get_id();
       return CommInternal::Client::sendBatchWait(
-          std::this_thread::get_id(), label2server(labels), data);
+          id, label2server(labels, pp_->threadKey(id)), data, priority);
+    }
+
+    // A request of sendTagged.
+    struct Request {
+      const std::vector<std::string>* labels;
+      const Data* data;
+      size_t size;
+      Priority priority;
+      // Picks the shard of each label, as the thread does in sendWait.
+      size_t shard_key;
+    };
+
+    using Release = typename CommInternal::Release;
+
+    // Send r without waiting, one message to each server of its labels,
+    // all tagged with tag. Returns the number of messages, each released
+    // by a reply of its own (see runReply); 0 if no server has the labels.
+    size_t sendTagged(const Request& r, size_t tag) {
+      thread_local std::vector<typename CommInternal::Outgoing> outgoing;
+      outgoing.clear();
+      for (Id server : label2server(*r.labels, r.shard_key)) {
+        outgoing.push_back({server, r.data, r.size, r.priority});
+      }
+      if (!outgoing.empty()) {
+        CommInternal::Client::sendTagged(
+            std::this_thread::get_id(), outgoing, tag);
+      }
+      return outgoing.size();
+    }
+
+    bool runReply(int timeout_usec, std::vector<Release>* released) {
+      return CommInternal::Client::runReply(
+          std::this_thread::get_id(), timeout_usec, released);
+    }
+
+    void waitReleased() {
+      CommInternal::Client::waitReleased(std::this_thread::get_id());
     }
 
    private:
     Comm* pp_;
-    std::mt19937 rng_;
     std::shared_ptr<spdlog::logger> logger_;
 
-    std::vector<Id> label2server(const std::vector<std::string>& labels) {
+    // The result is only valid until the next call from the same thread.
+    const std::vector<Id>& label2server(
+        const std::vector<std::string>& labels,
+        size_t shard_key) {
       assert(!labels.empty());
-      std::vector<Id> server_ids;
+      // Clients are shared by threads, hence the per-thread scratch.
+      thread_local std::vector<Id> server_ids;
+      server_ids.clear();
 
       for (const auto& label : labels) {
         // [TODO] Will this one work in multithreading case?
@@ -358,11 +535,11 @@ class CommT : public CommInternalT<
           logger_->warn("WARNING! no servers has the label: {}", label);
         } else {
           const std::vector<Id>& ids = *(elem->second);
-          // Randomly pick one of the label.
+          // A client always picks the same server of the label, and
+          // clients are spread evenly over them.
           // Note that there is no lock needed since only
           // read access is requested.
-          const int idx = rng_() % ids.size();
-          server_ids.push_back(ids.at(idx));
+          server_ids.push_back(ids.at(shard_key % ids.size()));
         }
       }
 
@@ -414,9 +591,28 @@ class CommT : public CommInternalT<
  private:
   using ServerLabelMap =
       tbb::concurrent_hash_map<std::string, std::unique_ptr<std::vector<Id>>>;
+  using ThreadKeyMap = tbb::concurrent_hash_map<Id, size_t>;
 
   ServerLabelMap serverLabels_;
   std::mutex register_mutex_;
+
+  // Client threads of this Comm, numbered in order of their first request.
+  ThreadKeyMap threadKeys_;
+  std::atomic<size_t> numClientThreads_{0};
+
+  size_t threadKey(Id id) {
+    {
+      ThreadKeyMap::const_accessor elem;
+      if (threadKeys_.find(elem, id)) {
+        return elem->second;
+      }
+    }
+    ThreadKeyMap::accessor elem;
+    if (threadKeys_.insert(elem, id)) {
+      elem->second = numClientThreads_++;
+    }
+    return elem->second;
+  }
 };
 
 } // namespace comm
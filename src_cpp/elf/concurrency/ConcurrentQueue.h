@@ -27,19 +27,34 @@
  *
  * ConcurrentQueueTBB<T>
  *   An alternative implementation, backed by tbb::concurrent_queue.
+ *
+ * ConcurrentQueueRing<T>, ConcurrentQueueRingSmall<T>
+ *   Bounded multi-producer single-consumer ring buffers (4096 and 64 slots)
+ *   whose consumer spins briefly, then sleeps until a push (futex on Linux).
+ *   push blocks while the ring is full.
  */
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <cassert>
 #include <chrono>
 #include <condition_variable>
-#include <deque>
+#include <cstdint>
 #include <functional>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 #include <blockingconcurrentqueue.h>
 #include <tbb/concurrent_queue.h>
 
@@ -48,8 +63,9 @@ namespace concurrency {
 
 // moodycamel internally maintains a bunch of sub-queues for each producer
 // thread and sometimes is not fair (the consumer.might always pick the data
-// from a particular thread). Therefore, we amend it with a deque, which makes
-// it only works for a single consumer.
+// from a particular thread). Therefore, we amend it with a buffer, which makes
+// it only works for a single consumer. The buffer is a vector drained from
+// head_, so that its storage is reused instead of reallocated.
 template <typename T>
 class ConcurrentQueueMoodyCamel {
  public:
@@ -77,7 +93,8 @@ class ConcurrentQueueMoodyCamel {
  private:
   using QueueT = moodycamel::BlockingConcurrentQueue<T>;
   QueueT q_;
-  std::deque<T> buffer_;
+  std::vector<T> buffer_;
+  size_t head_ = 0;
 
   std::thread::id single_consumer_;
   bool no_consumer_ = true;
@@ -92,16 +109,22 @@ class ConcurrentQueueMoodyCamel {
   }
 
   bool _prefetch(T* v) {
+    // Drop consumed entries once they are the majority, so the buffer does
+    // not keep growing while the consumer lags behind.
+    if (head_ > 0 && 2 * head_ >= buffer_.size()) {
+      buffer_.erase(buffer_.begin(), buffer_.begin() + head_);
+      head_ = 0;
+    }
+
     T value;
     while (q_.wait_dequeue_timed(value, std::chrono::microseconds(0))) {
       buffer_.push_back(value);
     }
 
-    if (buffer_.empty())
+    if (head_ == buffer_.size())
       return false;
 
-    *v = buffer_.front();
-    buffer_.pop_front();
+    *v = buffer_[head_++];
     return true;
   }
 };
@@ -140,6 +163,234 @@ class ConcurrentQueueTBB {
   QueueT q_;
 };
 
+namespace detail {
+
+// Lets one thread sleep until another one wakes it up, or a timeout. Wake-ups
+// are not lost: wake() after prepare() makes the following wait() return.
+class Parker {
+ public:
+  // Announce that we are about to wait. Check the wait condition again after
+  // this, then call wait() if still needed, and done() in any case.
+  void prepare() {
+    state_.store(kParked, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Sleep until wake() or for usec (usec < 0: no timeout). May return
+  // spuriously.
+  void wait(int64_t usec) {
+#ifdef __linux__
+    struct timespec ts;
+    struct timespec* timeout = nullptr;
+    if (usec >= 0) {
+      ts.tv_sec = usec / 1000000;
+      ts.tv_nsec = (usec % 1000000) * 1000;
+      timeout = &ts;
+    }
+    syscall(
+        SYS_futex,
+        reinterpret_cast<uint32_t*>(&state_),
+        FUTEX_WAIT_PRIVATE,
+        kParked,
+        timeout,
+        nullptr,
+        0);
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(
+        usec >= 0 ? std::min<int64_t>(usec, 50) : 50));
+#endif
+  }
+
+  void done() {
+    state_.store(kAwake, std::memory_order_relaxed);
+  }
+
+  // Called by producers after publishing.
+  void wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (state_.load(std::memory_order_relaxed) == kParked &&
+        state_.exchange(kAwake) == kParked) {
+#ifdef __linux__
+      syscall(
+          SYS_futex,
+          reinterpret_cast<uint32_t*>(&state_),
+          FUTEX_WAKE_PRIVATE,
+          1,
+          nullptr,
+          nullptr,
+          0);
+#endif
+    }
+  }
+
+ private:
+  static constexpr uint32_t kAwake = 0;
+  static constexpr uint32_t kParked = 1;
+  std::atomic<uint32_t> state_{kAwake};
+};
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+} // namespace detail
+
+// Bounded MPSC ring (sequence numbered slots, as in Vyukov's bounded queue).
+// Producers claim a slot with a CAS on tail_ and publish it by bumping the
+// slot's sequence number; the single consumer needs no atomic RMW at all.
+// The consumer spins for a while before parking, since in comm a reply
+// usually arrives within a few microseconds. The spin budget adapts: it
+// doubles when spinning paid off and halves when the consumer had to park
+// anyway (and is 0 on a single CPU, where spinning only delays producers).
+template <typename T, size_t kCapacity>
+class ConcurrentQueueRingT {
+  static_assert(
+      kCapacity >= 2 && (kCapacity & (kCapacity - 1)) == 0,
+      "capacity must be a power of 2");
+
+ public:
+  using value_type = T;
+  using Clock = std::chrono::steady_clock;
+
+  ConcurrentQueueRingT() : slots_(kCapacity) {
+    for (size_t i = 0; i < kCapacity; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  void push(const T& value) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (int attempt = 0;; ++attempt) {
+      slot = &slots_[pos & kMask];
+      const size_t seq = slot->seq.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else {
+        if (diff < 0) {
+          // Full: let the consumer run. Rare with a large enough ring, so
+          // producers just poll.
+          if (attempt < kYields) {
+            std::this_thread::yield();
+          } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+          }
+        }
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = value;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    parker_.wake();
+  }
+
+  void pop(T* value) {
+    waitPop(value, nullptr);
+  }
+
+  template <typename Rep, typename Period>
+  bool pop(T* value, std::chrono::duration<Rep, Period> timeout) {
+    if (tryPop(value)) {
+      return true;
+    }
+    if (timeout <= timeout.zero()) {
+      return false;
+    }
+    const Clock::time_point deadline =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(timeout);
+    return waitPop(value, &deadline);
+  }
+
+ private:
+  static constexpr size_t kMask = kCapacity - 1;
+  static constexpr int kMinSpins = 16;
+  static constexpr int kMaxSpins = 4096;
+  static constexpr int kYields = 4;
+
+  struct Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  std::vector<Slot> slots_;
+  alignas(64) std::atomic<size_t> tail_{0};
+  alignas(64) size_t head_ = 0;
+  int spins_ = std::thread::hardware_concurrency() > 1 ? 256 : 0;
+  detail::Parker parker_;
+
+  bool tryPop(T* value) {
+    Slot& slot = slots_[head_ & kMask];
+    if (slot.seq.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    *value = std::move(slot.value);
+    slot.seq.store(head_ + kCapacity, std::memory_order_release);
+    head_++;
+    return true;
+  }
+
+  // Spin, then yield, then park until an item arrives or the deadline (if
+  // any) passes.
+  bool waitPop(T* value, const Clock::time_point* deadline) {
+    for (int i = 0; i < spins_ + kYields; ++i) {
+      if (tryPop(value)) {
+        if (i < spins_) {
+          spins_ = std::min(2 * spins_, kMaxSpins);
+        }
+        return true;
+      }
+      if (deadline != nullptr && Clock::now() >= *deadline) {
+        return false;
+      }
+      if (i < spins_) {
+        detail::cpuRelax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    if (spins_ > 0) {
+      spins_ = std::max(spins_ / 2, kMinSpins);
+    }
+
+    while (true) {
+      parker_.prepare();
+      if (tryPop(value)) {
+        parker_.done();
+        return true;
+      }
+      int64_t usec = -1;
+      if (deadline != nullptr) {
+        usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                   *deadline - Clock::now())
+                   .count();
+        if (usec <= 0) {
+          parker_.done();
+          return tryPop(value);
+        }
+      }
+      parker_.wait(usec);
+      parker_.done();
+      if (tryPop(value)) {
+        return true;
+      }
+    }
+  }
+};
+
+template <typename T>
+using ConcurrentQueueRing = ConcurrentQueueRingT<T, 4096>;
+
+// For queues that only ever hold a few items, e.g. the replies a client
+// waits for.
+template <typename T>
+using ConcurrentQueueRingSmall = ConcurrentQueueRingT<T, 64>;
+
 // Define the moodycamel queue to be the default implementation
 template <typename T>
 using ConcurrentQueue = ConcurrentQueueMoodyCamel<T>;
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// The ConcurrentQueue implementations as comm::CommT queues, under the
+// pattern of the comm layer: many producer threads (games) each blocked in
+// sendWait, one consumer (collector) batching and releasing them.
+//
+// Usage: ConcurrentQueueBench [num_producers] [batchsize] [seconds]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "elf/comm/comm.h"
+#include "elf/concurrency/ConcurrentQueue.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+template <
+    template <typename> class ClientQueue,
+    template <typename> class ServerQueue>
+void run(const char* name, int num_producers, int batchsize, double seconds) {
+  using Comm = comm::CommT<int*, true, ClientQueue, ServerQueue>;
+  Comm comm;
+  auto server = comm.getServer();
+  auto client = comm.getClient();
+
+  std::atomic<bool> stop(false);
+  std::atomic<int> num_done(0);
+  std::atomic<int64_t> num_requests(0);
+
+  std::thread consumer([&]() {
+    server->RegServer("actor");
+    comm::RecvOptions options("actor", batchsize, 1000);
+    std::vector<typename Comm::Message> batch;
+    while (num_done < num_producers) {
+      server->waitBatch(options, &batch);
+      server->ReleaseBatch(batch, comm::SUCCESS);
+    }
+  });
+  server->waitForRegs(1);
+
+  std::vector<std::thread> producers;
+  for (int i = 0; i < num_producers; ++i) {
+    producers.emplace_back([&]() {
+      const std::vector<std::string> labels{"actor"};
+      int data = 0;
+      while (!stop) {
+        client->sendWait(&data, labels);
+        num_requests++;
+      }
+      num_done++;
+    });
+  }
+
+  // Let all producers start before measuring.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  const int64_t start_requests = num_requests;
+  const auto start = Clock::now();
+  std::this_thread::sleep_for(
+      std::chrono::microseconds((int64_t)(seconds * 1e6)));
+  const int64_t requests = num_requests - start_requests;
+  const double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  stop = true;
+  for (auto& t : producers) {
+    t.join();
+  }
+  consumer.join();
+
+  printf(
+      "%-10s %10.0f requests/s, %8.1f us/round trip per producer\n",
+      name,
+      requests / elapsed,
+      requests > 0 ? elapsed * 1e6 * num_producers / requests : 0.0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const int num_producers = argc > 1 ? atoi(argv[1]) : 4096;
+  const int batchsize = argc > 2 ? atoi(argv[2]) : 128;
+  const double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+
+  printf(
+      "%d producers, batchsize %d, %.1f s each\n",
+      num_producers,
+      batchsize,
+      seconds);
+  using namespace elf::concurrency;
+  run<ConcurrentQueueMoodyCamel, ConcurrentQueueMoodyCamel>(
+      "moodycamel", num_producers, batchsize, seconds);
+  run<ConcurrentQueueRingSmall, ConcurrentQueueRing>(
+      "ring", num_producers, batchsize, seconds);
+  run<ConcurrentQueueTBB, ConcurrentQueueTBB>(
+      "tbb", num_producers, batchsize, seconds);
+  return 0;
+}
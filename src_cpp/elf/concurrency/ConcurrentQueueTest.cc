@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "ConcurrentQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace elf {
+
+namespace concurrency {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Which producer, and its count.
+struct Item {
+  int producer = -1;
+  int seq = -1;
+};
+
+// Pops num_items from each of num_producers producers, and checks that those
+// of each producer come in order.
+template <typename Queue>
+void expectFifoPerProducer(Queue& q, int num_producers, int num_items) {
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&q, p, num_items]() {
+      for (int i = 0; i < num_items; ++i) {
+        q.push(Item{p, i});
+      }
+    });
+  }
+  std::vector<int> next(num_producers, 0);
+  for (int n = 0; n < num_producers * num_items; ++n) {
+    Item item;
+    ASSERT_TRUE(q.pop(&item, std::chrono::seconds(10)));
+    ASSERT_GE(item.producer, 0);
+    ASSERT_LT(item.producer, num_producers);
+    EXPECT_EQ(item.seq, next[item.producer]++);
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  Item item;
+  EXPECT_FALSE(q.pop(&item, std::chrono::milliseconds(0)));
+}
+
+} // namespace
+
+TEST(ConcurrentQueueRingTest, FifoPerProducer) {
+  ConcurrentQueueRing<Item> q;
+  expectFifoPerProducer(q, 8, 20000);
+}
+
+TEST(ConcurrentQueueRingTest, FullRingBlocksProducers) {
+  // Far more items than slots: producers wait for the consumer.
+  ConcurrentQueueRingT<Item, 8> q;
+  expectFifoPerProducer(q, 4, 5000);
+}
+
+TEST(ConcurrentQueueRingTest, ProducersWaitUntilPopped) {
+  ConcurrentQueueRingT<Item, 4> q;
+  std::atomic<int> pushed{0};
+  std::thread producer([&]() {
+    for (int i = 0; i < 8; ++i) {
+      q.push(Item{0, i});
+      pushed++;
+    }
+  });
+  // Only as many as the ring holds, until we pop.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(pushed, 4);
+  for (int i = 0; i < 8; ++i) {
+    Item item;
+    ASSERT_TRUE(q.pop(&item, std::chrono::seconds(10)));
+    EXPECT_EQ(item.seq, i);
+  }
+  producer.join();
+  EXPECT_EQ(pushed, 8);
+}
+
+TEST(ConcurrentQueueRingTest, TimedPopOnEmpty) {
+  ConcurrentQueueRing<Item> q;
+  Item item;
+  for (auto timeout : {std::chrono::milliseconds(0),
+                       std::chrono::milliseconds(20),
+                       std::chrono::milliseconds(100)}) {
+    const auto start = Clock::now();
+    EXPECT_FALSE(q.pop(&item, timeout));
+    const auto elapsed = Clock::now() - start;
+    EXPECT_GE(elapsed, timeout);
+    // Roughly the timeout: parked, not returning early or much later.
+    EXPECT_LT(elapsed, timeout + std::chrono::milliseconds(50));
+  }
+}
+
+TEST(ConcurrentQueueRingTest, WakesUpParkedConsumer) {
+  ConcurrentQueueRing<Item> q;
+  std::thread producer([&]() {
+    // Long enough for the consumer to be parked.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    q.push(Item{0, 42});
+  });
+  Item item;
+  const auto start = Clock::now();
+  // Without timeout, then with a long one.
+  q.pop(&item);
+  EXPECT_EQ(item.seq, 42);
+  EXPECT_LT(Clock::now() - start, std::chrono::seconds(5));
+  producer.join();
+
+  std::thread again([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    q.push(Item{0, 43});
+  });
+  ASSERT_TRUE(q.pop(&item, std::chrono::seconds(10)));
+  EXPECT_EQ(item.seq, 43);
+  EXPECT_LT(Clock::now() - start, std::chrono::seconds(5));
+  again.join();
+}
+
+TEST(ParkerTest, WakeAfterPark) {
+  detail::Parker parker;
+  std::atomic<bool> ready{false};
+  std::atomic<bool> woken{false};
+  std::thread waiter([&]() {
+    while (true) {
+      parker.prepare();
+      if (ready) {
+        parker.done();
+        break;
+      }
+      parker.wait(-1);
+      parker.done();
+    }
+    woken = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(woken);
+  ready = true;
+  parker.wake();
+  waiter.join();
+  EXPECT_TRUE(woken);
+}
+
+TEST(ParkerTest, WakeBeforeWaitIsNotLost) {
+  detail::Parker parker;
+  parker.prepare();
+  parker.wake();
+  const auto start = Clock::now();
+  // Would sleep for 10 sec if the wake-up was lost.
+  parker.wait(10 * 1000 * 1000);
+  parker.done();
+  EXPECT_LT(Clock::now() - start, std::chrono::seconds(1));
+}
+
+TEST(ParkerTest, WaitTimesOut) {
+  detail::Parker parker;
+  parker.prepare();
+  const auto start = Clock::now();
+  parker.wait(20 * 1000);
+  parker.done();
+  EXPECT_LT(Clock::now() - start, std::chrono::seconds(1));
+}
+
+} // namespace concurrency
+
+} // namespace elf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
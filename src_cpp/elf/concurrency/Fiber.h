@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * The Fiber class is a stackful coroutine: a function with a stack of its
+ * own, that runs on the thread calling resume() until it calls suspend()
+ * (or returns), and continues from there on the next resume().
+ *
+ * A fiber must always be resumed from the same thread, so that
+ * thread_local state seen by its function stays consistent.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+namespace elf {
+namespace concurrency {
+
+class Fiber {
+ public:
+  static constexpr size_t kDefaultStackSize = 256 * 1024;
+
+  explicit Fiber(
+      std::function<void()> func,
+      size_t stack_size = kDefaultStackSize)
+      : func_(std::move(func)) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    // Rounded up to pages, plus a guard page below the stack. Pages are
+    // only committed once touched.
+    stackSize_ = ((stack_size + page - 1) / page + 1) * page;
+    stack_ = mmap(
+        nullptr,
+        stackSize_,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0);
+    if (stack_ == MAP_FAILED) {
+      throw std::runtime_error("Fiber: cannot allocate stack");
+    }
+    mprotect(stack_, page, PROT_NONE);
+
+    getcontext(&context_);
+    context_.uc_stack.ss_sp = stack_;
+    context_.uc_stack.ss_size = stackSize_;
+    context_.uc_link = nullptr;
+    // makecontext only passes ints.
+    const uintptr_t self = reinterpret_cast<uintptr_t>(this);
+    makecontext(
+        &context_,
+        reinterpret_cast<void (*)()>(&Fiber::entry),
+        2,
+        (uint32_t)(self >> 32),
+        (uint32_t)self);
+  }
+
+  ~Fiber() {
+    munmap(stack_, stackSize_);
+  }
+
+  Fiber(const Fiber&) = delete;
+  Fiber& operator=(const Fiber&) = delete;
+
+  // Run the fiber until it suspends or returns. Returns false once it has
+  // returned.
+  bool resume() {
+    assert(!done_ && current() == nullptr);
+    current() = this;
+    swapcontext(&caller_, &context_);
+    current() = nullptr;
+    return !done_;
+  }
+
+  // Called from within a fiber: back to the resume() that ran it.
+  static void suspend() {
+    Fiber* self = current();
+    assert(self != nullptr);
+    swapcontext(&self->context_, &self->caller_);
+  }
+
+  // The fiber running on this thread, if any.
+  static Fiber*& current() {
+    thread_local Fiber* fiber = nullptr;
+    return fiber;
+  }
+
+  bool done() const {
+    return done_;
+  }
+
+ private:
+  std::function<void()> func_;
+  void* stack_ = nullptr;
+  size_t stackSize_ = 0;
+  ucontext_t context_;
+  ucontext_t caller_;
+  bool done_ = false;
+
+  static void entry(uint32_t hi, uint32_t lo) {
+    Fiber* self =
+        reinterpret_cast<Fiber*>(((uintptr_t)hi << 32) | (uintptr_t)lo);
+    self->func_();
+    self->done_ = true;
+    swapcontext(&self->context_, &self->caller_);
+  }
+};
+
+} // namespace concurrency
+} // namespace elf
@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * The WorkerPool class runs the tasks of a parallel for on a fixed set of
+ * threads plus the calling one.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace elf {
+namespace concurrency {
+
+class WorkerPool {
+ public:
+  using Task = std::function<void(int)>;
+
+  /**
+   * num_threads is the total parallelism, including the thread calling run().
+   */
+  explicit WorkerPool(int num_threads) {
+    for (int i = 1; i < num_threads; ++i) {
+      threads_.emplace_back([this]() { loop(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+      t.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  int size() const {
+    return threads_.size() + 1;
+  }
+
+  /**
+   * This method calls task(0), ..., task(num_tasks - 1), spread over the pool
+   * and the calling thread, and returns when all of them are done. Only one
+   * run() may be in flight at a time.
+   */
+  void run(int num_tasks, const Task& task) {
+    if (num_tasks <= 0) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &task;
+      num_tasks_ = num_tasks;
+      next_ = 0;
+      done_ = 0;
+      generation_++;
+    }
+    cv_.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    doneCv_.wait(lock, [this]() { return done_ == num_tasks_; });
+    task_ = nullptr;
+  }
+
+ private:
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable doneCv_;
+  bool stop_ = false;
+  uint64_t generation_ = 0;
+
+  const Task* task_ = nullptr;
+  int num_tasks_ = 0;
+  int next_ = 0;
+  int done_ = 0;
+
+  void loop() {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+      }
+      work();
+    }
+  }
+
+  // Take tasks of the current run() until there are none left.
+  void work() {
+    while (true) {
+      const Task* task = nullptr;
+      int i = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (task_ == nullptr || next_ >= num_tasks_) {
+          return;
+        }
+        task = task_;
+        i = next_++;
+      }
+
+      (*task)(i);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (++done_ == num_tasks_) {
+        doneCv_.notify_all();
+      }
+    }
+  }
+};
+
+} // namespace concurrency
+} // namespace elf
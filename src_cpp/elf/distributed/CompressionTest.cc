@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "compression.h"
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace elf {
+
+namespace shared {
+
+namespace {
+
+// Record-like json messages: the same keys over and over, random values.
+std::string sampleMessage(std::mt19937& rng) {
+  std::string s = "[";
+  const int n = 4 + rng() % 8;
+  for (int i = 0; i < n; ++i) {
+    s += "{\"thread_id\":" + std::to_string(rng() % 64) +
+        ",\"seq\":" + std::to_string(rng() % 1000) +
+        ",\"reward\":" + std::to_string(rng() % 2 ? 1 : -1) +
+        ",\"content\":\"(;B[" + std::string(1, 'a' + rng() % 19) +
+        std::string(1, 'a' + rng() % 19) + "])\",\"offline\":false}";
+  }
+  return s + "]";
+}
+
+std::vector<std::string> sampleMessages(int n, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::vector<std::string> samples;
+  for (int i = 0; i < n; ++i) {
+    samples.push_back(sampleMessage(rng));
+  }
+  return samples;
+}
+
+} // namespace
+
+TEST(CompressionTest, RoundTrip) {
+  Compressor c;
+  EXPECT_EQ(c.dictId(), 0u);
+  for (const auto& s : sampleMessages(20, 0)) {
+    const std::string packed = c.pack(s);
+    EXPECT_EQ(packed[0], PACK_ZSTD);
+    EXPECT_LT(packed.size(), s.size());
+    EXPECT_EQ(c.unpack(packed), s);
+  }
+}
+
+TEST(CompressionTest, RawWhenNotWorthIt) {
+  Compressor c;
+  const std::string small = "{}";
+  EXPECT_EQ(c.pack(small), std::string(1, PACK_RAW) + small);
+  EXPECT_EQ(c.unpack(c.pack(small)), small);
+  EXPECT_EQ(c.unpack(c.pack("")), "");
+
+  std::mt19937 rng(0);
+  std::string noise(4096, '\0');
+  for (char& ch : noise) {
+    ch = rng();
+  }
+  const std::string packed = c.pack(noise);
+  EXPECT_EQ(packed[0], PACK_RAW);
+  EXPECT_EQ(c.unpack(packed), noise);
+}
+
+TEST(CompressionTest, Dictionary) {
+  const std::string dict =
+      Compressor::trainDictionary(sampleMessages(1000, 1), 4096);
+  Compressor with_dict(3, dict);
+  Compressor plain;
+  EXPECT_NE(with_dict.dictId(), 0u);
+
+  size_t dict_size = 0, plain_size = 0;
+  for (const auto& s : sampleMessages(50, 2)) {
+    const std::string packed = with_dict.pack(s);
+    EXPECT_EQ(packed[0], PACK_ZSTD_DICT);
+    EXPECT_EQ(with_dict.unpack(packed), s);
+    dict_size += packed.size();
+    plain_size += plain.pack(s).size();
+
+    // Needs the same dictionary.
+    EXPECT_THROW(plain.unpack(packed), std::runtime_error);
+    // Not using it is fine, for readers without it.
+    EXPECT_EQ(plain.unpack(with_dict.pack(s, false)), s);
+  }
+  EXPECT_LT(dict_size, plain_size);
+}
+
+TEST(CompressionTest, Malformed) {
+  Compressor c;
+  const std::string packed = c.pack(sampleMessages(1, 3)[0]);
+  EXPECT_THROW(c.unpack(""), std::runtime_error);
+  EXPECT_THROW(c.unpack(std::string(1, 7) + "abc"), std::runtime_error);
+  for (size_t n = 1; n < packed.size(); ++n) {
+    EXPECT_THROW(c.unpack(packed.substr(0, n)), std::runtime_error);
+  }
+  EXPECT_THROW(Compressor(3, "not a dictionary"), std::runtime_error);
+}
+
+} // namespace shared
+
+} // namespace elf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,462 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "shared_rw_buffer2.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace elf {
+
+namespace shared {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kTimeout = std::chrono::seconds(10);
+
+// Each test listens on its own inproc endpoint.
+Options inprocOptions(int port) {
+  Options opt;
+  opt.port = port;
+  opt.use_ipv6 = false;
+  opt.transport = "inproc";
+  opt.addr = "localhost";
+  return opt;
+}
+
+Options negotiatingOptions(int port) {
+  Options opt = inprocOptions(port);
+  opt.formats = {"binary"};
+  opt.compression = "zstd";
+  opt.stream_credits = 4;
+  opt.heartbeat_sec = 1;
+  return opt;
+}
+
+// Waits for the next reply, handling the negotiation answers before it.
+bool nextReply(Writer& w, std::string* reply) {
+  const auto end = Clock::now() + kTimeout;
+  while (Clock::now() < end) {
+    if (w.getReplyNoblock(reply)) {
+      return true;
+    }
+    w.waitReply(10);
+  }
+  return false;
+}
+
+// Handles whatever the Reader has sent so far, for up to ms.
+int drainReplies(Writer& w, long ms) {
+  int n = 0;
+  std::string reply;
+  const auto end = Clock::now() + std::chrono::milliseconds(ms);
+  while (Clock::now() < end) {
+    while (w.getReplyNoblock(&reply)) {
+      n++;
+    }
+    w.waitReply(10);
+  }
+  return n;
+}
+
+template <typename F>
+bool waitUntil(F done) {
+  const auto end = Clock::now() + kTimeout;
+  while (!done()) {
+    if (Clock::now() >= end) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+// A Reader that predates negotiation: replies to every frame.
+class OldReader {
+ public:
+  struct Frame {
+    std::string identity, title, msg;
+  };
+
+  explicit OldReader(int port) : receiver_(port, false, "inproc") {}
+
+  bool recv(Frame* f, long timeout_ms = 2000) {
+    if (!receiver_.recv_noblock(&f->identity, &f->title, &f->msg) &&
+        !(receiver_.poll(timeout_ms) &&
+          receiver_.recv_noblock(&f->identity, &f->title, &f->msg))) {
+      return false;
+    }
+    return true;
+  }
+
+  void send(const Frame& f, const std::string& title, const std::string& m) {
+    receiver_.send(f.identity, title, m);
+  }
+
+ private:
+  distri::ZMQReceiver receiver_;
+};
+
+Reader::ReplyFunc replyOk() {
+  return [](Reader*, const std::string&, std::string* reply) {
+    *reply = "ok";
+    return true;
+  };
+}
+
+} // namespace
+
+TEST(ReaderWriterTest, NewWriterOldReader) {
+  const int port = 17101;
+  OldReader reader(port);
+  Writer w(negotiatingOptions(port));
+
+  w.Ctrl("123");
+  EXPECT_TRUE(w.negotiating());
+  OldReader::Frame f;
+  ASSERT_TRUE(reader.recv(&f));
+  EXPECT_EQ(f.title, "ctrl");
+  EXPECT_EQ(elf_utils::split(f.msg, '\n')[0], "123");
+  reader.send(f, "reply", "r");
+  // The offers came in the ctrl frame: nothing else to reply to.
+  EXPECT_FALSE(reader.recv(&f, 100));
+
+  std::string reply;
+  ASSERT_TRUE(nextReply(w, &reply));
+  EXPECT_EQ(reply, "r");
+  EXPECT_FALSE(w.negotiating());
+  EXPECT_FALSE(w.streaming());
+  EXPECT_EQ(w.format(), "");
+  EXPECT_EQ(w.heartbeatSec(), 0);
+  EXPECT_FALSE(w.Heartbeat("beat"));
+
+  w.Insert("{}");
+  ASSERT_TRUE(reader.recv(&f));
+  EXPECT_EQ(f.title, "content");
+  EXPECT_EQ(f.msg, "{}");
+}
+
+TEST(ReaderWriterTest, OldWriterNewReader) {
+  const int port = 17102;
+  Options opt = negotiatingOptions(port);
+  std::atomic<int> processed{0};
+  std::atomic<int> beats{0};
+  Reader r("db", opt);
+  r.startReceiving(
+      [&](Reader*, const std::string&, const std::string& msg) {
+        EXPECT_EQ(msg, "{}");
+        processed++;
+        return true;
+      },
+      replyOk(),
+      nullptr,
+      [&](Reader*, const std::string&, const std::string&) { beats++; });
+
+  // As sent by a Writer that predates negotiation.
+  distri::ZMQSender sender("old", "localhost", port, false, "inproc");
+  std::string title, msg;
+  auto recv = [&]() {
+    return sender.recv_noblock(&title, &msg) ||
+        (sender.poll(2000) && sender.recv_noblock(&title, &msg));
+  };
+  sender.send("ctrl", "123");
+  ASSERT_TRUE(recv());
+  EXPECT_EQ(title, "reply");
+  for (int i = 0; i < 3; ++i) {
+    sender.send("content", "{}");
+    ASSERT_TRUE(recv());
+    // Lockstep: no credits, only the reply.
+    EXPECT_EQ(title, "reply");
+    EXPECT_EQ(msg, "ok");
+  }
+  EXPECT_FALSE(sender.poll(100));
+  EXPECT_EQ(processed, 3);
+  EXPECT_EQ(beats, 0);
+}
+
+TEST(ReaderWriterTest, Negotiation) {
+  const int port = 17103;
+  Options ropt = negotiatingOptions(port);
+  ropt.formats = {"other", "binary"};
+  ropt.stream_credits = 2;
+  ropt.heartbeat_sec = 3;
+  std::vector<std::string> received;
+  std::mutex mutex;
+  Reader r("db", ropt);
+  r.startReceiving(
+      [&](Reader*, const std::string&, const std::string& msg) {
+        std::lock_guard<std::mutex> lock(mutex);
+        received.push_back(msg);
+        return true;
+      },
+      replyOk(),
+      nullptr,
+      [](Reader*, const std::string&, const std::string&) {});
+
+  Writer w(negotiatingOptions(port));
+  w.Ctrl("123");
+  std::string reply;
+  ASSERT_TRUE(nextReply(w, &reply));
+  EXPECT_FALSE(w.negotiating());
+  EXPECT_EQ(w.format(), "binary");
+  EXPECT_TRUE(w.streaming());
+  // The smaller window, and the longer heartbeat interval.
+  EXPECT_EQ(w.credits(), 2);
+  EXPECT_EQ(w.heartbeatSec(), 3);
+
+  // Compressed on the way, and unpacked by the Reader.
+  const std::string content(1000, 'x');
+  w.Insert(content);
+  EXPECT_LT(w.bytesSent(), (int64_t)content.size());
+  ASSERT_TRUE(nextReply(w, &reply));
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(received.size(), 1u);
+  EXPECT_EQ(received[0], content);
+}
+
+TEST(ReaderWriterTest, CreditsComeBack) {
+  const int port = 17104;
+  Options opt = inprocOptions(port);
+  opt.stream_credits = 4;
+  std::atomic<int> processed{0};
+  Reader r("db", opt);
+  r.startReceiving(
+      [&](Reader*, const std::string&, const std::string&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        processed++;
+        return true;
+      },
+      replyOk());
+
+  Writer w(opt);
+  w.Ctrl("123");
+  std::string reply;
+  ASSERT_TRUE(nextReply(w, &reply));
+  ASSERT_TRUE(w.streaming());
+  ASSERT_EQ(w.credits(), 4);
+
+  const int kNumMessages = 100;
+  int sent = 0;
+  const auto end = Clock::now() + kTimeout;
+  while (sent < kNumMessages && Clock::now() < end) {
+    while (w.getReplyNoblock(&reply)) {
+    }
+    if (w.credits() > 0) {
+      w.Insert("{}");
+      sent++;
+      // Never more in flight than the window.
+      EXPECT_LE(sent - processed.load(), 4);
+    } else {
+      w.waitReply(10);
+    }
+  }
+  EXPECT_EQ(sent, kNumMessages);
+  ASSERT_TRUE(waitUntil([&]() { return processed == kNumMessages; }));
+  drainReplies(w, 100);
+  // Every credit has come back.
+  EXPECT_EQ(w.credits(), 4);
+}
+
+TEST(ReaderWriterTest, OrderPerWriter) {
+  const int port = 17105;
+  Options opt = inprocOptions(port);
+  opt.num_decode_workers = 4;
+  opt.stream_credits = 8;
+  std::mutex mutex;
+  std::map<std::string, std::vector<int>> received;
+  std::map<std::string, std::thread::id> threads;
+  bool same_thread = true;
+  Reader r("db", opt);
+  r.startReceiving(
+      [&](Reader*, const std::string& identity, const std::string& msg) {
+        std::lock_guard<std::mutex> lock(mutex);
+        received[identity].push_back(std::stoi(msg));
+        // Messages of one Writer go to the same worker.
+        auto it = threads.emplace(identity, std::this_thread::get_id()).first;
+        same_thread = same_thread && it->second == std::this_thread::get_id();
+        return true;
+      },
+      replyOk());
+
+  const int kNumWriters = 8;
+  const int kNumMessages = 50;
+  std::vector<std::unique_ptr<Writer>> writers;
+  std::vector<int> sent(kNumWriters, 0);
+  std::string reply;
+  for (int i = 0; i < kNumWriters; ++i) {
+    Options wopt = opt;
+    wopt.identity = "w" + std::to_string(i);
+    writers.emplace_back(new Writer(wopt));
+    writers.back()->Ctrl("123");
+  }
+  const auto end = Clock::now() + kTimeout;
+  int total = 0;
+  while (total < kNumWriters * kNumMessages && Clock::now() < end) {
+    for (int i = 0; i < kNumWriters; ++i) {
+      Writer& w = *writers[i];
+      while (w.getReplyNoblock(&reply)) {
+      }
+      while (w.credits() > 0 && sent[i] < kNumMessages) {
+        w.Insert(std::to_string(sent[i]++));
+        total++;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(total, kNumWriters * kNumMessages);
+  ASSERT_TRUE(waitUntil([&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t n = 0;
+    for (const auto& p : received) {
+      n += p.second.size();
+    }
+    return n == (size_t)total;
+  }));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_TRUE(same_thread);
+  ASSERT_EQ(received.size(), (size_t)kNumWriters);
+  for (const auto& p : received) {
+    for (int k = 0; k < (int)p.second.size(); ++k) {
+      EXPECT_EQ(p.second[k], k) << p.first;
+    }
+  }
+}
+
+TEST(ReaderWriterTest, Heartbeats) {
+  const int port = 17106;
+  Options opt = inprocOptions(port);
+  opt.stream_credits = 2;
+  opt.heartbeat_sec = 1;
+  std::atomic<int> beats{0};
+  std::atomic<int> processed{0};
+  Reader r("db", opt);
+  r.startReceiving(
+      [&](Reader*, const std::string&, const std::string&) {
+        processed++;
+        return true;
+      },
+      replyOk(),
+      nullptr,
+      [&](Reader*, const std::string& identity, const std::string& msg) {
+        EXPECT_EQ(identity.substr(0, 2), "hb");
+        EXPECT_EQ(msg, "state");
+        beats++;
+      });
+
+  Options wopt = opt;
+  wopt.identity = "hb";
+  Writer w(wopt);
+  EXPECT_FALSE(w.Heartbeat("state"));
+  w.Ctrl("123");
+  std::string reply;
+  ASSERT_TRUE(nextReply(w, &reply));
+  ASSERT_EQ(w.heartbeatSec(), 1);
+
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(w.Heartbeat("state"));
+  }
+  ASSERT_TRUE(waitUntil([&]() { return beats == 5; }));
+  EXPECT_EQ(r.numHeartbeats(), 5);
+  // Neither a reply nor a credit for them.
+  EXPECT_EQ(drainReplies(w, 100), 0);
+  EXPECT_EQ(w.credits(), 2);
+  EXPECT_EQ(processed, 0);
+}
+
+// What the client does after a long silence (see ThreadedWriterCtrl): the
+// credits still on their way must not add to the new window.
+TEST(ReaderWriterTest, CtrlAgainStartsNewWindow) {
+  const int port = 17107;
+  Options opt = inprocOptions(port);
+  opt.stream_credits = 4;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool blocked = true;
+  Reader r("db", opt);
+  r.startReceiving(
+      [&](Reader*, const std::string&, const std::string&) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return !blocked; });
+        return true;
+      },
+      replyOk());
+
+  Writer w(opt);
+  w.Ctrl("1");
+  std::string reply;
+  ASSERT_TRUE(nextReply(w, &reply));
+  ASSERT_EQ(w.credits(), 4);
+  for (int i = 0; i < 4; ++i) {
+    w.Insert("{}");
+  }
+  EXPECT_EQ(w.credits(), 0);
+
+  // The Reader is stuck: start over.
+  w.Ctrl("2");
+  EXPECT_FALSE(w.streaming());
+  EXPECT_EQ(w.credits(), 0);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    blocked = false;
+  }
+  cv.notify_all();
+
+  // Four replies for the content, one for the new Ctrl.
+  EXPECT_EQ(drainReplies(w, 300), 5);
+  EXPECT_FALSE(w.negotiating());
+  EXPECT_TRUE(w.streaming());
+  EXPECT_EQ(w.credits(), 4);
+}
+
+TEST(ReaderWriterTest, CtrlAgainSendsRaw) {
+  const int port = 17108;
+  OldReader reader(port);
+  Options opt = inprocOptions(port);
+  opt.compression = "zstd";
+  Writer w(opt);
+
+  OldReader::Frame f;
+  std::string reply;
+  w.Ctrl("1");
+  ASSERT_TRUE(reader.recv(&f));
+  reader.send(f, "compression", Options::compressionTag(0));
+  reader.send(f, "reply", "r");
+  ASSERT_TRUE(nextReply(w, &reply));
+  w.Insert("{}");
+  ASSERT_TRUE(reader.recv(&f));
+  EXPECT_EQ(f.title, "packed");
+
+  // Not acknowledged this time.
+  w.Ctrl("2");
+  ASSERT_TRUE(reader.recv(&f));
+  reader.send(f, "reply", "r");
+  ASSERT_TRUE(nextReply(w, &reply));
+  w.Insert("{}");
+  ASSERT_TRUE(reader.recv(&f));
+  EXPECT_EQ(f.title, "content");
+}
+
+} // namespace shared
+
+} // namespace elf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zdict.h>
+#include <zstd.h>
+
+namespace elf {
+
+namespace shared {
+
+// Per-message compression of the content sent from Writer to Reader.
+//
+// A packed message is a flag byte followed by the payload: the message
+// itself (PACK_RAW, for small or incompressible messages), or a zstd frame,
+// compressed with or without the dictionary (see trainDictionary).
+enum PackFlag : uint8_t {
+  PACK_RAW = 0,
+  PACK_ZSTD = 1,
+  PACK_ZSTD_DICT = 2,
+};
+
+// Not thread-safe: the compression contexts are reused across calls.
+class Compressor {
+ public:
+  // Messages below this size are not worth compressing.
+  static constexpr size_t kMinPackSize = 64;
+  // Refuse to unpack messages claiming to be larger than that.
+  static constexpr size_t kMaxUnpackedSize = 1ULL << 31;
+
+  // dict is the content of a dictionary (empty for none).
+  explicit Compressor(int level = 3, const std::string& dict = "")
+      : level_(level),
+        cctx_(ZSTD_createCCtx()),
+        dctx_(ZSTD_createDCtx()) {
+    if (!dict.empty()) {
+      cdict_ = ZSTD_createCDict(dict.data(), dict.size(), level_);
+      ddict_ = ZSTD_createDDict(dict.data(), dict.size());
+      dictId_ = ZDICT_getDictID(dict.data(), dict.size());
+      if (cdict_ == nullptr || ddict_ == nullptr || dictId_ == 0) {
+        release();
+        throw std::runtime_error("Compressor: invalid dictionary");
+      }
+    }
+  }
+
+  ~Compressor() {
+    release();
+  }
+
+  Compressor(const Compressor&) = delete;
+  Compressor& operator=(const Compressor&) = delete;
+
+  // Id of the dictionary, 0 if there is none.
+  unsigned dictId() const {
+    return dictId_;
+  }
+
+  std::string pack(const std::string& s, bool use_dict = true) {
+    std::string out;
+    if (s.size() >= kMinPackSize) {
+      const bool dict = use_dict && cdict_ != nullptr;
+      out.resize(1 + ZSTD_compressBound(s.size()));
+      const size_t n = dict
+          ? ZSTD_compress_usingCDict(
+                cctx_, &out[1], out.size() - 1, s.data(), s.size(), cdict_)
+          : ZSTD_compressCCtx(
+                cctx_, &out[1], out.size() - 1, s.data(), s.size(), level_);
+      if (!ZSTD_isError(n) && n < s.size()) {
+        out[0] = dict ? PACK_ZSTD_DICT : PACK_ZSTD;
+        out.resize(1 + n);
+        return out;
+      }
+    }
+    out.resize(1 + s.size());
+    out[0] = PACK_RAW;
+    s.copy(&out[1], s.size());
+    return out;
+  }
+
+  // Throws std::runtime_error on malformed messages, or if the message
+  // needs a dictionary we do not have.
+  std::string unpack(const std::string& msg) {
+    if (msg.empty()) {
+      throw std::runtime_error("Compressor: empty message");
+    }
+    const char* src = msg.data() + 1;
+    const size_t src_size = msg.size() - 1;
+    switch (msg[0]) {
+      case PACK_RAW:
+        return std::string(src, src_size);
+      case PACK_ZSTD:
+      case PACK_ZSTD_DICT:
+        break;
+      default:
+        throw std::runtime_error("Compressor: unknown flag");
+    }
+
+    const bool dict = msg[0] == PACK_ZSTD_DICT;
+    if (dict &&
+        (ddict_ == nullptr ||
+         ZSTD_getDictID_fromFrame(src, src_size) != dictId_)) {
+      throw std::runtime_error("Compressor: unknown dictionary");
+    }
+    const unsigned long long size = ZSTD_getFrameContentSize(src, src_size);
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        size > kMaxUnpackedSize) {
+      throw std::runtime_error("Compressor: bad frame header");
+    }
+    std::string out(size, '\0');
+    const size_t n = dict
+        ? ZSTD_decompress_usingDDict(
+              dctx_, &out[0], out.size(), src, src_size, ddict_)
+        : ZSTD_decompressDCtx(dctx_, &out[0], out.size(), src, src_size);
+    if (ZSTD_isError(n) || n != size) {
+      throw std::runtime_error("Compressor: corrupted frame");
+    }
+    return out;
+  }
+
+  // A dictionary of at most dict_size bytes, trained on typical messages.
+  // zstd needs a fair number of samples (hundreds, ideally about 100 times
+  // dict_size in total).
+  static std::string trainDictionary(
+      const std::vector<std::string>& samples,
+      size_t dict_size) {
+    std::string buffer;
+    std::vector<size_t> sizes;
+    for (const auto& s : samples) {
+      buffer += s;
+      sizes.push_back(s.size());
+    }
+    std::string dict(dict_size, '\0');
+    const size_t n = ZDICT_trainFromBuffer(
+        &dict[0], dict.size(), buffer.data(), sizes.data(), sizes.size());
+    if (ZDICT_isError(n)) {
+      throw std::runtime_error(
+          std::string("Compressor: cannot train dictionary: ") +
+          ZDICT_getErrorName(n));
+    }
+    dict.resize(n);
+    return dict;
+  }
+
+  static std::string loadDictionary(const std::string& filename) {
+    std::ifstream f(filename, std::ios::binary);
+    if (!f) {
+      throw std::runtime_error("Compressor: cannot open " + filename);
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+  }
+
+ private:
+  int level_;
+  ZSTD_CCtx* cctx_;
+  ZSTD_DCtx* dctx_;
+  ZSTD_CDict* cdict_ = nullptr;
+  ZSTD_DDict* ddict_ = nullptr;
+  unsigned dictId_ = 0;
+
+  void release() {
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeDDict(ddict_);
+    ZSTD_freeCCtx(cctx_);
+    ZSTD_freeDCtx(dctx_);
+  }
+};
+
+} // namespace shared
+
+} // namespace elf
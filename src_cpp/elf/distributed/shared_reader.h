@@ -9,6 +9,7 @@
 #pragma once
 
 #include <time.h>
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <functional>
@@ -92,7 +93,7 @@ class ReaderQueueT {
     int delta = 0;
     {
       std::unique_lock<std::shared_mutex> lock(rwMutex_);
-      buffer_.push_back(v);
+      buffer_.push_back(std::move(v));
       delta++;
       while (buffer_.size() > ctrl_.queue_max_size) {
         buffer_.pop_front();
@@ -163,7 +164,6 @@ class ReaderQueuesT {
 
   ReaderQueuesT(const RQCtrl& reader_ctrl)
       : min_size_satisfied_(false),
-        parity_sizes_(2, 0),
         logger_(elf::logging::getIndexedLogger(
             "elf::distributed::ReaderQueuesT-",
             "")) {
@@ -294,26 +294,27 @@ class ReaderQueuesT {
   size_t min_size_per_queue_ = 0;
   std::atomic_bool min_size_satisfied_;
 
-  size_t total_insertion_ = 0;
-  std::vector<int> parity_sizes_;
+  // Updated by concurrent insertions (e.g. from several ingest shards).
+  std::atomic<size_t> total_insertion_{0};
+  std::atomic<int> parity_sizes_[2] = {{0}, {0}};
 
   std::shared_ptr<spdlog::logger> logger_;
 
   int insert_impl(int idx, T&& v) {
     int delta = qs_[idx]->Insert(std::move(v));
-    total_insertion_++;
+    const size_t total_insertion = ++total_insertion_;
     parity_sizes_[idx % 2] += delta;
 
-    if (total_insertion_ % 1000 == 0) {
-      float even_ratio = static_cast<float>(parity_sizes_[0]) /
-          (parity_sizes_[0] + parity_sizes_[1] + 1e-6);
+    if (total_insertion % 1000 == 0) {
+      const int even = parity_sizes_[0], odd = parity_sizes_[1];
+      float even_ratio = static_cast<float>(even) / (even + odd + 1e-6);
       logger_->info(
           "{}, ReaderQueue Insertion: {}, even: {} {}%, odd {}: ",
           elf_utils::now(),
-          total_insertion_,
-          parity_sizes_[0],
+          total_insertion,
+          even,
           100 * even_ratio,
-          parity_sizes_[1]);
+          odd);
     }
     return delta;
   }
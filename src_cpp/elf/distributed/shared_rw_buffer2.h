@@ -9,22 +9,33 @@
 #pragma once
 
 #include <assert.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <ctime>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
+#include "elf/concurrency/ConcurrentQueue.h"
 #include "elf/logging/IndexedLoggerFactory.h"
 #include "elf/utils/utils.h"
 
+#include "compression.h"
 #include "shared_reader.h"
 #include "zmq_util.h"
 
@@ -36,8 +47,37 @@ struct Options {
   std::string addr;
   int port = 5556;
   bool use_ipv6 = true;
+  // "tcp", "ipc" or "inproc" (see elf::distri::endpoint).
+  std::string transport = "tcp";
   bool verbose = false;
   std::string identity;
+  // Encodings of the content this end supports besides json, in order of
+  // preference. The Writer offers them in Ctrl(), and the Reader picks the
+  // first one it supports too. Peers that do not negotiate use json.
+  std::vector<std::string> formats;
+  // Compression of the content: "zstd", or empty for none (see
+  // Compressor). A Reader unpacks whatever its Writers send. A Writer
+  // compresses once its Reader has acknowledged it in reply to Ctrl(), and
+  // uses the dictionary only if the Reader has loaded the same one.
+  std::string compression;
+  int compression_level = 3;
+  // Dictionary file, trained with Compressor::trainDictionary.
+  std::string compression_dict;
+  // Threads of a Reader unpacking and processing the messages.
+  int num_decode_workers = 1;
+  // Streaming with credit-based flow control, if both ends set it (0 for
+  // none): the Writer may have that many content messages in flight (at
+  // most, for the Reader), and gets a credit back for each one the Reader
+  // has processed. Otherwise the Writer waits for a reply to each message.
+  int stream_credits = 0;
+  // Heartbeats (see Writer::Heartbeat), if both ends set it (0 for none):
+  // the Writer offers to send one every heartbeat_sec seconds, and the
+  // Reader accepts, at that interval or its own if longer.
+  int heartbeat_sec = 0;
+  // Readers sharing the ingest of a server: shard k listens on port + k,
+  // and a Writer connects to the shard of its identity (see
+  // elf_utils::consistent_shard).
+  int num_shards = 1;
 
   std::string info() const {
     std::stringstream ss;
@@ -47,10 +87,67 @@ struct Options {
     } else {
       ss << "Connect to " << addr << ":" << port;
     }
+    if (transport != "tcp") {
+      ss << " over " << transport;
+    }
     ss << ", ipv6: " << elf_utils::print_bool(use_ipv6)
        << ", verbose: " << elf_utils::print_bool(verbose);
+    if (!formats.empty()) {
+      ss << ", formats: " << joinFormats(formats);
+    }
+    if (!compression.empty()) {
+      ss << ", compression: " << compression << "@" << compression_level;
+    }
+    if (!compression_dict.empty()) {
+      ss << ", dict: " << compression_dict;
+    }
+    if (num_decode_workers > 1) {
+      ss << ", #decode_workers: " << num_decode_workers;
+    }
+    if (stream_credits > 0) {
+      ss << ", stream credits: " << stream_credits;
+    }
+    if (heartbeat_sec > 0) {
+      ss << ", heartbeat: " << heartbeat_sec << "s";
+    }
+    if (num_shards > 1) {
+      ss << ", #shards: " << num_shards;
+    }
     return ss.str();
   }
+
+  static std::string joinFormats(const std::vector<std::string>& formats) {
+    std::string s;
+    for (const auto& f : formats) {
+      s += (s.empty() ? "" : ",") + f;
+    }
+    return s;
+  }
+
+  std::unique_ptr<Compressor> createCompressor() const {
+    const std::string dict = compression_dict.empty()
+        ? ""
+        : Compressor::loadDictionary(compression_dict);
+    return std::unique_ptr<Compressor>(
+        new Compressor(compression_level, dict));
+  }
+
+  // "zstd:<dict id>", as exchanged by Writer and Reader.
+  static std::string compressionTag(unsigned dict_id) {
+    return "zstd:" + std::to_string(dict_id);
+  }
+
+  // The dict id of a tag, or -1 if it is not one.
+  static int64_t parseCompressionTag(const std::string& tag) {
+    const std::string prefix = "zstd:";
+    if (tag.compare(0, prefix.size(), prefix) != 0) {
+      return -1;
+    }
+    char* end = nullptr;
+    const char* p = tag.c_str() + prefix.size();
+    const unsigned long id = strtoul(p, &end, 10);
+    return end != p && *end == '\0' ? (int64_t)id : -1;
+  }
 };
 
 class Writer {
@@ -62,36 +159,159 @@ class Writer {
         logger_(
             elf::logging::getIndexedLogger("elf::distributed::Writer-", "")) {
     identity_ = options_.identity + "-" + get_id(rng_);
+    if (options_.compression == "zstd") {
+      compressor_ = options_.createCompressor();
+    } else if (!options_.compression.empty()) {
+      throw std::range_error("Unknown compression: " + options_.compression);
+    }
+    shard_ = elf_utils::consistent_shard(identity_, options_.num_shards);
     sender_.reset(new elf::distri::ZMQSender(
-        identity_, options_.addr, options_.port, options_.use_ipv6));
+        identity_,
+        options_.addr,
+        options_.port + shard_,
+        options_.use_ipv6,
+        options_.transport));
   }
 
   const std::string& identity() const {
     return identity_;
   }
 
+  // The ingest shard of the server we send to.
+  int shard() const {
+    return shard_;
+  }
+
   std::string info() const {
     std::stringstream ss;
     ss << "ZMQVer: " << elf::distri::s_version() << " Writer[" << identity_
-       << "]. " << options_.info();
+       << "]";
+    if (options_.num_shards > 1) {
+      ss << "[shard=" << shard_ << "]";
+    }
+    ss << ". " << options_.info();
     return ss.str();
   }
 
+  // Uses a credit when streaming.
   bool Insert(const std::string& s) {
-    write_mutex_.lock();
-    sender_->send("content", s);
-    write_mutex_.unlock();
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (streaming_) {
+      credits_--;
+    }
+    const int pack = pack_.load();
+    if (pack == PACK_RAW) {
+      sender_->send("content", s);
+      bytes_sent_ += s.size();
+    } else {
+      const std::string packed =
+          compressor_->pack(s, pack == PACK_ZSTD_DICT);
+      sender_->send("packed", packed);
+      bytes_sent_ += packed.size();
+    }
     return true;
   }
 
+  // Content bytes sent by Insert so far, as packed.
+  int64_t bytesSent() const {
+    return bytes_sent_.load();
+  }
+
+  // A small message, on its own frame type: the Reader hands it to its
+  // HeartbeatFunc, apart from content, and does not reply or give a
+  // credit for it. Only once the Reader has agreed (see heartbeatSec).
+  bool Heartbeat(const std::string& s) {
+    if (heartbeat_sec_ <= 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    sender_->send("beat", s);
+    return true;
+  }
+
+  // Announces this Writer, and (again) negotiates formats, compression,
+  // streaming and heartbeats. The offers follow msg (a single line) in the
+  // same frame, one "key=value" per line, so that a Reader that does not
+  // negotiate just logs them and replies once. The answers of one that
+  // does come before its reply (see negotiating). Credits left from before
+  // are dropped, and content goes out raw until the Reader agrees to
+  // compression again.
   bool Ctrl(const std::string& msg) {
-    sender_->send("ctrl", msg);
+    pack_ = PACK_RAW;
+    streaming_ = false;
+    credits_ = 0;
+    heartbeat_sec_ = 0;
+    std::string ctrl = msg;
+    if (!options_.formats.empty()) {
+      ctrl += "\nformats=" + Options::joinFormats(options_.formats);
+    }
+    if (compressor_ != nullptr) {
+      ctrl += "\ncompression=" +
+          Options::compressionTag(compressor_->dictId());
+    }
+    if (options_.stream_credits > 0) {
+      ctrl += "\nstream=" + std::to_string(options_.stream_credits);
+    }
+    if (options_.heartbeat_sec > 0) {
+      ctrl += "\nheartbeat=" + std::to_string(options_.heartbeat_sec);
+    }
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    negotiating_ = true;
+    sender_->send("ctrl", ctrl);
     return true;
   }
 
+  // Whether the reply to the last Ctrl has not come yet: until then,
+  // streaming, compression and heartbeats may still be agreed on.
+  bool negotiating() const {
+    return negotiating_;
+  }
+
+  // Whether the Reader has agreed to stream (see Options::stream_credits).
+  bool streaming() const {
+    return streaming_;
+  }
+
+  // Content messages we may send before the Reader has processed some.
+  int credits() const {
+    return credits_;
+  }
+
+  // Seconds between heartbeats agreed with the Reader, 0 for none.
+  int heartbeatSec() const {
+    return heartbeat_sec_;
+  }
+
+  // The content format agreed on with the Reader, empty for json (also
+  // until the Reader has answered).
+  std::string format() const {
+    std::lock_guard<std::mutex> lock(format_mutex_);
+    return format_;
+  }
+
   bool getReplyNoblock(std::string* msg) {
     std::string title;
     bool received = sender_->recv_noblock(&title, msg);
+    while (received &&
+           (title == "formats" || title == "compression" ||
+            title == "stream" || title == "credit" || title == "heartbeat")) {
+      if (title == "formats") {
+        logger_->info("Writer[{}] content format: \"{}\"", identity_, *msg);
+        std::lock_guard<std::mutex> lock(format_mutex_);
+        format_ = *msg;
+      } else if (title == "compression") {
+        onCompressionReply(*msg);
+      } else if (title == "heartbeat") {
+        heartbeat_sec_ = std::max(atoi(msg->c_str()), 0);
+        logger_->info(
+            "Writer[{}] heartbeat every {} sec", identity_, heartbeat_sec_);
+      } else if (title == "stream") {
+        onStream(*msg);
+      } else {
+        onCredit(*msg);
+      }
+      received = sender_->recv_noblock(&title, msg);
+    }
     if (!received)
       return false;
 
@@ -100,10 +320,16 @@ class Writer {
           "Writer[{}] wrong title {} in getReplyNoblock()", identity_, title);
       return false;
     } else {
+      negotiating_ = false;
       return true;
     }
   }
 
+  // Waits up to timeout_ms for a message from the Reader.
+  bool waitReply(long timeout_ms) {
+    return sender_->poll(timeout_ms);
+  }
+
   ~Writer() {
     sender_.reset(nullptr);
   }
@@ -112,10 +338,60 @@ class Writer {
   std::unique_ptr<elf::distri::ZMQSender> sender_;
   std::mt19937 rng_;
   std::string identity_;
+  int shard_ = 0;
   Options options_;
   std::mutex write_mutex_;
+  mutable std::mutex format_mutex_;
+  std::string format_;
+  std::unique_ptr<Compressor> compressor_;
+  // How to send content (a PackFlag), PACK_RAW until the Reader agrees.
+  std::atomic<int> pack_{PACK_RAW};
+  std::atomic_bool streaming_{false};
+  std::atomic<int> credits_{0};
+  std::atomic<int> heartbeat_sec_{0};
+  std::atomic_bool negotiating_{false};
+  std::atomic<int64_t> bytes_sent_{0};
   std::shared_ptr<spdlog::logger> logger_;
 
+  // The Reader's answer to our stream offer: the credits we start with.
+  void onStream(const std::string& msg) {
+    const int n = atoi(msg.c_str());
+    if (n <= 0) {
+      logger_->warn("Writer[{}] unexpected stream \"{}\"", identity_, msg);
+      return;
+    }
+    logger_->info("Writer[{}] streaming, credits: {}", identity_, n);
+    credits_ = n;
+    streaming_ = true;
+  }
+
+  // Credits only count once streaming: those for content sent before the
+  // last Ctrl come ahead of the stream answer, and are dropped.
+  void onCredit(const std::string& msg) {
+    const int n = atoi(msg.c_str());
+    if (n <= 0) {
+      logger_->warn("Writer[{}] unexpected credit \"{}\"", identity_, msg);
+      return;
+    }
+    if (streaming_) {
+      credits_ += n;
+    }
+  }
+
+  void onCompressionReply(const std::string& tag) {
+    const int64_t dict_id = Options::parseCompressionTag(tag);
+    if (compressor_ == nullptr || dict_id < 0) {
+      logger_->warn("Writer[{}] unexpected compression \"{}\"", identity_, tag);
+      return;
+    }
+    const bool dict = dict_id != 0 && dict_id == compressor_->dictId();
+    pack_ = dict ? PACK_ZSTD_DICT : PACK_ZSTD;
+    logger_->info(
+        "Writer[{}] compressing content, dictionary: {}",
+        identity_,
+        elf_utils::print_bool(dict));
+  }
+
   static std::string get_id(std::mt19937& rng) {
     long host_name_max = sysconf(_SC_HOST_NAME_MAX);
     if (host_name_max <= 0)
@@ -136,6 +412,23 @@ class Writer {
   }
 };
 
+// Receives the messages of the Writers. A receiving thread waits on the
+// socket (zmq_poll) and hands each message to one of
+// Options::num_decode_workers workers, chosen by the identity of its
+// sender. The workers unpack and process messages and compute replies, so
+// that messages (and replies) of one Writer stay in order while those of
+// different Writers are processed in parallel. Replies go back through the
+// receiving thread, the only one using the socket.
+//
+// Writers streaming content (see Options::stream_credits) get a credit
+// back for each content message, once processed: a slow Reader slows them
+// down instead of queuing up their messages.
+//
+// Heartbeats (see Writer::Heartbeat) go to HeartbeatFunc, in order with
+// the other messages of their Writer, but without a reply.
+//
+// With more than one worker, ProcessFunc, ReplyFunc and HeartbeatFunc are
+// called concurrently (for different identities).
 class Reader {
  public:
   using ProcessFunc = std::function<
@@ -146,28 +439,51 @@ class Reader {
 
   using StartFunc = std::function<void()>;
 
+  using HeartbeatFunc = std::function<
+      void(Reader*, const std::string& identity, const std::string& msg)>;
+
   Reader(const std::string& filename, const Options& opt)
-      : receiver_(opt.port, opt.use_ipv6),
+      : receiver_(opt.port, opt.use_ipv6, opt.transport),
         options_(opt),
         db_name_(filename),
         rng_(time(NULL)),
         done_(false),
         logger_(
-            elf::logging::getIndexedLogger("elf::distributed::Reader-", "")) {}
+            elf::logging::getIndexedLogger("elf::distributed::Reader-", "")) {
+    if (pipe2(wakeup_, O_NONBLOCK | O_CLOEXEC) != 0) {
+      throw std::runtime_error("Reader: cannot create pipe");
+    }
+    for (int i = 0; i < std::max(options_.num_decode_workers, 1); ++i) {
+      workers_.emplace_back(new Worker(options_.createCompressor()));
+    }
+  }
 
   void startReceiving(
       ProcessFunc proc_func,
       ReplyFunc replier = nullptr,
-      StartFunc start_func = nullptr) {
+      StartFunc start_func = nullptr,
+      HeartbeatFunc heartbeat_func = nullptr) {
+    heartbeat_func_ = heartbeat_func;
+    for (auto& w : workers_) {
+      Worker* worker = w.get();
+      worker->thread = std::thread([=]() {
+        threaded_process_msg(worker, proc_func, replier);
+      });
+    }
     receiver_thread_.reset(new std::thread(
         [=](Reader* reader) {
           if (start_func != nullptr)
             start_func();
-          reader->threaded_receive_msg(proc_func, replier);
+          reader->threaded_receive_msg();
         },
         this));
   }
 
+  // Heartbeats handed to the HeartbeatFunc so far.
+  int numHeartbeats() const {
+    return num_heartbeats_.load();
+  }
+
   std::string info() const {
     std::stringstream ss;
     ss << "ZMQVer: " << elf::distri::s_version() << " Reader[db=" << db_name_
@@ -178,12 +494,43 @@ class Reader {
   ~Reader() {
     logger_->info("Destroying Reader ... ");
     done_ = true;
-    receiver_thread_->join();
+    wakeup();
+    if (receiver_thread_ != nullptr) {
+      receiver_thread_->join();
+    }
+    for (auto& w : workers_) {
+      if (w->thread.joinable()) {
+        w->thread.join();
+      }
+    }
+    close(wakeup_[0]);
+    close(wakeup_[1]);
 
     logger_->info("Reader destroyed... ");
   }
 
  private:
+  struct Message {
+    std::string identity;
+    std::string title;
+    std::string msg;
+  };
+
+  struct Worker {
+    concurrency::ConcurrentQueue<Message> queue;
+    // Unpacks the "packed" content, with the dictionary if there is one.
+    std::unique_ptr<Compressor> compressor;
+    // The Writers streaming to us, among those of this worker.
+    std::unordered_set<std::string> streaming;
+    std::thread thread;
+
+    explicit Worker(std::unique_ptr<Compressor> c)
+        : compressor(std::move(c)) {}
+  };
+
+  static constexpr int kIdleLogSec = 10;
+  static constexpr auto kWorkerWait = std::chrono::milliseconds(100);
+
   elf::distri::ZMQReceiver receiver_;
   std::unique_ptr<std::thread> receiver_thread_;
   Options options_;
@@ -191,58 +538,204 @@ class Reader {
   std::mt19937 rng_;
 
   std::atomic_bool done_;
-  int client_size_ = 0;
-  int num_package_ = 0, num_failed_ = 0, num_skipped_ = 0;
+  std::atomic<int> client_size_{0};
+  std::atomic<int> num_package_{0}, num_failed_{0}, num_skipped_{0};
+  std::atomic<int> num_heartbeats_{0};
+  HeartbeatFunc heartbeat_func_ = nullptr;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Messages to send, from the workers, and a pipe waking up the receiving
+  // thread when there are some.
+  concurrency::ConcurrentQueue<Message> outbox_;
+  int wakeup_[2] = {-1, -1};
 
   std::shared_ptr<spdlog::logger> logger_;
 
-  void threaded_receive_msg(
-      ProcessFunc proc_func,
-      ReplyFunc replier = nullptr) {
+  // The first of the offered formats that we support, if any.
+  std::string pickFormat(const std::string& offered) const {
+    for (const auto& f : elf_utils::split(offered, ',')) {
+      for (const auto& ours : options_.formats) {
+        if (f == ours) {
+          return f;
+        }
+      }
+    }
+    return "";
+  }
+
+  // Answers an offer of a Ctrl, ahead of the reply. Unknown offers are
+  // left unanswered, so that the Writer keeps the default.
+  void negotiate(
+      Worker* worker,
+      const std::string& identity,
+      const std::string& key,
+      const std::string& value) {
+    logger_->info(
+        "{} Offer from {}: {}=\"{}\"", elf_utils::now(), identity, key, value);
+    if (key == "formats") {
+      const std::string format = pickFormat(value);
+      logger_->info("{} using format \"{}\"", identity, format);
+      send(identity, "formats", format);
+    } else if (key == "compression") {
+      // We can unpack zstd in any case, and with the dictionary if it is
+      // the one we have.
+      const unsigned dict_id = worker->compressor->dictId();
+      const unsigned ours =
+          Options::parseCompressionTag(value) == dict_id ? dict_id : 0;
+      send(identity, "compression", Options::compressionTag(ours));
+    } else if (key == "stream") {
+      const int credits =
+          std::min(atoi(value.c_str()), options_.stream_credits);
+      if (credits > 0) {
+        worker->streaming.insert(identity);
+        send(identity, "stream", std::to_string(credits));
+      }
+    } else if (key == "heartbeat") {
+      if (heartbeat_func_ != nullptr && options_.heartbeat_sec > 0) {
+        const int sec = std::max(atoi(value.c_str()), options_.heartbeat_sec);
+        send(identity, "heartbeat", std::to_string(sec));
+      }
+    }
+  }
+
+  void wakeup() {
+    const char c = 0;
+    // Failing means the pipe is full, which wakes up the receiving thread
+    // as well.
+    const ssize_t n = write(wakeup_[1], &c, 1);
+    (void)n;
+  }
+
+  void send(const std::string& identity, const char* title, std::string msg) {
+    outbox_.push(Message{identity, title, std::move(msg)});
+    wakeup();
+  }
+
+  void threaded_receive_msg() {
     std::string identity, title, msg;
+    std::hash<std::string> hasher;
+    auto last_msg = std::chrono::steady_clock::now();
+
     while (!done_.load()) {
-      if (!receiver_.recv_noblock(&identity, &title, &msg)) {
-        logger_->info(
-            "{}, Reader: no message, Stats: {}/{}/{}, wait for 10 sec ... ",
-            elf_utils::now(),
-            num_package_,
-            num_failed_,
-            num_skipped_);
-        std::this_thread::sleep_for(std::chrono::seconds(10));
-        continue;
+      bool woken = false;
+      const bool readable =
+          receiver_.poll(kIdleLogSec * 1000, wakeup_[0], &woken);
+
+      if (woken) {
+        char buf[256];
+        while (read(wakeup_[0], buf, sizeof(buf)) > 0) {
+        }
+        Message m;
+        while (outbox_.pop(&m, std::chrono::seconds(0))) {
+          receiver_.send(m.identity, m.title, m.msg);
+        }
       }
 
-      if (title == "ctrl") {
-        client_size_++;
+      if (readable) {
+        while (receiver_.recv_noblock(&identity, &title, &msg)) {
+          Worker* w = workers_[hasher(identity) % workers_.size()].get();
+          w->queue.push(Message{identity, title, std::move(msg)});
+        }
+        last_msg = std::chrono::steady_clock::now();
+      } else if (
+          !woken &&
+          std::chrono::steady_clock::now() - last_msg >=
+              std::chrono::seconds(kIdleLogSec)) {
         logger_->info(
-            "{} Ctrl from {}[{}]: {}",
+            "{}, Reader: no message for {} sec, Stats: {}/{}/{}, "
+            "#heartbeats: {}",
             elf_utils::now(),
-            identity,
-            client_size_,
-            msg);
-        // receiver_.send(identity, "ctrl", "");
-      } else if (title == "content") {
-        if (!proc_func(this, identity, msg)) {
-          logger_->warn("Msg processing error! from {}", identity);
-          num_failed_++;
-        } else {
-          num_package_++;
+            kIdleLogSec,
+            num_package_.load(),
+            num_failed_.load(),
+            num_skipped_.load(),
+            num_heartbeats_.load());
+        last_msg = std::chrono::steady_clock::now();
+      }
+    }
+  }
+
+  void threaded_process_msg(
+      Worker* worker,
+      ProcessFunc proc_func,
+      ReplyFunc replier) {
+    Message m;
+    while (!done_.load()) {
+      if (worker->queue.pop(&m, kWorkerWait)) {
+        process(worker, m, proc_func, replier);
+      }
+    }
+  }
+
+  void process(
+      Worker* worker,
+      const Message& m,
+      const ProcessFunc& proc_func,
+      const ReplyFunc& replier) {
+    const std::string& identity = m.identity;
+    const std::string& title = m.title;
+    const std::string& msg = m.msg;
+
+    if (title == "ctrl") {
+      // The message, then the offers of the Writer (see Writer::Ctrl).
+      const std::vector<std::string> lines = elf_utils::split(msg, '\n');
+      const int client_size = ++client_size_;
+      logger_->info(
+          "{} Ctrl from {}[{}]: {}",
+          elf_utils::now(),
+          identity,
+          client_size,
+          lines.empty() ? "" : lines[0]);
+      // Until it offers to stream again, no more credits for this Writer.
+      worker->streaming.erase(identity);
+      for (size_t i = 1; i < lines.size(); ++i) {
+        const std::string& offer = lines[i];
+        const size_t eq = offer.find('=');
+        if (eq != std::string::npos) {
+          negotiate(
+              worker, identity, offer.substr(0, eq), offer.substr(eq + 1));
         }
+      }
+    } else if (title == "beat") {
+      if (heartbeat_func_ != nullptr) {
+        num_heartbeats_++;
+        heartbeat_func_(this, identity, msg);
+      }
+      return;
+    } else if (title == "content" || title == "packed") {
+      bool ok = false;
+      if (title == "content") {
+        ok = proc_func(this, identity, msg);
       } else {
-        logger_->warn(
-            "{} Skipping unknown title: \"{}\", identity: \"{}\"",
-            elf_utils::now(),
-            title,
-            identity);
-        num_skipped_++;
+        try {
+          ok = proc_func(this, identity, worker->compressor->unpack(msg));
+        } catch (const std::exception& e) {
+          logger_->warn("Cannot unpack msg from {}: {}", identity, e.what());
+        }
       }
+      if (!ok) {
+        logger_->warn("Msg processing error! from {}", identity);
+        num_failed_++;
+      } else {
+        num_package_++;
+      }
+      if (worker->streaming.count(identity) > 0) {
+        send(identity, "credit", "1");
+      }
+    } else {
+      logger_->warn(
+          "{} Skipping unknown title: \"{}\", identity: \"{}\"",
+          elf_utils::now(),
+          title,
+          identity);
+      num_skipped_++;
+    }
 
-      // Send reply if there is any.
-      if (replier != nullptr) {
-        std::string reply;
-        if (replier(this, identity, &reply)) {
-          receiver_.send(identity, "reply", reply);
-        }
+    // Send reply if there is any.
+    if (replier != nullptr) {
+      std::string reply;
+      if (replier(this, identity, &reply)) {
+        send(identity, "reply", std::move(reply));
       }
     }
   }
@@ -11,7 +11,9 @@
 #include <deque>
 #include <functional>
 #include <iomanip>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -76,6 +78,36 @@ inline void set_opts(zmq::socket_t* opt) {
   opt->setsockopt(ZMQ_SNDHWM, 32767);
 }
 
+// The endpoint to bind to (addr empty) or to connect to, over transport
+// "tcp", "ipc" (same host) or "inproc" (same process, e.g. load tests).
+inline std::string
+endpoint(const std::string& transport, const std::string& addr, int port) {
+  if (transport == "tcp") {
+    return "tcp://" + (addr.empty() ? "*" : addr) + ":" + std::to_string(port);
+  } else if (transport == "ipc") {
+    return "ipc:///tmp/elf-" + std::to_string(port);
+  } else if (transport == "inproc") {
+    return "inproc://elf-" + std::to_string(port);
+  }
+  throw std::range_error("Unknown transport: " + transport);
+}
+
+// Sockets over inproc need to share their context: it is the same for the
+// whole process, and never destroyed.
+inline std::shared_ptr<zmq::context_t> make_context(
+    const std::string& transport) {
+  if (transport != "inproc") {
+    return std::make_shared<zmq::context_t>(1);
+  }
+  static zmq::context_t* context = []() {
+    auto* c = new zmq::context_t(1);
+    // 1024 by default, too few to simulate many clients.
+    zmq_ctx_set(static_cast<void*>(*c), ZMQ_MAX_SOCKETS, 1 << 16);
+    return c;
+  }();
+  return std::shared_ptr<zmq::context_t>(context, [](zmq::context_t*) {});
+}
+
 class SegmentedRecv {
  public:
   SegmentedRecv(zmq::socket_t& socket)
@@ -209,19 +241,19 @@ static const std::string kRecvPrefix = "ZMQRecv";
 
 class ZMQReceiver : public SameThreadChecker {
  public:
-  ZMQReceiver(int port, bool use_ipv6)
-      : context_(1),
+  ZMQReceiver(int port, bool use_ipv6, const std::string& transport = "tcp")
+      : context_(make_context(transport)),
         logger_(elf::logging::getIndexedLogger(
             "elf::distributed::ZMQReceiver-",
             "")) {
-    broker_.reset(new zmq::socket_t(context_, ZMQ_ROUTER));
+    broker_.reset(new zmq::socket_t(*context_, ZMQ_ROUTER));
     if (use_ipv6) {
       int ipv6 = 1;
       broker_->setsockopt(ZMQ_IPV6, &ipv6, sizeof(ipv6));
     }
     set_opts(broker_.get());
 
-    broker_->bind("tcp://*:" + std::to_string(port));
+    broker_->bind(endpoint(transport, "", port));
     receiver_.reset(new SegmentedRecv(*broker_));
   }
 
@@ -246,6 +278,25 @@ class ZMQReceiver : public SameThreadChecker {
     }
   }
 
+  // Waits up to timeout_ms for a message to receive (returns true) or, if
+  // fd is not -1, for fd to be readable (sets *fd_readable).
+  bool poll(long timeout_ms, int fd = -1, bool* fd_readable = nullptr) {
+    zmq::pollitem_t items[] = {
+        {static_cast<void*>(*broker_), 0, ZMQ_POLLIN, 0},
+        {nullptr, fd, ZMQ_POLLIN, 0},
+    };
+    try {
+      zmq::poll(items, fd < 0 ? 1 : 2, timeout_ms);
+    } catch (const std::exception& e) {
+      logger_->error("Exception encountered! {}", e.what());
+      return false;
+    }
+    if (fd_readable != nullptr) {
+      *fd_readable = fd >= 0 && (items[1].revents & ZMQ_POLLIN);
+    }
+    return items[0].revents & ZMQ_POLLIN;
+  }
+
   bool
   recv_noblock(std::string* identity, std::string* title, std::string* msg) {
     assert(msg != nullptr);
@@ -274,7 +325,7 @@ class ZMQReceiver : public SameThreadChecker {
   }
 
  private:
-  zmq::context_t context_;
+  std::shared_ptr<zmq::context_t> context_;
   std::unique_ptr<zmq::socket_t> broker_;
   std::unique_ptr<SegmentedRecv> receiver_;
   std::mutex mutex_;
@@ -287,12 +338,13 @@ class ZMQSender : public SameThreadChecker {
       const std::string& id,
       const std::string& addr,
       int port,
-      bool use_ipv6)
-      : context_(1),
+      bool use_ipv6,
+      const std::string& transport = "tcp")
+      : context_(make_context(transport)),
         logger_(elf::logging::getIndexedLogger(
             "elf::distributed::ZMQSender-",
             "")) {
-    sender_.reset(new zmq::socket_t(context_, ZMQ_DEALER));
+    sender_.reset(new zmq::socket_t(*context_, ZMQ_DEALER));
     if (use_ipv6) {
       int ipv6 = 1;
       sender_->setsockopt(ZMQ_IPV6, &ipv6, sizeof(ipv6));
@@ -300,7 +352,7 @@ class ZMQSender : public SameThreadChecker {
     sender_->setsockopt(ZMQ_IDENTITY, id.c_str(), id.length());
     set_opts(sender_.get());
 
-    sender_->connect("tcp://" + addr + ":" + std::to_string(port));
+    sender_->connect(endpoint(transport, addr, port));
     receiver_.reset(new SegmentedRecv(*sender_));
   }
 
@@ -318,6 +370,18 @@ class ZMQSender : public SameThreadChecker {
     }
   }
 
+  // Waits up to timeout_ms for a message to receive.
+  bool poll(long timeout_ms) {
+    zmq::pollitem_t item = {static_cast<void*>(*sender_), 0, ZMQ_POLLIN, 0};
+    try {
+      zmq::poll(&item, 1, timeout_ms);
+    } catch (const std::exception& e) {
+      logger_->error("Exception encountered! {}", e.what());
+      return false;
+    }
+    return item.revents & ZMQ_POLLIN;
+  }
+
   bool recv_noblock(std::string* title, std::string* msg) {
     assert(msg != nullptr);
 
@@ -346,7 +410,7 @@ class ZMQSender : public SameThreadChecker {
   }
 
  private:
-  zmq::context_t context_;
+  std::shared_ptr<zmq::context_t> context_;
   std::unique_ptr<zmq::socket_t> sender_;
   std::unique_ptr<SegmentedRecv> receiver_;
   std::mutex mutex_;
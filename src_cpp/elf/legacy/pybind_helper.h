@@ -2560,6 +2560,1686 @@
       a48,                        \
       a49)
 
+#define MM_APPLY_50(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_49(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50)
+
+#define MM_APPLY_51(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_50(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51)
+
+#define MM_APPLY_52(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_51(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52)
+
+#define MM_APPLY_53(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_52(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53)
+
+#define MM_APPLY_54(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_53(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54)
+
+#define MM_APPLY_55(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_54(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55)
+
+#define MM_APPLY_56(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_55(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56)
+
+#define MM_APPLY_57(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56,                          \
+    a57)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_56(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56,                        \
+      a57)
+
+#define MM_APPLY_58(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56,                          \
+    a57,                          \
+    a58)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_57(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56,                        \
+      a57,                        \
+      a58)
+
+#define MM_APPLY_59(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56,                          \
+    a57,                          \
+    a58,                          \
+    a59)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_58(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56,                        \
+      a57,                        \
+      a58,                        \
+      a59)
+
+#define MM_APPLY_60(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56,                          \
+    a57,                          \
+    a58,                          \
+    a59,                          \
+    a60)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_59(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56,                        \
+      a57,                        \
+      a58,                        \
+      a59,                        \
+      a60)
+
+#define MM_APPLY_61(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56,                          \
+    a57,                          \
+    a58,                          \
+    a59,                          \
+    a60,                          \
+    a61)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_60(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56,                        \
+      a57,                        \
+      a58,                        \
+      a59,                        \
+      a60,                        \
+      a61)
+
+#define MM_APPLY_62(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56,                          \
+    a57,                          \
+    a58,                          \
+    a59,                          \
+    a60,                          \
+    a61,                          \
+    a62)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_61(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56,                        \
+      a57,                        \
+      a58,                        \
+      a59,                        \
+      a60,                        \
+      a61,                        \
+      a62)
+
+#define MM_APPLY_63(              \
+    macroname,                    \
+    C,                            \
+    a1,                           \
+    a2,                           \
+    a3,                           \
+    a4,                           \
+    a5,                           \
+    a6,                           \
+    a7,                           \
+    a8,                           \
+    a9,                           \
+    a10,                          \
+    a11,                          \
+    a12,                          \
+    a13,                          \
+    a14,                          \
+    a15,                          \
+    a16,                          \
+    a17,                          \
+    a18,                          \
+    a19,                          \
+    a20,                          \
+    a21,                          \
+    a22,                          \
+    a23,                          \
+    a24,                          \
+    a25,                          \
+    a26,                          \
+    a27,                          \
+    a28,                          \
+    a29,                          \
+    a30,                          \
+    a31,                          \
+    a32,                          \
+    a33,                          \
+    a34,                          \
+    a35,                          \
+    a36,                          \
+    a37,                          \
+    a38,                          \
+    a39,                          \
+    a40,                          \
+    a41,                          \
+    a42,                          \
+    a43,                          \
+    a44,                          \
+    a45,                          \
+    a46,                          \
+    a47,                          \
+    a48,                          \
+    a49,                          \
+    a50,                          \
+    a51,                          \
+    a52,                          \
+    a53,                          \
+    a54,                          \
+    a55,                          \
+    a56,                          \
+    a57,                          \
+    a58,                          \
+    a59,                          \
+    a60,                          \
+    a61,                          \
+    a62,                          \
+    a63)                          \
+  MM_INVOKE_B(macroname, (C, a1)) \
+  MM_APPLY_62(                    \
+      macroname,                  \
+      C,                          \
+      a2,                         \
+      a3,                         \
+      a4,                         \
+      a5,                         \
+      a6,                         \
+      a7,                         \
+      a8,                         \
+      a9,                         \
+      a10,                        \
+      a11,                        \
+      a12,                        \
+      a13,                        \
+      a14,                        \
+      a15,                        \
+      a16,                        \
+      a17,                        \
+      a18,                        \
+      a19,                        \
+      a20,                        \
+      a21,                        \
+      a22,                        \
+      a23,                        \
+      a24,                        \
+      a25,                        \
+      a26,                        \
+      a27,                        \
+      a28,                        \
+      a29,                        \
+      a30,                        \
+      a31,                        \
+      a32,                        \
+      a33,                        \
+      a34,                        \
+      a35,                        \
+      a36,                        \
+      a37,                        \
+      a38,                        \
+      a39,                        \
+      a40,                        \
+      a41,                        \
+      a42,                        \
+      a43,                        \
+      a44,                        \
+      a45,                        \
+      a46,                        \
+      a47,                        \
+      a48,                        \
+      a49,                        \
+      a50,                        \
+      a51,                        \
+      a52,                        \
+      a53,                        \
+      a54,                        \
+      a55,                        \
+      a56,                        \
+      a57,                        \
+      a58,                        \
+      a59,                        \
+      a60,                        \
+      a61,                        \
+      a62,                        \
+      a63)
+
 #define MM_NARG(...) MM_NARG_(__VA_ARGS__, MM_RSEQ_N())
 #define MM_NARG_(...) MM_ARG_N(__VA_ARGS__)
 #define MM_ARG_N( \
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <string>
+
+namespace elf_utils {
+
+// Appends values to a string: integers as (LEB128) varints or fixed-width
+// little-endian, floats as little-endian 32 bits.
+class BinaryWriter {
+ public:
+  explicit BinaryWriter(std::string* out) : out_(out) {}
+
+  void putByte(uint8_t v) {
+    out_->push_back(static_cast<char>(v));
+  }
+
+  void putVarint(uint64_t v) {
+    while (v >= 0x80) {
+      out_->push_back(static_cast<char>(v | 0x80));
+      v >>= 7;
+    }
+    out_->push_back(static_cast<char>(v));
+  }
+
+  // Zigzag encoded, so that small negative values stay short.
+  void putSignedVarint(int64_t v) {
+    putVarint(
+        (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+  }
+
+  void putFixed32(uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+      out_->push_back(static_cast<char>(v >> (8 * i)));
+    }
+  }
+
+  void putFixed64(uint64_t v) {
+    putFixed32(static_cast<uint32_t>(v));
+    putFixed32(static_cast<uint32_t>(v >> 32));
+  }
+
+  void putFloat(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    putFixed32(bits);
+  }
+
+  void putBytes(const void* p, size_t n) {
+    out_->append(static_cast<const char*>(p), n);
+  }
+
+  void putString(const std::string& s) {
+    putVarint(s.size());
+    out_->append(s);
+  }
+
+ private:
+  std::string* out_;
+};
+
+// Reads back what BinaryWriter wrote. Throws std::runtime_error on
+// truncated or malformed input.
+class BinaryReader {
+ public:
+  BinaryReader(const char* p, size_t size) : p_(p), end_(p + size) {}
+
+  explicit BinaryReader(const std::string& s)
+      : BinaryReader(s.data(), s.size()) {}
+
+  uint8_t getByte() {
+    need(1);
+    return static_cast<uint8_t>(*p_++);
+  }
+
+  uint64_t getVarint() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      const uint8_t b = getByte();
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        return v;
+      }
+    }
+    throw std::runtime_error("BinaryReader: malformed varint");
+  }
+
+  int64_t getSignedVarint() {
+    const uint64_t v = getVarint();
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+  }
+
+  uint32_t getFixed32() {
+    need(4);
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+      v |= static_cast<uint32_t>(static_cast<uint8_t>(p_[i])) << (8 * i);
+    }
+    p_ += 4;
+    return v;
+  }
+
+  uint64_t getFixed64() {
+    const uint64_t lo = getFixed32();
+    return lo | static_cast<uint64_t>(getFixed32()) << 32;
+  }
+
+  float getFloat() {
+    const uint32_t bits = getFixed32();
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+
+  void getBytes(void* p, size_t n) {
+    need(n);
+    memcpy(p, p_, n);
+    p_ += n;
+  }
+
+  std::string getString() {
+    const size_t n = getCount();
+    std::string s(p_, n);
+    p_ += n;
+    return s;
+  }
+
+  // A count of items taking at least a byte each, checked against what is
+  // left, so that corrupt input cannot make us allocate unbounded memory.
+  size_t getCount() {
+    const uint64_t n = getVarint();
+    if (n > remaining()) {
+      throw std::runtime_error("BinaryReader: count past end of input");
+    }
+    return n;
+  }
+
+  size_t remaining() const {
+    return end_ - p_;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+
+  void need(size_t n) const {
+    if (remaining() < n) {
+      throw std::runtime_error("BinaryReader: truncated input");
+    }
+  }
+};
+
+} // namespace elf_utils
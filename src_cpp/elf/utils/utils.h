@@ -94,6 +94,26 @@ inline std::vector<std::string> split(const std::string& s, char delim) {
   return elems;
 }
 
+// The shard in [0, num_shards) of a key, the same on every host and build
+// (unlike std::hash). Jump consistent hash (Lamping and Veach), so going
+// from n to n + 1 shards only moves 1/(n + 1) of the keys.
+inline int consistent_shard(const std::string& key, int num_shards) {
+  if (num_shards <= 1)
+    return 0;
+  // FNV-1a.
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    h = (h ^ c) * 1099511628211ULL;
+  }
+  int64_t b = 0, j = 0;
+  while (j < num_shards) {
+    b = j;
+    h = h * 2862933555777941757ULL + 1;
+    j = (b + 1) * (static_cast<double>(1LL << 31) / ((h >> 33) + 1));
+  }
+  return b;
+}
+
 template <typename Map>
 const typename Map::mapped_type& map_get(
     const Map& m,
@@ -7,36 +7,15 @@
  */
 
 #include "board_feature.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include <cassert>
 #include <cmath>
 #include <utility>
 #include "go_state.h"
 
 #define S_ISA(c1, c2) ((c2 == S_EMPTY) || (c1 == c2))
-// For feature extraction.
-// Distance transform
-static void DistanceTransform(float* arr) {
-#define IND(i, j) ((i)*BOARD_SIZE + (j))
-  // First dimension.
-  for (int j = 0; j < BOARD_SIZE; j++) {
-    for (int i = 1; i < BOARD_SIZE; i++) {
-      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i - 1, j)] + 1);
-    }
-    for (int i = BOARD_SIZE - 2; i >= 0; i--) {
-      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i + 1, j)] + 1);
-    }
-  }
-  // Second dimension
-  for (int i = 0; i < BOARD_SIZE; i++) {
-    for (int j = 1; j < BOARD_SIZE; j++) {
-      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i, j - 1)] + 1);
-    }
-    for (int j = BOARD_SIZE - 2; j >= 0; j--) {
-      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i, j + 1)] + 1);
-    }
-  }
-#undef IDX
-}
 
 // If we set player = 0 (S_EMPTY), then the liberties of both side will be
 // returned.
@@ -171,6 +150,27 @@ bool BoardFeature::getHistoryExp(Stone player, float* data) const {
   return true;
 }
 
+// exp(-age / 10.0) for every age a stone can have in a game.
+static float historyExp(int age) {
+  static const std::array<float, BOARD_MAX_MOVE + 1> table = [] {
+    std::array<float, BOARD_MAX_MOVE + 1> t;
+    for (int i = 0; i <= BOARD_MAX_MOVE; ++i) {
+      t[i] = exp(-i / 10.0);
+    }
+    return t;
+  }();
+  return age <= BOARD_MAX_MOVE ? table[age] : exp(-age / 10.0);
+}
+
+void BoardFeature::getHistoryExpFromCache(
+    const int16_t* last_placed,
+    float* data) const {
+  const int ply = s_.board()._ply;
+  for (int i = 0; i < kBoardRegion; ++i) {
+    data[_fwd[i]] = last_placed[i] >= 0 ? historyExp(ply - last_placed[i]) : 0;
+  }
+}
+
 bool BoardFeature::getDistanceMap(Stone player, float* data) const {
   const Board* _board = &s_.board();
 
@@ -187,6 +187,62 @@ bool BoardFeature::getDistanceMap(Stone player, float* data) const {
   return true;
 }
 
+void BoardFeature::permutePlane(const float* src, float* data) const {
+  if (_rot == NONE && !_flip) {
+    memcpy(data, src, kBoardRegion * sizeof(float));
+    return;
+  }
+
+  // Table-driven gather: data[j] = src[_bwd[j]].
+  int j = 0;
+#ifdef __AVX2__
+  for (; j + 8 <= kBoardRegion; j += 8) {
+    const __m256i idx = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(_bwd + j)));
+    _mm256_storeu_ps(data + j, _mm256_i32gather_ps(src, idx, 4));
+  }
+#endif
+  for (; j < kBoardRegion; ++j) {
+    data[j] = src[_bwd[j]];
+  }
+}
+
+void BoardFeature::expandStones(const uint64_t* bits, float* data) const {
+  if (_rot == NONE && !_flip) {
+    // Identity: bit i maps to data[i], dense loop that vectorizes.
+    for (int i = 0; i < kBoardRegion; ++i) {
+      data[i] = (bits[i >> 6] >> (i & 63)) & 1;
+    }
+    return;
+  }
+
+  // Expand in export order, then permute.
+  float plane[kBoardRegion];
+  for (int i = 0; i < kBoardRegion; ++i) {
+    plane[i] = (bits[i >> 6] >> (i & 63)) & 1;
+  }
+  permutePlane(plane, data);
+}
+
+void BoardFeature::packStones(const uint64_t* bits, uint8_t* data) const {
+  if (_rot == NONE && !_flip) {
+    for (int b = 0; b < kPackedPlaneBytes; ++b) {
+      data[b] = (uint8_t)(bits[b >> 3] >> ((b & 7) << 3));
+    }
+    return;
+  }
+
+  memset(data, 0, kPackedPlaneBytes);
+  for (int w = 0; w < BoardHistory::kNumWords; ++w) {
+    uint64_t word = bits[w];
+    while (word != 0) {
+      const int j = _fwd[(w << 6) + __builtin_ctzll(word)];
+      data[j >> 3] |= (uint8_t)(1 << (j & 7));
+      word &= word - 1;
+    }
+  }
+}
+
 static float* board_plane(float* features, int idx) {
   return features + idx * BOARD_SIZE * BOARD_SIZE;
 }
@@ -207,6 +263,11 @@ void BoardFeature::extract(std::vector<float>* features) const {
 }
 
 void BoardFeature::extract(float* features) const {
+  if (s_.featureCache() != nullptr) {
+    extractFromCache(*s_.featureCache(), features);
+    return;
+  }
+
   std::fill(features, features + MAX_NUM_FEATURE * kBoardRegion, 0.0);
 
   const Board* _board = &s_.board();
@@ -236,6 +297,40 @@ void BoardFeature::extract(float* features) const {
     std::fill(white_indicator, white_indicator + kBoardRegion, 1.0);
 }
 
+// Same planes as above, copied from the incrementally maintained cache.
+void BoardFeature::extractFromCache(const FeatureCache& cache, float* features)
+    const {
+  const Board* _board = &s_.board();
+  Stone player = _board->_next_player;
+  Stone opponent = OPPONENT(player);
+
+  for (int k = 0; k < 3; ++k) {
+    permutePlane(
+        cache.liberties(player) + k * kBoardRegion, LAYER(OUR_LIB + k));
+    permutePlane(
+        cache.liberties(opponent) + k * kBoardRegion, LAYER(OPPONENT_LIB + k));
+  }
+  getSimpleKo(player, LAYER(OUR_SIMPLE_KO));
+
+  permutePlane(cache.stones(player), LAYER(OUR_STONES));
+  permutePlane(cache.stones(opponent), LAYER(OPPONENT_STONES));
+  permutePlane(cache.stones(S_EMPTY), LAYER(EMPTY_STONES));
+
+  getHistoryExpFromCache(cache.lastPlaced(player), LAYER(OUR_HISTORY));
+  getHistoryExpFromCache(cache.lastPlaced(opponent), LAYER(OPPONENT_HISTORY));
+
+  std::fill(LAYER(BORDER), LAYER(OUR_CLOSEST_COLOR), (float)0.0);
+  permutePlane(cache.distance(player), LAYER(OUR_CLOSEST_COLOR));
+  permutePlane(cache.distance(opponent), LAYER(OPPONENT_CLOSEST_COLOR));
+
+  float* black_indicator = LAYER(BLACK_INDICATOR);
+  float* white_indicator = LAYER(WHITE_INDICATOR);
+  const bool black = player == S_BLACK;
+  std::fill(black_indicator, black_indicator + kBoardRegion, black ? 1.0 : 0.0);
+  std::fill(white_indicator, white_indicator + kBoardRegion, black ? 0.0 : 1.0);
+  std::fill(LAYER(WHITE_INDICATOR + 1), LAYER(MAX_NUM_FEATURE), (float)0.0);
+}
+
 void BoardFeature::extractAGZ(std::vector<float>* features) const {
   features->resize(MAX_NUM_AGZ_FEATURE * kBoardRegion);
   extractAGZ(&(*features)[0]);
@@ -245,46 +340,65 @@ void BoardFeature::extractAGZ(std::vector<float>* features) const {
 // Of size 18 * N * N
 // store in float* features
 void BoardFeature::extractAGZ(float* features) const {
-  std::fill(features, features + MAX_NUM_AGZ_FEATURE * kBoardRegion, 0.0);
-
   const Board* _board = &s_.board();
-  // get history of type std::deque<BoardHistory>
-  // and BoardHistory is a struct with members:
-  // std::vector<Coord> black;
-  // std::vector<Coord> white;
-  const auto& history = s_.getHistory();
+  // Ring of packed black/white bitplanes, most recent first.
+  const BoardHistoryRing& history = s_.getHistory();
 
   Stone player = _board->_next_player;
 
-  if (history.size() > MAX_NUM_AGZ_HISTORY) {
-    logger_->info(
-        "#history.size() = {}, > {}", history.size(), MAX_NUM_AGZ_HISTORY);
-    assert(false);
-  }
-
-  // Save the current board state to game state.
-  int i = 0;
-  for (auto it = history.rbegin(); it != history.rend(); ++it) {
-    const std::vector<Coord>* myself = &it->black;
-    const std::vector<Coord>* opponent = &it->white;
-    if (player == S_WHITE)
-      std::swap(myself, opponent);
-
-    float* plane_myself = LAYER(i);
-    for (Coord c : *myself)
-      plane_myself[transform(c)] = 1.0;
-
-    float* plane_opponent = LAYER(i + 1);
-    for (Coord c : *opponent)
-      plane_opponent[transform(c)] = 1.0;
-
-    i += 2;
+  // Save the current board state to game state. Each history plane is
+  // fully written, only missing history and the indicators need filling.
+  const FeatureCache* cache = s_.featureCache();
+  for (size_t i = 0; i < history.size(); ++i) {
+    if (cache != nullptr) {
+      permutePlane(cache->history(i, player), LAYER(2 * i));
+      permutePlane(cache->history(i, OPPONENT(player)), LAYER(2 * i + 1));
+    } else {
+      const BoardHistory& h = history.recent(i);
+      expandStones(h.stones(player), LAYER(2 * i));
+      expandStones(h.stones(OPPONENT(player)), LAYER(2 * i + 1));
+    }
   }
+  std::fill(
+      LAYER(2 * history.size()), LAYER(2 * MAX_NUM_AGZ_HISTORY), (float)0.0);
 
   float* black_indicator = LAYER(2 * MAX_NUM_AGZ_HISTORY);
   float* white_indicator = LAYER(2 * MAX_NUM_AGZ_HISTORY + 1);
-  if (player == S_BLACK)
-    std::fill(black_indicator, black_indicator + kBoardRegion, 1.0);
-  else
-    std::fill(white_indicator, white_indicator + kBoardRegion, 1.0);
+  const bool black = player == S_BLACK;
+  std::fill(black_indicator, black_indicator + kBoardRegion, black ? 1.0 : 0.0);
+  std::fill(white_indicator, white_indicator + kBoardRegion, black ? 0.0 : 1.0);
+}
+
+void BoardFeature::extractAGZPacked(uint8_t* features) const {
+  memset(features, 0, MAX_NUM_AGZ_FEATURE * kPackedPlaneBytes);
+
+  const BoardHistoryRing& history = s_.getHistory();
+  Stone player = s_.board()._next_player;
+
+  for (size_t i = 0; i < history.size(); ++i) {
+    const BoardHistory& h = history.recent(i);
+    packStones(h.stones(player), features + 2 * i * kPackedPlaneBytes);
+    packStones(
+        h.stones(OPPONENT(player)), features + (2 * i + 1) * kPackedPlaneBytes);
+  }
+
+  // Indicator plane: all points set, padding bits of the last byte cleared.
+  const int plane = 2 * MAX_NUM_AGZ_HISTORY + (player == S_BLACK ? 0 : 1);
+  uint8_t* indicator = features + plane * kPackedPlaneBytes;
+  memset(indicator, 0xff, kPackedPlaneBytes);
+  indicator[kPackedPlaneBytes - 1] =
+      0xff >> (kPackedPlaneBytes * 8 - NUM_INTERSECTION);
+}
+
+void BoardFeature::unpackPlanes(
+    const uint8_t* packed,
+    int num_planes,
+    float* features) {
+  for (int c = 0; c < num_planes; ++c) {
+    const uint8_t* src = packed + c * kPackedPlaneBytes;
+    float* dst = features + c * kBoardRegion;
+    for (int i = 0; i < kBoardRegion; ++i) {
+      dst[i] = (src[i >> 3] >> (i & 7)) & 1;
+    }
+  }
 }
@@ -10,6 +10,8 @@
 
 #include "go_common.h"
 
+#include <array>
+#include <cassert>
 #include <random>
 #include <vector>
 
@@ -38,25 +40,143 @@
 #define MAX_NUM_AGZ_FEATURE 18
 #define MAX_NUM_AGZ_HISTORY 8
 
+// Black and white stones of one position, packed as bitplanes indexed by the
+// export offset (x * BOARD_SIZE + y).
 struct BoardHistory {
-  std::vector<Coord> black;
-  std::vector<Coord> white;
+  static constexpr int kNumWords = (NUM_INTERSECTION + 63) / 64;
 
-  BoardHistory(const Board& b) {
+  uint64_t black[kNumWords];
+  uint64_t white[kNumWords];
+
+  BoardHistory() {
+    clear();
+  }
+
+  // Full scan of the board. Only used when stones are placed outside of
+  // GoState::forward (e.g., handicap).
+  explicit BoardHistory(const Board& b) {
+    reset(b);
+  }
+
+  void clear() {
+    memset(black, 0, sizeof(black));
+    memset(white, 0, sizeof(white));
+  }
+
+  void reset(const Board& b) {
+    clear();
     for (int i = 0; i < BOARD_SIZE; ++i) {
       for (int j = 0; j < BOARD_SIZE; ++j) {
         Coord c = OFFSETXY(i, j);
         Stone s = b._infos[c].color;
-        if (s == S_WHITE)
-          white.push_back(c);
-        else if (s == S_BLACK)
-          black.push_back(c);
+        if (s == S_BLACK || s == S_WHITE)
+          add(c, s);
       }
     }
   }
+
+  void add(Coord c, Stone s) {
+    const int offset = EXPORT_OFFSET(c);
+    uint64_t* plane = s == S_BLACK ? black : white;
+    plane[offset >> 6] |= uint64_t(1) << (offset & 63);
+  }
+
+  void remove(Coord c) {
+    const int offset = EXPORT_OFFSET(c);
+    const uint64_t mask = ~(uint64_t(1) << (offset & 63));
+    black[offset >> 6] &= mask;
+    white[offset >> 6] &= mask;
+  }
+
+  const uint64_t* stones(Stone s) const {
+    return s == S_BLACK ? black : white;
+  }
+};
+
+// Fixed-size ring of the last MAX_NUM_AGZ_HISTORY positions. Pushing
+// overwrites the oldest entry, so it never allocates.
+class BoardHistoryRing {
+ public:
+  size_t size() const {
+    return _size;
+  }
+
+  // i == 0 is the most recent position.
+  const BoardHistory& recent(size_t i) const {
+    assert(i < _size);
+    return _ring[(_head + MAX_NUM_AGZ_HISTORY - i) % MAX_NUM_AGZ_HISTORY];
+  }
+
+  void push(const BoardHistory& h) {
+    _head = (_head + 1) % MAX_NUM_AGZ_HISTORY;
+    _ring[_head] = h;
+    if (_size < MAX_NUM_AGZ_HISTORY)
+      _size++;
+  }
+
+  void clear() {
+    _head = 0;
+    _size = 0;
+  }
+
+ private:
+  std::array<BoardHistory, MAX_NUM_AGZ_HISTORY> _ring;
+  size_t _head = 0;
+  size_t _size = 0;
+};
+
+// D4 symmetry lookup tables, built at compile time. For D4 code k (rotation
+// k % 4, flip k / 4, see BoardFeature::setD4Code):
+//   fwd[k][i]:   export offset that export offset i is mapped to.
+//   bwd[k][j]:   export offset that is mapped to export offset j.
+//   coord[k][j]: board coordinate that is mapped to export offset j.
+struct D4Tables {
+  int16_t fwd[8][NUM_INTERSECTION];
+  int16_t bwd[8][NUM_INTERSECTION];
+  Coord coord[8][NUM_INTERSECTION];
 };
 
+constexpr D4Tables makeD4Tables() {
+  D4Tables t{};
+  for (int code = 0; code < 8; ++code) {
+    for (int x = 0; x < BOARD_SIZE; ++x) {
+      for (int y = 0; y < BOARD_SIZE; ++y) {
+        // Same as BoardFeature::Transform.
+        int tx = x, ty = y;
+        switch (code % 4) {
+          case 1:
+            tx = y;
+            ty = BOARD_SIZE - x - 1;
+            break;
+          case 2:
+            tx = BOARD_SIZE - x - 1;
+            ty = BOARD_SIZE - y - 1;
+            break;
+          case 3:
+            tx = BOARD_SIZE - y - 1;
+            ty = x;
+            break;
+        }
+        if (code >= 4) {
+          const int tmp = tx;
+          tx = ty;
+          ty = tmp;
+        }
+        const int i = EXPORT_OFFSET_XY(x, y);
+        const int j = EXPORT_OFFSET_XY(tx, ty);
+        t.fwd[code][i] = j;
+        t.bwd[code][j] = i;
+        t.coord[code][j] = OFFSETXY(x, y);
+      }
+    }
+  }
+  return t;
+}
+
+inline constexpr D4Tables kD4Tables = makeD4Tables();
+
 class GoState;
+class FeatureCache;
 
 class BoardFeature {
  public:
@@ -64,12 +184,12 @@ class BoardFeature {
 
   BoardFeature(const GoState& s, Rot rot, bool flip)
       : s_(s),
-        _rot(rot),
-        _flip(flip),
         logger_(elf::logging::getIndexedLogger(
             "elfgames::go::base::BoardFeature-",
-            "")) {}
-  BoardFeature(const GoState& s) : s_(s), _rot(NONE), _flip(false) {}
+            "")) {
+    setD4Group(rot, flip);
+  }
+  BoardFeature(const GoState& s) : s_(s) {}
 
   static BoardFeature RandomShuffle(const GoState& s, std::mt19937* rng) {
     BoardFeature bf(s);
@@ -84,6 +204,10 @@ class BoardFeature {
   void setD4Group(Rot new_rot, bool new_flip) {
     _rot = new_rot;
     _flip = new_flip;
+    const int code = getD4Code();
+    _fwd = kD4Tables.fwd[code];
+    _bwd = kD4Tables.bwd[code];
+    _coord = kD4Tables.coord[code];
   }
   void setD4Code(int code) {
     auto rot = (BoardFeature::Rot)(code % 4);
@@ -132,15 +256,13 @@ class BoardFeature {
   int64_t coord2Action(Coord m) const {
     if (m == M_PASS)
       return BOARD_ACTION_PASS;
-    auto p = Transform(std::make_pair(X(m), Y(m)));
-    return EXPORT_OFFSET_XY(p.first, p.second);
+    return _fwd[EXPORT_OFFSET(m)];
   }
 
   Coord action2Coord(int64_t action) const {
     if (action == -1 || action == BOARD_ACTION_PASS)
       return M_PASS;
-    auto p = InvTransform(std::make_pair(EXPORT_X(action), EXPORT_Y(action)));
-    return OFFSETXY(p.first, p.second);
+    return _coord[action];
   }
 
   void extract(std::vector<float>* features) const;
@@ -148,22 +270,36 @@ class BoardFeature {
   void extract(float* features) const;
   void extractAGZ(float* features) const;
 
+  // Bytes per plane of the bit-packed AGZ feature. Point i of a plane
+  // (export offset) is bit (i % 8) of byte (i / 8).
+  static constexpr int kPackedPlaneBytes = (NUM_INTERSECTION + 7) / 8;
+
+  // Same planes as extractAGZ, one bit per point.
+  void extractAGZPacked(uint8_t* features) const;
+  // Expand num_planes packed planes back to float planes.
+  static void
+  unpackPlanes(const uint8_t* packed, int num_planes, float* features);
+
  private:
   const GoState& s_;
   Rot _rot = NONE;
   bool _flip = false;
 
+  // Rows of kD4Tables for the current (_rot, _flip).
+  const int16_t* _fwd = kD4Tables.fwd[0];
+  const int16_t* _bwd = kD4Tables.bwd[0];
+  const Coord* _coord = kD4Tables.coord[0];
+
   static constexpr int64_t kBoardRegion = BOARD_SIZE * BOARD_SIZE;
 
   std::shared_ptr<spdlog::logger> logger_;
 
   int transform(int x, int y) const {
-    auto p = Transform(std::make_pair(x, y));
-    return EXPORT_OFFSET_XY(p.first, p.second);
+    return _fwd[EXPORT_OFFSET_XY(x, y)];
   }
 
   int transform(Coord m) const {
-    return transform(X(m), Y(m));
+    return _fwd[EXPORT_OFFSET(m)];
   }
 
   int transform(Coord m, int c) const {
@@ -179,4 +315,16 @@ class BoardFeature {
   bool getHistory(Stone player, float* data) const;
   bool getHistoryExp(Stone player, float* data) const;
   bool getDistanceMap(Stone player, float* data) const;
+
+  // Features from GoState's FeatureCache, if enabled.
+  void extractFromCache(const FeatureCache& cache, float* features) const;
+  void getHistoryExpFromCache(const int16_t* last_placed, float* data) const;
+
+  // D4-permute one plane in export order. Every point of data is written.
+  void permutePlane(const float* src, float* data) const;
+  // Expand one packed history bitplane into a float plane. Every point of
+  // the plane is written.
+  void expandStones(const uint64_t* bits, float* data) const;
+  // Same, but into a bit-packed plane of kPackedPlaneBytes.
+  void packStones(const uint64_t* bits, uint8_t* data) const;
 };
@@ -0,0 +1,185 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "feature_cache.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Distance transform
+void DistanceTransform(float* arr) {
+#define IND(i, j) ((i)*BOARD_SIZE + (j))
+  // First dimension.
+  for (int j = 0; j < BOARD_SIZE; j++) {
+    for (int i = 1; i < BOARD_SIZE; i++) {
+      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i - 1, j)] + 1);
+    }
+    for (int i = BOARD_SIZE - 2; i >= 0; i--) {
+      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i + 1, j)] + 1);
+    }
+  }
+  // Second dimension
+  for (int i = 0; i < BOARD_SIZE; i++) {
+    for (int j = 1; j < BOARD_SIZE; j++) {
+      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i, j - 1)] + 1);
+    }
+    for (int j = BOARD_SIZE - 2; j >= 0; j--) {
+      arr[IND(i, j)] = std::min(arr[IND(i, j)], arr[IND(i, j + 1)] + 1);
+    }
+  }
+#undef IND
+}
+
+void FeatureCache::clear() {
+  _history_head = 0;
+  _history_size = 0;
+
+  std::fill(_stones[S_EMPTY], _stones[S_EMPTY] + kBoardRegion, 1.0);
+  std::fill(_stones[S_BLACK], _stones[S_BLACK] + kBoardRegion, 0.0);
+  std::fill(_stones[S_WHITE], _stones[S_WHITE] + kBoardRegion, 0.0);
+  for (int k = 0; k < 2; ++k) {
+    std::fill(_liberties[k], _liberties[k] + 3 * kBoardRegion, 0.0);
+    std::fill(_distance[k], _distance[k] + kBoardRegion, kFarAway);
+    std::fill(_last_placed[k], _last_placed[k] + kBoardRegion, -1);
+  }
+}
+
+void FeatureCache::reset(const Board& b, const BoardHistoryRing& history) {
+  clear();
+  for (size_t i = history.size(); i > 0; --i) {
+    pushHistory(history.recent(i - 1));
+  }
+
+  for (int i = 0; i < BOARD_SIZE; ++i) {
+    for (int j = 0; j < BOARD_SIZE; ++j) {
+      Coord c = OFFSETXY(i, j);
+      Stone s = b._infos[c].color;
+      if (s == S_BLACK || s == S_WHITE)
+        addStone(b, c, s);
+    }
+  }
+  for (int id = 1; id < b._num_groups; ++id) {
+    updateGroup(b, id);
+  }
+  recomputeDistance(S_BLACK);
+  recomputeDistance(S_WHITE);
+}
+
+void FeatureCache::update(
+    const Board& b,
+    Coord c,
+    const BoardHistory& prev,
+    const BoardHistory& cur) {
+  pushHistory(cur);
+  if (c == M_PASS || c == M_RESIGN)
+    return;
+
+  const Stone player = b._infos[c].color;
+  const Stone opponent = OPPONENT(player);
+
+  addStone(b, c, player);
+  // A new stone can only bring its own color closer.
+  float* dist = _distance[player - S_BLACK];
+  for (int x = 0; x < BOARD_SIZE; ++x) {
+    for (int y = 0; y < BOARD_SIZE; ++y) {
+      float& d = dist[EXPORT_OFFSET_XY(x, y)];
+      d = std::min(d, (float)(std::abs(x - X(c)) + std::abs(y - Y(c))));
+    }
+  }
+
+  // Liberties only change for groups touching a point whose emptiness
+  // changed: the placed stone and the captured ones.
+  unsigned short ids[MAX_GROUP];
+  bool seen[MAX_GROUP] = {false};
+  int num_ids = 0;
+  auto touch = [&](Coord p) {
+    FOR4(p, _, q) {
+      unsigned short id = b._infos[q].id;
+      if (G_HAS_STONE(id) && !seen[id]) {
+        seen[id] = true;
+        ids[num_ids++] = id;
+      }
+    }
+    ENDFOR4
+  };
+  seen[b._infos[c].id] = true;
+  ids[num_ids++] = b._infos[c].id;
+  touch(c);
+
+  bool captured = false;
+  const uint64_t* before = prev.stones(opponent);
+  const uint64_t* after = cur.stones(opponent);
+  for (int w = 0; w < BoardHistory::kNumWords; ++w) {
+    uint64_t removed = before[w] & ~after[w];
+    while (removed != 0) {
+      const int offset = (w << 6) + __builtin_ctzll(removed);
+      removeStone(offset, opponent);
+      touch(OFFSETXY(EXPORT_X(offset), EXPORT_Y(offset)));
+      captured = true;
+      removed &= removed - 1;
+    }
+  }
+  if (captured)
+    recomputeDistance(opponent);
+
+  for (int i = 0; i < num_ids; ++i) {
+    updateGroup(b, ids[i]);
+  }
+}
+
+void FeatureCache::pushHistory(const BoardHistory& h) {
+  _history_head = (_history_head + 1) % MAX_NUM_AGZ_HISTORY;
+  for (int k = 0; k < 2; ++k) {
+    const uint64_t* bits = h.stones(S_BLACK + k);
+    float* plane = _history[_history_head][k];
+    for (int i = 0; i < kBoardRegion; ++i) {
+      plane[i] = (bits[i >> 6] >> (i & 63)) & 1;
+    }
+  }
+  if (_history_size < MAX_NUM_AGZ_HISTORY)
+    _history_size++;
+}
+
+void FeatureCache::addStone(const Board& b, Coord c, Stone color) {
+  const int offset = EXPORT_OFFSET(c);
+  _stones[S_EMPTY][offset] = 0.0;
+  _stones[color][offset] = 1.0;
+  _last_placed[color - S_BLACK][offset] = b._infos[c].last_placed;
+}
+
+void FeatureCache::removeStone(int offset, Stone color) {
+  _stones[S_EMPTY][offset] = 1.0;
+  _stones[color][offset] = 0.0;
+  _last_placed[color - S_BLACK][offset] = -1;
+  float* lib = _liberties[color - S_BLACK];
+  for (int k = 0; k < 3; ++k) {
+    lib[k * kBoardRegion + offset] = 0.0;
+  }
+}
+
+void FeatureCache::updateGroup(const Board& b, unsigned short id) {
+  const Board* board = &b;
+  const Group& g = board->_groups[id];
+  const int category = std::min((int)g.liberties, 3) - 1;
+  float* lib = _liberties[g.color - S_BLACK];
+  TRAVERSE(board, id, c) {
+    const int offset = EXPORT_OFFSET(c);
+    for (int k = 0; k < 3; ++k) {
+      lib[k * kBoardRegion + offset] = k == category ? 1.0 : 0.0;
+    }
+  }
+  ENDTRAVERSE
+}
+
+void FeatureCache::recomputeDistance(Stone color) {
+  float* dist = _distance[color - S_BLACK];
+  for (int i = 0; i < kBoardRegion; ++i) {
+    dist[i] = _stones[color][i] > 0 ? 0 : kFarAway;
+  }
+  DistanceTransform(dist);
+}
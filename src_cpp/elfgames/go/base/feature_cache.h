@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "board.h"
+#include "board_feature.h"
+
+// Two-pass L1 distance transform of a BOARD_SIZE x BOARD_SIZE plane.
+void DistanceTransform(float* arr);
+
+// NN input planes of the current position, maintained by GoState::forward()
+// from the delta of each move (placed stone, captured stones and the groups
+// next to them), so that BoardFeature only has to copy or D4-permute them.
+//
+// All planes are in export order (x * BOARD_SIZE + y). Colors index planes
+// directly: S_EMPTY, S_BLACK, S_WHITE.
+class FeatureCache {
+ public:
+  static constexpr int kBoardRegion = BOARD_SIZE * BOARD_SIZE;
+  // Distance of a point when there is no stone of that color.
+  static constexpr float kFarAway = 10000;
+
+  FeatureCache() {
+    clear();
+  }
+
+  // Empty board, no history.
+  void clear();
+
+  // Rebuild from scratch, e.g. after handicap stones are placed.
+  void reset(const Board& b, const BoardHistoryRing& history);
+
+  // Called right after Play(&b, ...) for move c. prev and cur are the packed
+  // stones before and after the move (cur has just been pushed to history).
+  void update(
+      const Board& b,
+      Coord c,
+      const BoardHistory& prev,
+      const BoardHistory& cur);
+
+  // Same length as GoState::getHistory().
+  size_t historySize() const {
+    return _history_size;
+  }
+  // Stones of color (S_BLACK or S_WHITE) in the i-th most recent position.
+  const float* history(size_t i, Stone color) const {
+    assert(i < _history_size);
+    const size_t slot =
+        (_history_head + MAX_NUM_AGZ_HISTORY - i) % MAX_NUM_AGZ_HISTORY;
+    return _history[slot][color - S_BLACK];
+  }
+
+  const float* stones(Stone color) const {
+    return _stones[color];
+  }
+  // Three binary planes: stones of color whose group has 1, 2, >= 3
+  // liberties.
+  const float* liberties(Stone color) const {
+    return _liberties[color - S_BLACK];
+  }
+  // L1 distance to the closest stone of color (kFarAway if there is none).
+  const float* distance(Stone color) const {
+    return _distance[color - S_BLACK];
+  }
+  // Ply at which each stone of color was placed, -1 elsewhere.
+  const int16_t* lastPlaced(Stone color) const {
+    return _last_placed[color - S_BLACK];
+  }
+
+ private:
+  float _history[MAX_NUM_AGZ_HISTORY][2][kBoardRegion];
+  size_t _history_head;
+  size_t _history_size;
+
+  float _stones[3][kBoardRegion];
+  float _liberties[2][3 * kBoardRegion];
+  float _distance[2][kBoardRegion];
+  int16_t _last_placed[2][kBoardRegion];
+
+  void pushHistory(const BoardHistory& h);
+  void addStone(const Board& b, Coord c, Stone color);
+  void removeStone(int offset, Stone color);
+  // Rewrite the liberty planes of all stones in group id.
+  void updateGroup(const Board& b, unsigned short id);
+  void recomputeDistance(Stone color);
+};
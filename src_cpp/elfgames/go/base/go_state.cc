@@ -84,15 +84,48 @@ bool GoState::forward(const Coord& c) {
 
   _add_board_hash(c);
 
-  Play(&_board, &ids);
+  // Group ids in ids are only valid before Play.
+  if (_feature_cache) {
+    // The cache finds the captured stones from the stones before the move.
+    const BoardHistory prev = _stones;
+    _update_stones(ids);
+    Play(&_board, &ids);
+    _history.push(_stones);
+    _feature_cache->update(_board, c, prev, _stones);
+  } else {
+    _update_stones(ids);
+    Play(&_board, &ids);
+    _history.push(_stones);
+  }
 
   _moves.push_back(c);
-  _history.emplace_back(_board);
-  if (_history.size() > MAX_NUM_AGZ_HISTORY)
-    _history.pop_front();
   return true;
 }
 
+GoState& GoState::operator=(const GoState& s) {
+  if (this == &s)
+    return *this;
+  copyBoard(&_board, &s._board);
+  _stones = s._stones;
+  _history = s._history;
+  _board_hash = s._board_hash;
+  _moves = s._moves;
+  _final_value = s._final_value;
+  _has_final_value = s._has_final_value;
+  if (s._feature_cache)
+    _feature_cache = std::make_unique<FeatureCache>(*s._feature_cache);
+  else
+    _feature_cache.reset();
+  return *this;
+}
+
+void GoState::enableFeatureCache() {
+  if (_feature_cache)
+    return;
+  _feature_cache = std::make_unique<FeatureCache>();
+  _feature_cache->reset(_board, _history);
+}
+
 bool GoState::_check_superko() const {
   // Check superko rule.
   // need to check whether last move is pass or not.
@@ -120,6 +153,24 @@ void GoState::_add_board_hash(const Coord& c) {
   copyBits(r.back().bits, _board._bits);
 }
 
+void GoState::_update_stones(const GroupId4& ids) {
+  if (ids.c == M_PASS || ids.c == M_RESIGN)
+    return;
+
+  // Adjacent enemy groups with one liberty left are captured by this move.
+  const Board* b = &_board;
+  for (int i = 0; i < 4; ++i) {
+    if (ids.ids[i] == 0 || ids.colors[i] == ids.player ||
+        ids.group_liberties[i] != 1)
+      continue;
+    TRAVERSE(b, ids.ids[i], c) {
+      _stones.remove(c);
+    }
+    ENDTRAVERSE
+  }
+  _stones.add(ids.c, ids.player);
+}
+
 bool GoState::checkMove(const Coord& c) const {
   GroupId4 ids;
   if (c == M_INVALID)
@@ -129,13 +180,37 @@ bool GoState::checkMove(const Coord& c) const {
 
 void GoState::applyHandicap(int handi) {
   _handi_table.apply(handi, &_board);
+  _stones.reset(_board);
+  if (_feature_cache)
+    _feature_cache->reset(_board, _history);
 }
 
 void GoState::reset() {
   clearBoard(&_board);
   _moves.clear();
   _board_hash.clear();
+  _stones.clear();
   _history.clear();
+  if (_feature_cache)
+    _feature_cache->clear();
+  _final_value = 0.0;
+  _has_final_value = false;
+}
+
+void GoState::saveSnapshot(Snapshot* s) const {
+  copyBoard(&s->board, &_board);
+  s->stones = _stones;
+  s->history = _history;
+}
+
+void GoState::restoreSnapshot(const Snapshot& s, const Coord* moves, size_t n) {
+  copyBoard(&_board, &s.board);
+  _stones = s.stones;
+  _history = s.history;
+  _moves.assign(moves, moves + n);
+  _board_hash.clear();
+  if (_feature_cache)
+    _feature_cache->reset(_board, _history);
   _final_value = 0.0;
   _has_final_value = false;
 }
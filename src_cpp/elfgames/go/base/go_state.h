@@ -9,6 +9,7 @@
 #pragma once
 
 #include <deque>
+#include <memory>
 #include <queue>
 #include <sstream>
 #include <unordered_map>
@@ -18,6 +19,7 @@
 
 #include "board.h"
 #include "board_feature.h"
+#include "feature_cache.h"
 
 class HandicapTable {
  private:
@@ -114,14 +116,38 @@ class GoState {
   void reset();
   void applyHandicap(int handi);
 
+  // A position without the history of positions kept for superko, which
+  // only matters for moves yet to be checked (see PositionIndex).
+  struct Snapshot {
+    Board board;
+    BoardHistory stones;
+    BoardHistoryRing history;
+  };
+  void saveSnapshot(Snapshot* s) const;
+  // Sets the position to s, reached by the n moves.
+  void restoreSnapshot(const Snapshot& s, const Coord* moves, size_t n);
+
   GoState(const GoState& s)
-      : _history(s._history),
+      : _stones(s._stones),
+        _history(s._history),
         _board_hash(s._board_hash),
         _moves(s._moves),
         _final_value(s._final_value),
-        _has_final_value(s._has_final_value) {
+        _has_final_value(s._has_final_value),
+        _feature_cache(
+            s._feature_cache ? std::make_unique<FeatureCache>(*s._feature_cache)
+                             : nullptr) {
     copyBoard(&_board, &s._board);
   }
+  GoState& operator=(const GoState& s);
+
+  // Opt-in: keep the NN input planes up to date in forward(), so that
+  // BoardFeature extraction becomes a copy. A copy of the state gets its own
+  // copy of the cache.
+  void enableFeatureCache();
+  const FeatureCache* featureCache() const {
+    return _feature_cache.get();
+  }
 
   static HandicapTable& handi_table() {
     return _handi_table;
@@ -203,13 +229,15 @@ class GoState {
   }
 
   // TODO: not a good design..
-  const std::deque<BoardHistory>& getHistory() const {
+  const BoardHistoryRing& getHistory() const {
     return _history;
   }
 
  protected:
   Board _board;
-  std::deque<BoardHistory> _history;
+  // Packed stones of _board, updated incrementally in forward().
+  BoardHistory _stones;
+  BoardHistoryRing _history;
 
   struct _BoardRecord {
     Board::Bits bits;
@@ -221,10 +249,13 @@ class GoState {
   float _final_value = 0.0;
   bool _has_final_value = false;
 
+  std::unique_ptr<FeatureCache> _feature_cache;
+
   static HandicapTable _handi_table;
 
   bool _check_superko() const;
   void _add_board_hash(const Coord& c);
+  void _update_stones(const GroupId4& ids);
 };
 
 struct GoReply {
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Microbenchmark of AGZ feature extraction and policy un-rotation, comparing
+// the precomputed D4 tables against per-stone Transform()/InvTransform(), and
+// of DF feature extraction with and without GoState's feature cache.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "elfgames/go/base/board_feature.h"
+#include "elfgames/go/base/go_state.h"
+
+static constexpr int kBoardRegion = BOARD_SIZE * BOARD_SIZE;
+
+// Branchy reference: zero all planes, then scatter each stone through
+// Transform(), which is what extractAGZ did before the tables.
+static void extractAGZReference(const BoardFeature& bf, float* features) {
+  std::fill(features, features + MAX_NUM_AGZ_FEATURE * kBoardRegion, 0.0);
+  const GoState& s = bf.state();
+  const BoardHistoryRing& history = s.getHistory();
+  Stone player = s.nextPlayer();
+
+  for (size_t i = 0; i < history.size(); ++i) {
+    for (int k = 0; k < 2; ++k) {
+      const Stone color = k == 0 ? player : OPPONENT(player);
+      const uint64_t* bits = history.recent(i).stones(color);
+      float* plane = features + (2 * i + k) * kBoardRegion;
+      for (int a = 0; a < kBoardRegion; ++a) {
+        if ((bits[a >> 6] >> (a & 63)) & 1) {
+          auto p = bf.Transform(std::make_pair(EXPORT_X(a), EXPORT_Y(a)));
+          plane[EXPORT_OFFSET_XY(p.first, p.second)] = 1.0;
+        }
+      }
+    }
+  }
+  float* indicator = features +
+      (2 * MAX_NUM_AGZ_HISTORY + (player == S_BLACK ? 0 : 1)) * kBoardRegion;
+  std::fill(indicator, indicator + kBoardRegion, 1.0);
+}
+
+static Coord action2CoordReference(const BoardFeature& bf, int64_t action) {
+  if (action == BOARD_ACTION_PASS)
+    return M_PASS;
+  auto p = bf.InvTransform(std::make_pair(EXPORT_X(action), EXPORT_Y(action)));
+  return OFFSETXY(p.first, p.second);
+}
+
+template <typename F>
+static double nsPerCall(int n, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; ++i) {
+    f(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+int main(int argc, char** argv) {
+  // A mid-game position from random legal moves.
+  std::mt19937 rng(0);
+  GoState s;
+  for (int i = 0; i < 10000 && s.getPly() < 150; ++i) {
+    Coord c = OFFSETXY(rng() % BOARD_SIZE, rng() % BOARD_SIZE);
+    if (s.checkMove(c))
+      s.forward(c);
+  }
+
+  const int n = argc > 1 ? atoi(argv[1]) : 20000;
+  std::vector<float> features(MAX_NUM_AGZ_FEATURE * kBoardRegion);
+  std::vector<float> reference(features.size());
+  BoardFeature bf(s);
+
+  // Sanity check before timing.
+  for (int code = 0; code < 8; ++code) {
+    bf.setD4Code(code);
+    bf.extractAGZ(&features[0]);
+    extractAGZReference(bf, &reference[0]);
+    if (features != reference) {
+      printf("Mismatch at D4 code %d\n", code);
+      return 1;
+    }
+  }
+
+  double t_ref = nsPerCall(n, [&](int i) {
+    bf.setD4Code(i % 8);
+    extractAGZReference(bf, &reference[0]);
+  });
+  double t_new = nsPerCall(n, [&](int i) {
+    bf.setD4Code(i % 8);
+    bf.extractAGZ(&features[0]);
+  });
+  printf(
+      "extractAGZ:   reference %8.1f ns, tables %8.1f ns, speedup %.2fx\n",
+      t_ref,
+      t_new,
+      t_ref / t_new);
+
+  // DF features, rebuilt from the board vs copied from GoState's cache.
+  GoState cached(s);
+  cached.enableFeatureCache();
+  BoardFeature bf_cached(cached);
+  std::vector<float> df(MAX_NUM_FEATURE * kBoardRegion);
+  t_ref = nsPerCall(n, [&](int i) {
+    bf.setD4Code(i % 8);
+    bf.extract(&df[0]);
+  });
+  t_new = nsPerCall(n, [&](int i) {
+    bf_cached.setD4Code(i % 8);
+    bf_cached.extract(&df[0]);
+  });
+  printf(
+      "extract (DF): rebuilt   %8.1f ns, cached %8.1f ns, speedup %.2fx\n",
+      t_ref,
+      t_new,
+      t_ref / t_new);
+
+  uint64_t sink = 0;
+  t_ref = nsPerCall(n, [&](int i) {
+    bf.setD4Code(i % 8);
+    for (int64_t a = 0; a < (int64_t)BOARD_NUM_ACTION; ++a) {
+      sink += action2CoordReference(bf, a);
+    }
+  });
+  t_new = nsPerCall(n, [&](int i) {
+    bf.setD4Code(i % 8);
+    for (int64_t a = 0; a < (int64_t)BOARD_NUM_ACTION; ++a) {
+      sink += bf.action2Coord(a);
+    }
+  });
+  printf(
+      "action2Coord: reference %8.1f ns, tables %8.1f ns, speedup %.2fx "
+      "(%d actions, sink %lu)\n",
+      t_ref,
+      t_new,
+      t_ref / t_new,
+      (int)BOARD_NUM_ACTION,
+      (unsigned long)sink);
+  return 0;
+}
@@ -13,6 +13,8 @@
  */
 
 #include <gtest/gtest.h>
+#include <cstring>
+#include <random>
 #include <vector>
 
 #include "elfgames/go/base/board_feature.h"
@@ -100,6 +102,116 @@ TEST(FeatureTest, testAgzFeature) {
   }
 }
 
+static bool historyEqual(const BoardHistory& h1, const BoardHistory& h2) {
+  return memcmp(h1.black, h2.black, sizeof(h1.black)) == 0 &&
+      memcmp(h1.white, h2.white, sizeof(h1.white)) == 0;
+}
+
+TEST(FeatureTest, testHistoryWithCaptures) {
+  std::string str;
+  for (int i = 0; i < 5; ++i)
+    str += ".........";
+  str += "XXXX.....";
+  str += "XOOX.....";
+  str += "O.OX.....";
+  str += "OOXX.....";
+  GoState s;
+  loadBoard(s, str);
+  giveTurn(s, S_BLACK);
+
+  // The multi-capture move.
+  s.forward(str2coord("bh"));
+
+  const BoardHistoryRing& history = s.getHistory();
+  EXPECT_EQ(history.size(), (size_t)MAX_NUM_AGZ_HISTORY);
+  EXPECT_TRUE(historyEqual(history.recent(0), BoardHistory(s.board())));
+  EXPECT_FALSE(historyEqual(history.recent(0), history.recent(1)));
+
+  // Copies keep their own history.
+  GoState s2(s);
+  s2.forward(str2coord("ii"));
+  EXPECT_TRUE(historyEqual(s2.getHistory().recent(1), history.recent(0)));
+  EXPECT_TRUE(
+      historyEqual(s2.getHistory().recent(0), BoardHistory(s2.board())));
+  EXPECT_TRUE(historyEqual(history.recent(0), BoardHistory(s.board())));
+
+  // The AGZ planes of the current position agree with the board.
+  std::vector<float> features;
+  BoardFeature(s2).extractAGZ(&features);
+  for (int x = 0; x < BOARD_SIZE; ++x) {
+    for (int y = 0; y < BOARD_SIZE; ++y) {
+      Stone stone = s2.board()._infos[OFFSETXY(x, y)].color;
+      // Black to play, so plane 0 holds black stones.
+      EXPECT_EQ(features[EXPORT_OFFSET_XY(x, y)], stone == S_BLACK ? 1.0 : 0.0);
+      EXPECT_EQ(
+          features[kBoardRegion + EXPORT_OFFSET_XY(x, y)],
+          stone == S_WHITE ? 1.0 : 0.0);
+    }
+  }
+}
+
+TEST(FeatureTest, testAgzPackedFeature) {
+  GoState s;
+  for (auto c :
+       {toFlat(0, 0), toFlat(0, 1), toFlat(0, 2), toFlat(0, 3), toFlat(1, 1)})
+    s.forward(c);
+
+  std::vector<uint8_t> packed(
+      MAX_NUM_AGZ_FEATURE * BoardFeature::kPackedPlaneBytes);
+  std::vector<float> unpacked(MAX_NUM_AGZ_FEATURE * kBoardRegion);
+  std::vector<float> features;
+
+  // Packing then unpacking gives extractAGZ, under every symmetry.
+  for (int code = 0; code < 8; ++code) {
+    BoardFeature bf(s);
+    bf.setD4Code(code);
+    bf.extractAGZ(&features);
+    bf.extractAGZPacked(&packed[0]);
+    BoardFeature::unpackPlanes(&packed[0], MAX_NUM_AGZ_FEATURE, &unpacked[0]);
+    EXPECT_TRUE(features == unpacked);
+  }
+}
+
+TEST(FeatureTest, testFeatureCache) {
+  // Random games, with and without the cache, must give identical features.
+  std::mt19937 rng(1);
+  std::vector<float> expected, actual;
+  for (int game = 0; game < 4; ++game) {
+    GoState plain;
+    GoState cached;
+    cached.enableFeatureCache();
+    for (int i = 0; i < 1000 && !plain.terminated(); ++i) {
+      Coord c = toFlat(rng() % BOARD_SIZE, rng() % BOARD_SIZE);
+      if (!plain.checkMove(c))
+        continue;
+      plain.forward(c);
+      cached.forward(c);
+
+      if (i % 50 == 25) {
+        // Copies carry an independent cache.
+        GoState copy(cached);
+        cached.forward(M_PASS);
+        copy.forward(M_PASS);
+        plain.forward(M_PASS);
+        cached = copy;
+      }
+
+      BoardFeature bf_plain(plain);
+      BoardFeature bf_cached(cached);
+      ASSERT_NE(cached.featureCache(), nullptr);
+      const int code = rng() % 8;
+      bf_plain.setD4Code(code);
+      bf_cached.setD4Code(code);
+      bf_plain.extract(&expected);
+      bf_cached.extract(&actual);
+      ASSERT_TRUE(expected == actual) << "ply " << plain.getPly();
+      bf_plain.extractAGZ(&expected);
+      bf_cached.extractAGZ(&actual);
+      ASSERT_TRUE(expected == actual) << "ply " << plain.getPly();
+    }
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
@@ -282,6 +282,29 @@ TEST(SymmetryTest, testProperMoveTransform) {
   }
 }
 
+// The precomputed D4 tables agree with Transform and are permutations.
+TEST(SymmetryTest, testD4Tables) {
+  GoState s;
+  BoardFeature bf(s);
+
+  for (int code = 0; code < 8; ++code) {
+    bf.setD4Code(code);
+    std::vector<bool> seen(kBoardRegion, false);
+    for (int x = 0; x < BOARD_SIZE; ++x) {
+      for (int y = 0; y < BOARD_SIZE; ++y) {
+        Coord m = OFFSETXY(x, y);
+        auto p = bf.Transform(std::make_pair(x, y));
+        int64_t a = bf.coord2Action(m);
+        EXPECT_EQ(a, EXPORT_OFFSET_XY(p.first, p.second));
+        EXPECT_EQ(bf.action2Coord(a), m);
+        EXPECT_FALSE(seen[a]);
+        seen[a] = true;
+      }
+    }
+    EXPECT_EQ(bf.coord2Action(M_PASS), (int64_t)kBoardRegion);
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
 
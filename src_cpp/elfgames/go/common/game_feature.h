@@ -39,6 +39,10 @@ class GoFeature {
     bf.extractAGZ(f);
   }
 
+  static void extractStateAGZPacked(const BoardFeature& bf, uint8_t* f) {
+    bf.extractAGZPacked(f);
+  }
+
   static void ReplyValue(GoReply& reply, const float* value) {
     reply.value = *value;
   }
@@ -104,13 +108,20 @@ class GoFeature {
     extractStateAGZ(s._bf, f);
   }
 
+  static void extractStateExtAGZPacked(
+      const GoStateExtOffline& s,
+      uint8_t* f) {
+    extractStateAGZPacked(s._bf, f);
+  }
+
   static void extractMCTSPi(const GoStateExtOffline& s, float* mcts_scores) {
     const BoardFeature& bf = s._bf;
     const size_t move_to = s._state.getPly() - 1;
 
     std::fill(mcts_scores, mcts_scores + BOARD_NUM_ACTION, 0.0);
-    if (move_to < s._mcts_policies.size()) {
-      const auto& policy = s._mcts_policies[move_to].prob;
+    const std::vector<CoordRecord>& policies = s._record->result.policies;
+    if (move_to < policies.size()) {
+      const auto& policy = policies[move_to].prob;
       float sum_v = 0.0;
       for (size_t i = 0; i < BOARD_NUM_ACTION; ++i) {
         mcts_scores[i] = policy[bf.action2Coord(i)];
@@ -121,7 +132,7 @@ class GoFeature {
         mcts_scores[i] /= sum_v;
       }
     } else {
-      mcts_scores[bf.coord2Action(s._offline_all_moves[move_to])] = 1.0;
+      mcts_scores[bf.coord2Action(s._index->moves()[move_to])] = 1.0;
     }
   }
 
@@ -133,7 +144,7 @@ class GoFeature {
     std::fill(offline_a, offline_a + s._options.num_future_actions, 0);
     const size_t move_to = s._state.getPly() - 1;
     for (int i = 0; i < s._options.num_future_actions; ++i) {
-      Coord m = s._offline_all_moves[move_to + i];
+      Coord m = s._index->moves()[move_to + i];
       offline_a[i] = bf.coord2Action(m);
     }
   }
@@ -166,6 +177,15 @@ class GoFeature {
     } else {
       s.addFunction<BoardFeature>(extractStateAGZ)
           .addFunction<GoStateExtOffline>(extractStateExtAGZ);
+
+      // Bit-packed alternative to "s" (all AGZ planes are binary), 1/32 of
+      // the bytes to move. See BoardFeature::kPackedPlaneBytes for layout.
+      e.addField<uint8_t>("s_packed")
+          .addExtents(
+              batchsize,
+              {batchsize, _num_plane, BoardFeature::kPackedPlaneBytes})
+          .addFunction<BoardFeature>(extractStateAGZPacked)
+          .addFunction<GoStateExtOffline>(extractStateExtAGZPacked);
     }
 
     e.addField<int64_t>("a").addExtent(batchsize);
@@ -211,6 +231,7 @@ class GoFeature {
         {"board_size", BOARD_SIZE},
         {"num_future_actions", options_.num_future_actions},
         {"num_planes", _num_plane},
+        {"packed_plane_bytes", BoardFeature::kPackedPlaneBytes},
         {"our_stone_plane", _our_stone_plane},
         {"opponent_stone_plane", _opponent_stone_plane},
         {"ACTION_SKIP", SA_SKIP},
@@ -47,6 +47,7 @@ MCTSGoAI* GoGameSelfPlay::init_ai(
   params.seed = _rng();
   params.ply_pass_enabled = _options.ply_pass_enabled;
   params.komi = _options.komi;
+  params.num_symmetries = _options.num_symmetries;
   params.required_version = model_ver;
 
   elf::ai::tree_search::TSOptions opt = mcts_options;
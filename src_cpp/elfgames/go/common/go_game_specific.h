@@ -77,6 +77,10 @@ struct GameOptions {
   int preload_sgf_move_to = -1;
 
   bool use_df_feature = false;
+  // Keep NN input planes incrementally in GoState (see FeatureCache).
+  bool use_feature_cache = false;
+  // Evaluate MCTS leaves under this many D4 symmetries and average.
+  int num_symmetries = 1;
 
   int q_min_size = 10;
   int q_max_size = 1000;
@@ -120,6 +124,28 @@ struct GameOptions {
   std::string server_addr;
   std::string server_id;
   int port;
+  // "tcp", "ipc" for clients on the same host as the server, or "inproc"
+  // for clients in the same process (see elf::distri::endpoint).
+  std::string transport = "tcp";
+  // Compression of the records sent to the server (see
+  // elf::shared::Options).
+  std::string compression;
+  std::string compression_dict;
+  // Threads of the server decoding and processing received records.
+  int num_decode_workers = 4;
+  // Records in flight from a client (0 to wait for a reply to each batch,
+  // see elf::shared::Options::stream_credits).
+  int stream_credits = 8;
+  // Ingest shards of the server, on ports port to port + num_ingest_shards
+  // - 1 (clients need the same value to pick theirs).
+  int num_ingest_shards = 1;
+  // Seconds between heartbeats of a client, with the states of its games
+  // (see Heartbeat), 0 for none.
+  int heartbeat_sec = 5;
+  // Moves between the snapshots of the positions of a game in the replay
+  // buffer (see PositionIndex), 0 to replay sampled positions from the
+  // start.
+  int position_snapshot_interval = 32;
   bool verbose = false;
   bool print_result = false;
   std::string dump_record_prefix;
@@ -148,6 +174,9 @@ struct GameOptions {
     ss << "MoveCutOff: " << move_cutoff << std::endl;
     ss << "Use DF feature: " << elf_utils::print_bool(use_df_feature)
        << std::endl;
+    ss << "Use feature cache: " << elf_utils::print_bool(use_feature_cache)
+       << std::endl;
+    ss << "#Symmetries per evaluation: " << num_symmetries << std::endl;
     ss << "PolicyDistriCutOff: " << policy_distri_cutoff << std::endl;
 
     if (expected_num_clients > 0) {
@@ -163,9 +192,19 @@ struct GameOptions {
     }
 
     ss << "Server_addr: " << server_addr << ", server_id: " << server_id
-       << ", port: " << port << std::endl;
+       << ", port: " << port << ", transport: " << transport << std::endl;
+    if (!compression.empty() || !compression_dict.empty()) {
+      ss << "Compression: " << compression << ", dict: " << compression_dict
+         << std::endl;
+    }
     ss << "#Reader: " << num_reader << ", Qmin_sz: " << q_min_size
        << ", Qmax_sz: " << q_max_size << std::endl;
+    ss << "#DecodeWorkers: " << num_decode_workers << std::endl;
+    ss << "Stream credits: " << stream_credits << std::endl;
+    ss << "#IngestShards: " << num_ingest_shards << std::endl;
+    ss << "Heartbeat sec: " << heartbeat_sec << std::endl;
+    ss << "Position snapshot interval: " << position_snapshot_interval
+       << std::endl;
     ss << "Verbose: " << elf_utils::print_bool(verbose) << std::endl;
     ss << "Policy distri training for all moves: "
        << elf_utils::print_bool(verbose) << std::endl;
@@ -230,6 +269,14 @@ struct GameOptions {
       server_addr,
       server_id,
       port,
+      transport,
+      compression,
+      compression_dict,
+      num_decode_workers,
+      stream_credits,
+      num_ingest_shards,
+      heartbeat_sec,
+      position_snapshot_interval,
       policy_distri_cutoff,
       client_max_delay_sec,
       q_min_size,
@@ -250,6 +297,8 @@ struct GameOptions {
       ply_pass_enabled,
       following_pass,
       use_df_feature,
+      use_feature_cache,
+      num_symmetries,
       policy_distri_training_for_all,
       black_use_policy_network_only,
       white_use_policy_network_only,
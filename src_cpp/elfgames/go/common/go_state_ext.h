@@ -16,6 +16,7 @@
 #include "../base/go_state.h"
 #include "game_utils.h"
 #include "go_game_specific.h"
+#include "position_index.h"
 #include "record.h"
 
 #include "elf/ai/tree_search/tree_search_base.h"
@@ -42,6 +43,8 @@ struct GoStateExt {
         _logger(elf::logging::getIndexedLogger(
             "elfgames::go::common::GoStateExt-",
             "")) {
+    if (options.use_feature_cache)
+      _state.enableFeatureCache();
     restart();
   }
 
@@ -266,31 +269,32 @@ class GoStateExtOffline {
         _options(options),
         _logger(elf::logging::getIndexedLogger(
             "elfgames::go::common::GoStateExtOffline-",
-            "")) {}
-
-  void fromRecord(const Record& r) {
-    _offline_all_moves = sgfstr2coords(r.result.content);
-    _offline_winner = r.result.reward > 0 ? 1.0 : -1.0;
+            "")) {
+    if (options.use_feature_cache)
+      _state.enableFeatureCache();
+  }
 
-    _mcts_policies = r.result.policies;
-    curr_request_ = r.request;
-    _seq = r.seq;
-    _predicted_values = r.result.values;
+  void fromRecord(const IndexedRecord& r) {
+    _record = r.record;
+    _index = r.index;
+    _offline_winner = _record->result.reward > 0 ? 1.0 : -1.0;
+    curr_request_ = _record->request;
+    _seq = _record->seq;
     _state.reset();
   }
 
   bool switchRandomMove(std::mt19937* rng) {
     // Random sample one move
-    if ((int)_offline_all_moves.size() <= _options.num_future_actions - 1) {
+    if (getNumMoves() <= _options.num_future_actions - 1) {
       _logger->warn(
           "[{}] #moves {} smaller than {} - 1",
           _game_idx,
-          _offline_all_moves.size(),
+          getNumMoves(),
           _options.num_future_actions);
       return false;
     }
-    size_t move_to = (*rng)() %
-        (_offline_all_moves.size() - _options.num_future_actions + 1);
+    size_t move_to =
+        (*rng)() % (getNumMoves() - _options.num_future_actions + 1);
     switchBeforeMove(move_to);
     return true;
   }
@@ -300,20 +304,15 @@ class GoStateExtOffline {
   }
 
   void switchBeforeMove(size_t move_to) {
-    assert(move_to < _offline_all_moves.size());
-
-    _state.reset();
-    for (size_t i = 0; i < move_to; ++i) {
-      _state.forward(_offline_all_moves[i]);
-    }
+    _index->restore(move_to, &_state);
   }
 
   int getNumMoves() const {
-    return _offline_all_moves.size();
+    return _index ? _index->moves().size() : 0;
   }
 
   float getPredictedValue(int move_idx) const {
-    return _predicted_values[move_idx];
+    return _record->result.values[move_idx];
   }
 
  private:
@@ -325,11 +324,9 @@ class GoStateExtOffline {
   int _seq;
   MsgRequest curr_request_;
 
-  std::vector<Coord> _offline_all_moves;
+  std::shared_ptr<const Record> _record;
+  std::shared_ptr<const PositionIndex> _index;
   float _offline_winner;
 
-  std::vector<CoordRecord> _mcts_policies;
-  std::vector<float> _predicted_values;
-
   std::shared_ptr<spdlog::logger> _logger;
 };
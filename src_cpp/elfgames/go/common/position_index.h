@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "../base/go_state.h"
+#include "../sgf/sgf.h"
+#include "record.h"
+
+// The moves of a game, decoded once, with a snapshot of the position every
+// snapshot_interval moves: the position before any move is restored from
+// the snapshot before it plus fewer than snapshot_interval moves, instead of
+// a replay from the start.
+//
+// Restored positions are those of a replay from the start: the moves that
+// GoState::forward() rejected there (e.g. after superko) are skipped. As
+// the history of positions kept for superko is not in the snapshots, a
+// restored GoState is for reading the position, not for playing on.
+class PositionIndex {
+ public:
+  // No snapshots if snapshot_interval <= 0.
+  PositionIndex(std::vector<Coord> moves, int snapshot_interval)
+      : moves_(std::move(moves)),
+        snapshot_interval_(std::max(snapshot_interval, 0)),
+        played_(moves_.size()) {
+    if (snapshot_interval_ > 0) {
+      snapshots_.reserve(moves_.size() / snapshot_interval_);
+    }
+    GoState s;
+    for (size_t i = 0; i < moves_.size(); ++i) {
+      if (snapshot_interval_ > 0 && i > 0 && i % snapshot_interval_ == 0) {
+        snapshots_.emplace_back();
+        s.saveSnapshot(&snapshots_.back().position);
+        snapshots_.back().num_played = s.getAllMoves().size();
+      }
+      played_[i] = moves_[i] != M_INVALID && s.forward(moves_[i]);
+    }
+    played_moves_ = s.getAllMoves();
+  }
+
+  PositionIndex(const Record& r, int snapshot_interval)
+      : PositionIndex(sgfstr2coords(r.result.content), snapshot_interval) {}
+
+  const std::vector<Coord>& moves() const {
+    return moves_;
+  }
+
+  // Sets s to the position before moves()[move_to].
+  void restore(size_t move_to, GoState* s) const {
+    assert(move_to < moves_.size());
+    size_t i = 0;
+    const size_t k =
+        snapshot_interval_ > 0 ? move_to / snapshot_interval_ : 0;
+    if (k > 0) {
+      const Snapshot& snapshot = snapshots_[k - 1];
+      s->restoreSnapshot(
+          snapshot.position, played_moves_.data(), snapshot.num_played);
+      i = k * snapshot_interval_;
+    } else {
+      s->reset();
+    }
+    for (; i < move_to; ++i) {
+      if (played_[i]) {
+        s->forward(moves_[i]);
+      }
+    }
+  }
+
+ private:
+  struct Snapshot {
+    GoState::Snapshot position;
+    size_t num_played;
+  };
+
+  std::vector<Coord> moves_;
+  size_t snapshot_interval_;
+  // Whether moves_[i] was played by a replay from the start.
+  std::vector<bool> played_;
+  std::vector<Coord> played_moves_;
+  // Position before moves_[(k + 1) * snapshot_interval_].
+  std::vector<Snapshot> snapshots_;
+};
+
+// A record of the replay buffer, decoded on insertion. Shared with the
+// GoStateExtOffline sampling it rather than copied.
+struct IndexedRecord {
+  std::shared_ptr<const Record> record;
+  std::shared_ptr<const PositionIndex> index;
+};
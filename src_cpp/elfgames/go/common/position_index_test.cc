@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "elfgames/go/base/board_feature.h"
+#include "elfgames/go/common/position_index.h"
+#include "elfgames/go/common/record_samples.h"
+
+namespace {
+
+GoState replay(const std::vector<Coord>& moves, size_t move_to) {
+  GoState s;
+  for (size_t i = 0; i < move_to; ++i) {
+    s.forward(moves[i]);
+  }
+  return s;
+}
+
+// Restored positions must be those of a replay from the start, down to the
+// features.
+void checkRestore(const std::vector<Coord>& moves, int snapshot_interval) {
+  PositionIndex index(moves, snapshot_interval);
+  ASSERT_TRUE(index.moves() == moves);
+
+  GoState restored;
+  restored.enableFeatureCache();
+  std::vector<float> expected, actual;
+  for (size_t move_to = 0; move_to < moves.size(); ++move_to) {
+    const GoState s = replay(moves, move_to);
+    index.restore(move_to, &restored);
+
+    ASSERT_EQ(s.getPly(), restored.getPly()) << "move_to " << move_to;
+    ASSERT_EQ(s.getHashCode(), restored.getHashCode());
+    ASSERT_EQ(s.nextPlayer(), restored.nextPlayer());
+    ASSERT_EQ(s.lastMove(), restored.lastMove());
+    ASSERT_EQ(s.lastMove2(), restored.lastMove2());
+    ASSERT_TRUE(s.getAllMoves() == restored.getAllMoves());
+
+    BoardFeature bf(s);
+    BoardFeature bf_restored(restored);
+    bf.extract(&expected);
+    bf_restored.extract(&actual);
+    ASSERT_TRUE(expected == actual) << "move_to " << move_to;
+    bf.extractAGZ(&expected);
+    bf_restored.extractAGZ(&actual);
+    ASSERT_TRUE(expected == actual) << "move_to " << move_to;
+  }
+}
+
+} // namespace
+
+TEST(PositionIndexTest, testRestore) {
+  std::mt19937 rng(1);
+  MsgRequest request;
+  request.vers.black_ver = 0;
+  for (int game = 0; game < 2; ++game) {
+    const Record r = randomRecord(rng, request);
+    const std::vector<Coord> moves = sgfstr2coords(r.result.content);
+    for (int snapshot_interval : {0, 1, 7, 32}) {
+      checkRestore(moves, snapshot_interval);
+    }
+  }
+}
+
+TEST(PositionIndexTest, testRejectedMoves) {
+  // Moves on occupied points are rejected by the replay, and skipped.
+  std::mt19937 rng(2);
+  std::vector<Coord> moves;
+  for (int i = 0; i < 120; ++i) {
+    moves.push_back(OFFSETXY(rng() % BOARD_SIZE, rng() % BOARD_SIZE));
+  }
+  moves.push_back(M_PASS);
+  moves.push_back(M_PASS);
+  // After two passes, the game is over.
+  moves.push_back(OFFSETXY(0, 0));
+  ASSERT_LT(replay(moves, moves.size()).getPly(), (int)moves.size());
+
+  for (int snapshot_interval : {0, 4, 32}) {
+    checkRestore(moves, snapshot_interval);
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
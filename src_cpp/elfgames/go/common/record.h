@@ -8,20 +8,31 @@
 
 #pragma once
 
+#include <string.h>
+
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <mutex>
+#include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <nlohmann/json.hpp>
+#include "elf/utils/binary_utils.h"
 #include "model_pair.h"
 
 #include "../base/board.h"
 #include "../base/common.h"
+#include "../sgf/sgf.h"
 
 using json = nlohmann::json;
 
+// Name of the binary encoding of Records (see Records::dumpBinaryString),
+// as negotiated by the Writer/Reader of the self-play pipeline.
+constexpr char kRecordsBinaryFormat[] = "records-bin1";
+
 enum ClientType {
   CLIENT_INVALID,
   CLIENT_SELFPLAY_ONLY,
@@ -247,6 +258,133 @@ struct MsgResult {
     }
     return res;
   }
+
+  // Binary encoding. Moves are stored as coords when content is exactly
+  // what coords2sgfstr produces, and policies sparsely when most of their
+  // entries are zero. With top_k > 0, only the top_k largest entries of
+  // each policy are kept.
+  void writeBinary(elf_utils::BinaryWriter& w, int top_k = 0) const {
+    w.putSignedVarint(num_move);
+    w.putFloat(reward);
+    w.putByte((black_never_resign ? 1 : 0) | (white_never_resign ? 2 : 0));
+    w.putVarint(using_models.size());
+    for (int64_t m : using_models) {
+      w.putSignedVarint(m);
+    }
+
+    std::vector<Coord> moves = sgfstr2coords(content);
+    if (coords2sgfstr(moves) == content) {
+      w.putByte(1);
+      w.putVarint(moves.size());
+      for (Coord c : moves) {
+        w.putVarint(c);
+      }
+    } else {
+      w.putByte(0);
+      w.putString(content);
+    }
+
+    w.putVarint(policies.size());
+    for (const CoordRecord& p : policies) {
+      writePolicy(w, p, top_k);
+    }
+
+    w.putVarint(values.size());
+    for (float v : values) {
+      w.putFloat(v);
+    }
+  }
+
+  static MsgResult readBinary(elf_utils::BinaryReader& r) {
+    MsgResult res;
+    res.num_move = r.getSignedVarint();
+    res.reward = r.getFloat();
+    const uint8_t flags = r.getByte();
+    res.black_never_resign = (flags & 1) != 0;
+    res.white_never_resign = (flags & 2) != 0;
+    res.using_models.resize(r.getCount());
+    for (int64_t& m : res.using_models) {
+      m = r.getSignedVarint();
+    }
+
+    if (r.getByte() == 1) {
+      std::vector<Coord> moves(r.getCount());
+      for (Coord& c : moves) {
+        c = r.getVarint();
+      }
+      res.content = coords2sgfstr(moves);
+    } else {
+      res.content = r.getString();
+    }
+
+    res.policies.resize(r.getCount());
+    for (CoordRecord& p : res.policies) {
+      readPolicy(r, &p);
+    }
+
+    res.values.resize(r.getCount());
+    for (float& v : res.values) {
+      v = r.getFloat();
+    }
+    return res;
+  }
+
+ private:
+  // Either 0 followed by all BOUND_COORD entries, or n + 1 followed by n
+  // (index delta, value) pairs for the non-zero entries.
+  static void writePolicy(
+      elf_utils::BinaryWriter& w,
+      const CoordRecord& p,
+      int top_k) {
+    std::vector<std::pair<int, unsigned char>> entries;
+    for (int i = 0; i < BOUND_COORD; ++i) {
+      if (p.prob[i] > 0) {
+        entries.emplace_back(i, p.prob[i]);
+      }
+    }
+    if (top_k > 0 && entries.size() > (size_t)top_k) {
+      std::nth_element(
+          entries.begin(),
+          entries.begin() + top_k,
+          entries.end(),
+          [](const std::pair<int, unsigned char>& a,
+             const std::pair<int, unsigned char>& b) {
+            return a.second > b.second;
+          });
+      entries.resize(top_k);
+      std::sort(entries.begin(), entries.end());
+    }
+
+    if (entries.size() * 2 >= (size_t)BOUND_COORD) {
+      w.putVarint(0);
+      w.putBytes(p.prob, BOUND_COORD);
+      return;
+    }
+    w.putVarint(entries.size() + 1);
+    int last = 0;
+    for (const auto& e : entries) {
+      w.putVarint(e.first - last);
+      w.putByte(e.second);
+      last = e.first;
+    }
+  }
+
+  static void readPolicy(elf_utils::BinaryReader& r, CoordRecord* p) {
+    const size_t n = r.getCount();
+    if (n == 0) {
+      r.getBytes(p->prob, BOUND_COORD);
+      return;
+    }
+    std::fill(p->prob, p->prob + BOUND_COORD, 0);
+    uint64_t idx = 0;
+    for (size_t i = 0; i < n - 1; ++i) {
+      idx += r.getVarint();
+      if (idx >= (uint64_t)BOUND_COORD) {
+        throw std::runtime_error("MsgResult: policy index out of range");
+      }
+      p->prob[idx] = r.getByte();
+    }
+  }
 };
 
 struct Record {
@@ -291,6 +429,28 @@ struct Record {
     return r;
   }
 
+  // Binary encoding of all but the request, which Records stores once per
+  // distinct value.
+  void writeBinary(elf_utils::BinaryWriter& w, int top_k = 0) const {
+    result.writeBinary(w, top_k);
+    w.putVarint(timestamp);
+    w.putVarint(thread_id);
+    w.putSignedVarint(seq);
+    w.putFloat(pri);
+    w.putByte(offline ? 1 : 0);
+  }
+
+  static Record readBinary(elf_utils::BinaryReader& r) {
+    Record rec;
+    rec.result = MsgResult::readBinary(r);
+    rec.timestamp = r.getVarint();
+    rec.thread_id = r.getVarint();
+    rec.seq = r.getSignedVarint();
+    rec.pri = r.getFloat();
+    rec.offline = r.getByte() != 0;
+    return rec;
+  }
+
   // Extra serialization.
   static std::vector<Record> createBatchFromJson(const std::string& json_str) {
     return createBatchFromJson(json::parse(json_str));
@@ -379,6 +539,45 @@ struct ThreadState {
     return state;
   }
 
+  void writeBinary(elf_utils::BinaryWriter& w) const {
+    w.putSignedVarint(thread_id);
+    w.putSignedVarint(seq);
+    w.putSignedVarint(move_idx);
+    w.putSignedVarint(black);
+    w.putSignedVarint(white);
+  }
+
+  static ThreadState readBinary(elf_utils::BinaryReader& r) {
+    ThreadState state;
+    state.thread_id = r.getSignedVarint();
+    state.seq = r.getSignedVarint();
+    state.move_idx = r.getSignedVarint();
+    state.black = r.getSignedVarint();
+    state.white = r.getSignedVarint();
+    return state;
+  }
+
+  // Fixed-width (see Heartbeat).
+  void writeFixed(elf_utils::BinaryWriter& w) const {
+    w.putFixed32(thread_id);
+    w.putFixed32(seq);
+    w.putFixed32(move_idx);
+    w.putFixed64(black);
+    w.putFixed64(white);
+  }
+
+  static ThreadState readFixed(elf_utils::BinaryReader& r) {
+    ThreadState state;
+    state.thread_id = static_cast<int32_t>(r.getFixed32());
+    state.seq = static_cast<int32_t>(r.getFixed32());
+    state.move_idx = static_cast<int32_t>(r.getFixed32());
+    state.black = static_cast<int64_t>(r.getFixed64());
+    state.white = static_cast<int64_t>(r.getFixed64());
+    return state;
+  }
+
+  static constexpr size_t kFixedSize = 3 * 4 + 2 * 8;
+
   friend bool operator==(const ThreadState& t1, const ThreadState& t2) {
     return t1.thread_id == t2.thread_id && t1.seq == t2.seq &&
         t1.move_idx == t2.move_idx && t1.black == t2.black &&
@@ -473,4 +672,145 @@ struct Records {
       return createFromJson(j);
     }
   }
+
+  // Binary encoding (kRecordsBinaryFormat): magic and version, identity,
+  // states, the distinct requests of the records (as json), then each
+  // record with the index of its request. See MsgResult::writeBinary for
+  // top_k.
+  std::string dumpBinaryString(int top_k = 0) const {
+    std::string s;
+    elf_utils::BinaryWriter w(&s);
+    w.putBytes(kBinaryMagic, sizeof(kBinaryMagic));
+    w.putByte(kBinaryVersion);
+    w.putString(identity);
+
+    w.putVarint(states.size());
+    for (const auto& t : states) {
+      t.second.writeBinary(w);
+    }
+
+    // Records of a batch mostly share a handful of requests.
+    std::vector<const MsgRequest*> requests;
+    std::vector<size_t> request_idx(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+      const MsgRequest& request = records[i].request;
+      size_t k = 0;
+      while (k < requests.size() && *requests[k] != request) {
+        k++;
+      }
+      if (k == requests.size()) {
+        requests.push_back(&request);
+      }
+      request_idx[i] = k;
+    }
+    w.putVarint(requests.size());
+    for (const MsgRequest* request : requests) {
+      w.putString(request->setJsonFields());
+    }
+
+    w.putVarint(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+      w.putVarint(request_idx[i]);
+      records[i].writeBinary(w, top_k);
+    }
+    return s;
+  }
+
+  static bool isBinaryString(const std::string& s) {
+    return s.size() > sizeof(kBinaryMagic) &&
+        memcmp(s.data(), kBinaryMagic, sizeof(kBinaryMagic)) == 0;
+  }
+
+  // Throws (a std::exception) on malformed input.
+  static Records createFromBinaryString(const std::string& s) {
+    if (!isBinaryString(s)) {
+      throw std::runtime_error("Records: not a binary string");
+    }
+    elf_utils::BinaryReader r(
+        s.data() + sizeof(kBinaryMagic), s.size() - sizeof(kBinaryMagic));
+    if (r.getByte() != kBinaryVersion) {
+      throw std::runtime_error("Records: unsupported binary version");
+    }
+    Records rs(r.getString());
+
+    const size_t num_states = r.getCount();
+    for (size_t i = 0; i < num_states; ++i) {
+      ThreadState t = ThreadState::readBinary(r);
+      rs.states[t.thread_id] = t;
+    }
+
+    std::vector<MsgRequest> requests(r.getCount());
+    for (MsgRequest& request : requests) {
+      request = MsgRequest::createFromJson(json::parse(r.getString()));
+    }
+
+    rs.records.resize(r.getCount());
+    for (Record& rec : rs.records) {
+      const uint64_t k = r.getVarint();
+      if (k >= requests.size()) {
+        throw std::runtime_error("Records: request index out of range");
+      }
+      rec = Record::readBinary(r);
+      rec.request = requests[k];
+    }
+    if (r.remaining() != 0) {
+      throw std::runtime_error("Records: trailing bytes");
+    }
+    return rs;
+  }
+
+  // Either encoding.
+  static Records createFromString(const std::string& s) {
+    return isBinaryString(s) ? createFromBinaryString(s)
+                             : createFromJsonString(s);
+  }
+
+ private:
+  static constexpr char kBinaryMagic[4] = {'E', 'L', 'F', 'R'};
+  static constexpr uint8_t kBinaryVersion = 1;
+};
+
+// The states of the game threads of a client, sent between its Records
+// (see elf::shared::Writer::Heartbeat) so that the server sees it alive
+// and progressing in the middle of its games. Binary only: magic and
+// version, the number of states, then each state, all fixed-width.
+struct Heartbeat {
+  std::unordered_map<int, ThreadState> states;
+
+  std::string dumpBinaryString() const {
+    std::string s;
+    elf_utils::BinaryWriter w(&s);
+    w.putBytes(kMagic, sizeof(kMagic));
+    w.putByte(kVersion);
+    w.putFixed32(states.size());
+    for (const auto& t : states) {
+      t.second.writeFixed(w);
+    }
+    return s;
+  }
+
+  // Throws (a std::exception) on malformed input.
+  static Heartbeat createFromBinaryString(const std::string& s) {
+    elf_utils::BinaryReader r(s);
+    char magic[sizeof(kMagic)];
+    r.getBytes(magic, sizeof(magic));
+    if (memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        r.getByte() != kVersion) {
+      throw std::runtime_error("Heartbeat: bad magic or version");
+    }
+    const size_t num_states = r.getFixed32();
+    if (r.remaining() != num_states * ThreadState::kFixedSize) {
+      throw std::runtime_error("Heartbeat: wrong size");
+    }
+    Heartbeat hb;
+    for (size_t i = 0; i < num_states; ++i) {
+      ThreadState t = ThreadState::readFixed(r);
+      hb.states[t.thread_id] = t;
+    }
+    return hb;
+  }
+
+ private:
+  static constexpr char kMagic[4] = {'E', 'L', 'F', 'H'};
+  static constexpr uint8_t kVersion = 1;
 };
@@ -0,0 +1,252 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Size and encode/decode cost of a batch of self-play records, in json and
+// in the binary format (Records::dumpBinaryString), with full policies and
+// with only their top-k entries, each also compressed with zstd (see
+// elf::shared::Compressor), with and without a trained dictionary.
+//
+// Then end to end: num_messages batches streamed over inproc from a Writer
+// to a Reader decoding them, as from a self-play client to the server,
+// with the format and compression negotiated as they are. Reports the
+// throughput and the bytes on the wire.
+//
+// Games are synthetic (see randomRecord).
+//
+// Usage: record_bench [num_games] [rounds] [num_messages]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "elf/distributed/compression.h"
+#include "elf/distributed/shared_rw_buffer2.h"
+#include "elfgames/go/common/record.h"
+#include "elfgames/go/common/record_samples.h"
+
+template <typename F>
+static double msecPerCall(int rounds, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; ++i) {
+    f();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() /
+      rounds;
+}
+
+// Encodes rs with dump, then packs it if c is not null (with the
+// dictionary if it has one).
+static void report(
+    const char* name,
+    const Records& rs,
+    int rounds,
+    size_t json_size,
+    std::string (*dump)(const Records&),
+    elf::shared::Compressor* c = nullptr) {
+  std::string s;
+  double pack = 0, unpack = 0;
+  const double enc = msecPerCall(rounds, [&]() {
+    s = dump(rs);
+    if (c != nullptr) {
+      const auto start = std::chrono::steady_clock::now();
+      s = c->pack(s);
+      pack += std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    }
+  });
+  size_t n = 0;
+  const double dec = msecPerCall(rounds, [&]() {
+    std::string msg = s;
+    if (c != nullptr) {
+      const auto start = std::chrono::steady_clock::now();
+      msg = c->unpack(msg);
+      unpack += std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    }
+    n += Records::createFromString(msg).records.size();
+  });
+  printf(
+      "%-16s %9zu bytes (x%5.1f smaller), encode %8.2f ms, decode %8.2f ms",
+      name,
+      s.size(),
+      (double)json_size / s.size(),
+      enc,
+      dec);
+  if (c != nullptr) {
+    printf(" (pack %6.2f, unpack %6.2f)", pack / rounds, unpack / rounds);
+  }
+  printf("\n");
+}
+
+static std::string dumpJson(const Records& r) {
+  return r.dumpJsonString();
+}
+
+static std::string dumpBinary(const Records& r) {
+  return r.dumpBinaryString();
+}
+
+static std::string dumpBinaryTop16(const Records& r) {
+  return r.dumpBinaryString(16);
+}
+
+// Batches of one game, as dictionary training samples.
+static std::vector<std::string> samples(
+    std::mt19937& rng,
+    const MsgRequest& request,
+    int n,
+    std::string (*dump)(const Records&)) {
+  std::vector<std::string> out;
+  for (int i = 0; i < n; ++i) {
+    Records rs("bench-client");
+    rs.addRecord(randomRecord(rng, request));
+    out.push_back(dump(rs));
+  }
+  return out;
+}
+
+// Streams num_messages times rs from a Writer to a Reader over inproc, on
+// port. The Writer encodes each message, the Reader decodes it.
+static void transfer(
+    const char* name,
+    const Records& rs,
+    int num_messages,
+    int port,
+    const std::vector<std::string>& formats,
+    const std::string& compression) {
+  elf::shared::Options options;
+  options.transport = "inproc";
+  options.port = port;
+  options.identity = "bench";
+  options.formats = formats;
+  options.compression = compression;
+  options.stream_credits = 8;
+
+  std::atomic<int> num_processed{0};
+  std::atomic<int> num_games{0};
+  elf::shared::Reader reader("bench", options);
+  reader.startReceiving(
+      [&](elf::shared::Reader*, const std::string&, const std::string& msg) {
+        bool ok = true;
+        try {
+          num_games += Records::createFromString(msg).records.size();
+        } catch (const std::exception&) {
+          ok = false;
+        }
+        num_processed++;
+        return ok;
+      },
+      [](elf::shared::Reader*, const std::string&, std::string*) {
+        return true;
+      });
+
+  elf::shared::Writer writer(options);
+  writer.Ctrl("bench");
+  std::string reply;
+  // The reply to Ctrl comes after the answers to the negotiation.
+  while (!writer.getReplyNoblock(&reply)) {
+    writer.waitReply(100);
+  }
+  const bool binary = writer.format() == kRecordsBinaryFormat;
+
+  const auto start = std::chrono::steady_clock::now();
+  int sent = 0;
+  size_t content_size = 0;
+  while (num_processed < num_messages) {
+    while (writer.getReplyNoblock(&reply)) {
+    }
+    if (sent < num_messages && writer.credits() > 0) {
+      const std::string content =
+          binary ? rs.dumpBinaryString() : rs.dumpJsonString();
+      content_size = content.size();
+      writer.Insert(content);
+      sent++;
+    } else {
+      writer.waitReply(10);
+    }
+  }
+  const double sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+  const double wire = (double)writer.bytesSent() / num_messages;
+  printf(
+      "%-16s %8.1f msg/s, %9.1f games/s, %8.1f MB/s, %9.0f bytes/msg on "
+      "the wire (x%5.1f by compression)%s\n",
+      name,
+      num_messages / sec,
+      num_games / sec,
+      wire * num_messages / sec / 1e6,
+      wire,
+      content_size / wire,
+      num_games == num_messages * (int)rs.records.size() ? ""
+                                                          : ", LOST GAMES");
+}
+
+int main(int argc, char** argv) {
+  const int num_games = argc > 1 ? atoi(argv[1]) : 32;
+  const int rounds = argc > 2 ? atoi(argv[2]) : 5;
+  const int num_messages = argc > 3 ? atoi(argv[3]) : 20;
+
+  spdlog::set_level(spdlog::level::warn);
+
+  std::mt19937 rng(0);
+  MsgRequest request;
+  request.vers.black_ver = request.vers.white_ver = 1200;
+  Records rs("bench-client");
+  for (int i = 0; i < num_games; ++i) {
+    rs.addRecord(randomRecord(rng, request));
+    ThreadState ts;
+    ts.thread_id = i;
+    ts.seq = i;
+    rs.updateState(ts);
+  }
+
+  // Dictionaries trained on other games.
+  constexpr size_t kDictSize = 64 * 1024;
+  constexpr int kNumSamples = 64;
+  std::mt19937 train_rng(1);
+  elf::shared::Compressor zstd;
+  elf::shared::Compressor json_dict(
+      3,
+      elf::shared::Compressor::trainDictionary(
+          samples(train_rng, request, kNumSamples, dumpJson), kDictSize));
+  elf::shared::Compressor binary_dict(
+      3,
+      elf::shared::Compressor::trainDictionary(
+          samples(train_rng, request, kNumSamples, dumpBinary), kDictSize));
+
+  const size_t json_size = rs.dumpJsonString().size();
+  printf("%d games, %zu json bytes\n", num_games, json_size);
+  report("json", rs, rounds, json_size, dumpJson);
+  report("json zstd", rs, rounds, json_size, dumpJson, &zstd);
+  report("json zstd+dict", rs, rounds, json_size, dumpJson, &json_dict);
+  report("binary", rs, rounds, json_size, dumpBinary);
+  report("binary zstd", rs, rounds, json_size, dumpBinary, &zstd);
+  report("binary zstd+dict", rs, rounds, json_size, dumpBinary, &binary_dict);
+  report("binary top16", rs, rounds, json_size, dumpBinaryTop16);
+  report("binary top16 zstd", rs, rounds, json_size, dumpBinaryTop16, &zstd);
+
+  printf(
+      "%d messages of %d games, Writer to Reader over inproc\n",
+      num_messages,
+      num_games);
+  const std::vector<std::string> binary = {kRecordsBinaryFormat};
+  transfer("json", rs, num_messages, 5700, {}, "");
+  transfer("json zstd", rs, num_messages, 5701, {}, "zstd");
+  transfer("binary", rs, num_messages, 5702, binary, "");
+  transfer("binary zstd", rs, num_messages, 5703, binary, "zstd");
+  return 0;
+}
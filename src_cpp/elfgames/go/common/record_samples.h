@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <random>
+
+#include "../base/go_state.h"
+#include "../sgf/sgf.h"
+#include "record.h"
+
+// A synthetic self-play record, for benchmarks and load tests: random legal
+// moves with a pass at the end, and policies mimicking MCTS visit counts (a
+// few dozen visited moves, most visits on the move played).
+inline Record randomRecord(std::mt19937& rng, const MsgRequest& request) {
+  Record r;
+  r.request = request;
+  r.timestamp = 1530000000 + rng() % 100000;
+  r.thread_id = rng() % 64;
+  r.seq = rng() % 1000;
+
+  GoState s;
+  for (int i = 0; i < 10000 && s.getPly() < 250; ++i) {
+    Coord c = OFFSETXY(rng() % BOARD_SIZE, rng() % BOARD_SIZE);
+    if (s.checkMove(c))
+      s.forward(c);
+  }
+  s.forward(M_PASS);
+
+  for (Coord c : s.getAllMoves()) {
+    r.result.policies.emplace_back();
+    CoordRecord& p = r.result.policies.back();
+    std::fill(p.prob, p.prob + BOUND_COORD, 0);
+    const int visited = 16 + rng() % 32;
+    for (int k = 0; k < visited; ++k) {
+      const Coord v = OFFSETXY(rng() % BOARD_SIZE, rng() % BOARD_SIZE);
+      p.prob[v] = std::min(255, p.prob[v] + 1 + (int)(rng() % 8));
+    }
+    p.prob[c] = 128 + rng() % 128;
+    r.result.values.push_back((int)(rng() % 2001) / 1000.0 - 1.0);
+  }
+  r.result.num_move = s.getPly();
+  r.result.reward = rng() % 2 ? 1.0 : -1.0;
+  r.result.using_models = {request.vers.black_ver};
+  r.result.content = coords2sgfstr(s.getAllMoves());
+  return r;
+}
@@ -0,0 +1,242 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include "elfgames/go/common/record.h"
+#include "elfgames/go/sgf/sgf.h"
+
+namespace {
+
+MsgRequest makeRequest(int64_t black, int64_t white) {
+  MsgRequest request;
+  request.vers.black_ver = black;
+  request.vers.white_ver = white;
+  request.client_ctrl.black_resign_thres = 0.05;
+  request.client_ctrl.player_swap = true;
+  return request;
+}
+
+Record makeRecord(const MsgRequest& request, int seq, int num_move) {
+  Record r;
+  r.request = request;
+  r.timestamp = 1530000000 + seq;
+  r.thread_id = 3;
+  r.seq = seq;
+  r.pri = 0.5;
+  r.offline = seq % 2 == 1;
+
+  std::vector<Coord> moves;
+  for (int i = 0; i < num_move; ++i) {
+    moves.push_back(
+        i == num_move - 1 ? M_PASS : OFFSETXY(i % BOARD_SIZE, i / BOARD_SIZE));
+    r.result.policies.emplace_back();
+    CoordRecord& p = r.result.policies.back();
+    std::fill(p.prob, p.prob + BOUND_COORD, 0);
+    p.prob[moves.back()] = 200;
+    p.prob[OFFSETXY(0, 0)] += 30;
+    p.prob[OFFSETXY(1, 1)] += 20;
+    r.result.values.push_back(i * 0.01 - 0.5);
+  }
+  r.result.num_move = num_move;
+  r.result.reward = -1.0;
+  r.result.white_never_resign = true;
+  r.result.using_models = {request.vers.black_ver, request.vers.white_ver};
+  r.result.content = coords2sgfstr(moves);
+  return r;
+}
+
+Records makeRecords() {
+  Records rs("client-1");
+  ThreadState ts;
+  ts.thread_id = 3;
+  ts.seq = 7;
+  ts.move_idx = 12;
+  ts.black = 20;
+  ts.white = -1;
+  rs.updateState(ts);
+
+  const MsgRequest r1 = makeRequest(20, -1);
+  const MsgRequest r2 = makeRequest(20, 21);
+  rs.addRecord(makeRecord(r1, 0, 10));
+  rs.addRecord(makeRecord(r2, 1, 5));
+  rs.addRecord(makeRecord(r1, 2, 1));
+  return rs;
+}
+
+void expectSameResult(const MsgResult& a, const MsgResult& b) {
+  EXPECT_EQ(a.num_move, b.num_move);
+  EXPECT_EQ(a.reward, b.reward);
+  EXPECT_EQ(a.black_never_resign, b.black_never_resign);
+  EXPECT_EQ(a.white_never_resign, b.white_never_resign);
+  EXPECT_EQ(a.using_models, b.using_models);
+  EXPECT_EQ(a.content, b.content);
+  EXPECT_EQ(a.values, b.values);
+  ASSERT_EQ(a.policies.size(), b.policies.size());
+  for (size_t i = 0; i < a.policies.size(); ++i) {
+    for (int k = 0; k < BOUND_COORD; ++k) {
+      EXPECT_EQ(a.policies[i].prob[k], b.policies[i].prob[k]);
+    }
+  }
+}
+
+void expectSameRecords(const Records& a, const Records& b) {
+  EXPECT_EQ(a.identity, b.identity);
+  EXPECT_EQ(a.states, b.states);
+  ASSERT_EQ(a.records.size(), b.records.size());
+  for (size_t i = 0; i < a.records.size(); ++i) {
+    const Record& ra = a.records[i];
+    const Record& rb = b.records[i];
+    EXPECT_EQ(ra.request, rb.request);
+    EXPECT_EQ(ra.timestamp, rb.timestamp);
+    EXPECT_EQ(ra.thread_id, rb.thread_id);
+    EXPECT_EQ(ra.seq, rb.seq);
+    EXPECT_EQ(ra.pri, rb.pri);
+    EXPECT_EQ(ra.offline, rb.offline);
+    expectSameResult(ra.result, rb.result);
+  }
+}
+
+} // namespace
+
+TEST(RecordTest, testBinaryUtils) {
+  std::string s;
+  elf_utils::BinaryWriter w(&s);
+  w.putVarint(0);
+  w.putVarint(300);
+  w.putVarint(~0ULL);
+  w.putSignedVarint(-1);
+  w.putSignedVarint(-1234567890123LL);
+  w.putFloat(-0.25);
+  w.putFixed32(0xdeadbeef);
+  w.putFixed64(~1ULL);
+  w.putString("abc");
+  EXPECT_EQ(s.substr(0, 3), std::string("\x00\xac\x02", 3));
+
+  elf_utils::BinaryReader r(s);
+  EXPECT_EQ(r.getVarint(), 0u);
+  EXPECT_EQ(r.getVarint(), 300u);
+  EXPECT_EQ(r.getVarint(), ~0ULL);
+  EXPECT_EQ(r.getSignedVarint(), -1);
+  EXPECT_EQ(r.getSignedVarint(), -1234567890123LL);
+  EXPECT_EQ(r.getFloat(), -0.25);
+  EXPECT_EQ(r.getFixed32(), 0xdeadbeefu);
+  EXPECT_EQ(r.getFixed64(), ~1ULL);
+  EXPECT_EQ(r.getString(), "abc");
+  EXPECT_EQ(r.remaining(), 0u);
+  EXPECT_THROW(r.getByte(), std::runtime_error);
+}
+
+TEST(RecordTest, testBinaryRoundTrip) {
+  const Records rs = makeRecords();
+  const std::string s = rs.dumpBinaryString();
+  EXPECT_TRUE(Records::isBinaryString(s));
+  expectSameRecords(rs, Records::createFromBinaryString(s));
+
+  // Smaller than json, even on these short games.
+  EXPECT_LT(s.size() * 4, rs.dumpJsonString().size());
+
+  const Records empty("empty");
+  expectSameRecords(
+      empty, Records::createFromBinaryString(empty.dumpBinaryString()));
+}
+
+TEST(RecordTest, testBinaryContentFallback) {
+  // Content that coords2sgfstr would not produce is kept as is.
+  Records rs = makeRecords();
+  rs.records[0].result.content = "(;B[aa]C[comment];W[bb])";
+  rs.records[1].result.content = "";
+  rs.records[2].result.content = "(;W[aa])";
+  expectSameRecords(
+      rs, Records::createFromBinaryString(rs.dumpBinaryString()));
+}
+
+TEST(RecordTest, testBinaryDensePolicy) {
+  Records rs = makeRecords();
+  CoordRecord& p = rs.records[0].result.policies[0];
+  for (int k = 0; k < BOUND_COORD; ++k) {
+    p.prob[k] = k % 7 + 1;
+  }
+  expectSameRecords(
+      rs, Records::createFromBinaryString(rs.dumpBinaryString()));
+}
+
+TEST(RecordTest, testBinaryTopK) {
+  const Records rs = makeRecords();
+  const Records top =
+      Records::createFromBinaryString(rs.dumpBinaryString(/*top_k=*/2));
+  ASSERT_EQ(top.records.size(), rs.records.size());
+
+  // The third move has entries 200 (the move), 30 and 20.
+  const Coord c = OFFSETXY(2, 0);
+  const CoordRecord& p = top.records[0].result.policies[2];
+  int non_zero = 0;
+  for (int k = 0; k < BOUND_COORD; ++k) {
+    non_zero += p.prob[k] > 0;
+  }
+  EXPECT_EQ(non_zero, 2);
+  EXPECT_EQ(p.prob[c], 200);
+  EXPECT_EQ(p.prob[OFFSETXY(0, 0)], 30);
+  EXPECT_EQ(p.prob[OFFSETXY(1, 1)], 0);
+}
+
+TEST(RecordTest, testBinaryMalformed) {
+  const std::string s = makeRecords().dumpBinaryString();
+  // Every truncation is rejected.
+  for (size_t n = 0; n < s.size(); ++n) {
+    EXPECT_ANY_THROW(Records::createFromBinaryString(s.substr(0, n)));
+  }
+  EXPECT_ANY_THROW(Records::createFromBinaryString(s + "x"));
+
+  std::string bad_version = s;
+  bad_version[4] = 2;
+  EXPECT_ANY_THROW(Records::createFromBinaryString(bad_version));
+}
+
+TEST(RecordTest, testHeartbeat) {
+  Heartbeat hb;
+  for (int i = 0; i < 8; ++i) {
+    ThreadState& ts = hb.states[i];
+    ts.thread_id = i;
+    ts.seq = 1000 + i;
+    ts.move_idx = i * 30;
+    ts.black = 12345678901LL;
+    ts.white = i % 2 ? -1 : 17;
+  }
+  const std::string s = hb.dumpBinaryString();
+  // Fixed-size: a header and 28 bytes per thread.
+  EXPECT_EQ(s.size(), 9 + 8 * ThreadState::kFixedSize);
+  EXPECT_EQ(Heartbeat::createFromBinaryString(s).states, hb.states);
+  EXPECT_TRUE(
+      Heartbeat::createFromBinaryString(Heartbeat().dumpBinaryString())
+          .states.empty());
+
+  for (size_t n = 0; n < s.size(); ++n) {
+    EXPECT_ANY_THROW(Heartbeat::createFromBinaryString(s.substr(0, n)));
+  }
+  EXPECT_ANY_THROW(Heartbeat::createFromBinaryString(s + "x"));
+  // Records are not heartbeats.
+  EXPECT_ANY_THROW(
+      Heartbeat::createFromBinaryString(makeRecords().dumpBinaryString()));
+}
+
+TEST(RecordTest, testCreateFromString) {
+  const Records rs = makeRecords();
+  const std::string j = rs.dumpJsonString();
+  EXPECT_FALSE(Records::isBinaryString(j));
+  expectSameRecords(rs, Records::createFromString(j));
+  expectSameRecords(rs, Records::createFromString(rs.dumpBinaryString()));
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 
 #include "elf/ai/tree_search/mcts.h"
@@ -24,6 +26,9 @@ struct MCTSActorParams {
   int64_t required_version = -1;
   bool remove_pass_if_dangerous = true;
   bool rotation_flip = true;
+  // If > 1, every leaf is evaluated under this many distinct D4 symmetries
+  // (at most 8) in the same batch, and policy and value are averaged.
+  int num_symmetries = 1;
   float komi = 7.5;
 
   std::string info() const {
@@ -31,7 +36,8 @@ struct MCTSActorParams {
     ss << "[name=" << actor_name << "][ply_pass_enabled=" << ply_pass_enabled
        << "][seed=" << seed << "][requred_ver=" << required_version
        << "][remove_pass_if_dangerous=" << remove_pass_if_dangerous
-       << "][rotation_flip=" << rotation_flip << "][komi=" << komi << "]";
+       << "][rotation_flip=" << rotation_flip
+       << "][num_symmetries=" << num_symmetries << "][komi=" << komi << "]";
     return ss.str();
   }
 };
@@ -82,42 +88,22 @@ class MCTSActor {
     auto& resps = *p_resps;
 
     resps.resize(states.size());
-    std::vector<BoardFeature> sel_bfs;
-    std::vector<size_t> sel_indices;
+    std::vector<const GoState*> sel_states;
+    std::vector<NodeResponse*> sel_resps;
 
     for (size_t i = 0; i < states.size(); i++) {
       assert(states[i] != nullptr);
       PreEvalResult res = pre_evaluate(*states[i], &resps[i]);
       if (res == EVAL_NEED_NN) {
-        sel_bfs.push_back(get_extractor(*states[i]));
-        sel_indices.push_back(i);
+        sel_states.push_back(states[i]);
+        sel_resps.push_back(&resps[i]);
       }
     }
 
-    if (sel_bfs.empty())
+    if (sel_states.empty())
       return;
 
-    std::vector<GoReply> replies;
-    for (size_t i = 0; i < sel_bfs.size(); ++i) {
-      replies.emplace_back(sel_bfs[i]);
-    }
-
-    // Get all pointers.
-    std::vector<GoReply*> p_replies;
-    std::vector<const BoardFeature*> p_bfs;
-
-    for (size_t i = 0; i < sel_bfs.size(); ++i) {
-      p_bfs.push_back(&sel_bfs[i]);
-      p_replies.push_back(&replies[i]);
-    }
-
-    if (!ai_->act_batch(p_bfs, p_replies)) {
-      logger_->info("act unsuccessful! ");
-    } else {
-      for (size_t i = 0; i < sel_indices.size(); i++) {
-        post_nn_result(replies[i], &resps[sel_indices[i]]);
-      }
-    }
+    evaluate_nn(sel_states, sel_resps);
   }
 
   void evaluate(const GoState& s, NodeResponse* resp) {
@@ -128,7 +114,10 @@ class MCTSActor {
     // else res = EVAL_NEED_NN
     PreEvalResult res = pre_evaluate(s, resp);
 
-    if (res == EVAL_NEED_NN) {
+    if (res == EVAL_NEED_NN && num_symmetries() > 1) {
+      // All symmetries go out in one batch.
+      evaluate_nn({&s}, {resp});
+    } else if (res == EVAL_NEED_NN) {
       BoardFeature bf = get_extractor(s);
       // GoReply struct initialization
       // members containing:
@@ -172,6 +161,86 @@ class MCTSActor {
  private:
   std::shared_ptr<spdlog::logger> logger_;
 
+  int num_symmetries() const {
+    return std::min(std::max(params_.num_symmetries, 1), 8);
+  }
+
+  // Run the network on states that all need it and post the results.
+  // With num_symmetries() == k > 1, each state is sent as k differently
+  // transformed copies in the same act_batch, and the replies are averaged.
+  void evaluate_nn(
+      const std::vector<const GoState*>& states,
+      const std::vector<NodeResponse*>& resps) {
+    const size_t k = num_symmetries();
+
+    std::vector<BoardFeature> bfs;
+    bfs.reserve(states.size() * k);
+    for (const GoState* s : states) {
+      if (k == 1) {
+        bfs.push_back(get_extractor(*s));
+        continue;
+      }
+      // Distinct codes, a random subset of them if k < 8.
+      std::array<int, 8> codes = {0, 1, 2, 3, 4, 5, 6, 7};
+      if (k < codes.size())
+        std::shuffle(codes.begin(), codes.end(), rng_);
+      for (size_t j = 0; j < k; ++j) {
+        bfs.emplace_back(*s);
+        bfs.back().setD4Code(codes[j]);
+      }
+    }
+
+    std::vector<GoReply> replies;
+    replies.reserve(bfs.size());
+    for (size_t i = 0; i < bfs.size(); ++i) {
+      replies.emplace_back(bfs[i]);
+    }
+
+    // Get all pointers.
+    std::vector<GoReply*> p_replies;
+    std::vector<const BoardFeature*> p_bfs;
+
+    for (size_t i = 0; i < bfs.size(); ++i) {
+      p_bfs.push_back(&bfs[i]);
+      p_replies.push_back(&replies[i]);
+    }
+
+    if (!ai_->act_batch(p_bfs, p_replies)) {
+      logger_->info("act unsuccessful! ");
+      return;
+    }
+
+    for (size_t i = 0; i < states.size(); i++) {
+      if (k == 1) {
+        post_nn_result(replies[i], resps[i]);
+      } else {
+        // Averaged in the untransformed frame.
+        BoardFeature bf(*states[i]);
+        GoReply reply(bf);
+        average_replies(&replies[i * k], k, &reply);
+        post_nn_result(reply, resps[i]);
+      }
+    }
+  }
+
+  // Map each reply's pi back through its inverse transform into avg (whose
+  // extractor is the identity), then average pi and value.
+  static void
+  average_replies(const GoReply* replies, size_t k, GoReply* avg) {
+    std::fill(avg->pi.begin(), avg->pi.end(), 0.0);
+    avg->value = 0.0;
+    avg->version = replies[0].version;
+    for (size_t j = 0; j < k; ++j) {
+      const GoReply& r = replies[j];
+      assert(r.version == avg->version);
+      for (size_t a = 0; a < r.pi.size(); ++a) {
+        const int64_t action = avg->bf.coord2Action(r.bf.action2Coord(a));
+        avg->pi[action] += r.pi[a] / k;
+      }
+      avg->value += r.value / k;
+    }
+  }
+
   BoardFeature get_extractor(const GoState& s) {
     // RandomShuffle: static
     // All extractor will go through a
@@ -7,6 +7,7 @@
  */
 
 #pragma once
+#include <algorithm>
 #include <atomic>
 #include "../common/record.h"
 #include "elf/logging/IndexedLoggerFactory.h"
@@ -66,6 +67,12 @@ struct ClientInfo {
     return active_;
   }
 
+  // When the client is considered dead without further state updates.
+  uint64_t deadline() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_update_ + max_delay_sec_;
+  }
+
   bool IsStuck(uint64_t curr_timestamp, uint64_t* delay = nullptr) const {
     std::lock_guard<std::mutex> lock(mutex_);
     auto last_delay = curr_timestamp - last_update_;
@@ -99,6 +106,15 @@ struct ClientInfo {
   std::vector<std::unique_ptr<State>> threads_;
 };
 
+// Clients are split in num_shards shards by identity (as the ingest shards
+// of the server, see elf_utils::consistent_shard), each with its own lock:
+// a message only locks the shard of its sender, and the counts of client
+// types when it changes them.
+//
+// Each message costs O(1): the counts of client types are kept up to date
+// as clients are allocated, die and come back, and the liveness of the
+// other clients of a shard is checked by a timer wheel, which only visits
+// the clients whose deadline (ClientInfo::deadline) may have passed.
 class ClientManager {
  public:
   ClientManager(
@@ -107,7 +123,8 @@ class ClientManager {
       int num_expected_clients,
       float selfplay_only_ratio = 0.6,
       int max_num_eval = -1,
-      std::function<uint64_t()> timer = elf_utils::sec_since_epoch_from_now)
+      std::function<uint64_t()> timer = elf_utils::sec_since_epoch_from_now,
+      int num_shards = 1)
       : selfplay_only_ratio_(selfplay_only_ratio),
         num_expected_clients_(num_expected_clients),
         max_num_eval_(max_num_eval),
@@ -118,6 +135,10 @@ class ClientManager {
             "elfgames::go::train::ClientManager-",
             "")) {
     assert(timer_ != nullptr);
+    for (int i = 0; i < std::max(num_shards, 1); ++i) {
+      shards_.emplace_back(new Shard);
+      shards_.back()->last_update = getCurrTimeStamp();
+    }
   }
 
   void setSelfplayOnlyRatio(float ratio) {
@@ -128,31 +149,40 @@ class ClientManager {
   const ClientInfo& updateStates(
       const std::string& identity,
       const std::unordered_map<int, ThreadState>& states) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ClientInfo& info = _getClient(identity);
+    Shard& shard = shardOf(identity);
+    updateIdleShards(&shard);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Client& c = _getClientEntry(shard, identity);
+    ClientInfo& info = *c.info;
 
     for (const auto& s : states) {
       info.stateUpdate(s.second);
     }
 
     // A client is considered dead after 20 min.
-    updateClients();
+    std::vector<std::string> newly_dead, newly_alive;
+    onUpdate(shard, c, &newly_dead, &newly_alive);
+    advanceWheel(shard, &newly_dead, &newly_alive);
+    logChanges(newly_dead, newly_alive);
     return info;
   }
 
   const ClientInfo* getClientC(const std::string& identity) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = clients_.find(identity);
-    if (it != clients_.end()) {
-      return it->second.get();
+    const Shard& shard = shardOf(identity);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.clients.find(identity);
+    if (it != shard.clients.end()) {
+      return it->second.info.get();
     } else {
       return nullptr;
     }
   }
 
   ClientInfo& getClient(const std::string& identity) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return _getClient(identity);
+    Shard& shard = shardOf(identity);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return *_getClientEntry(shard, identity).info;
   }
 
   size_t getNumEval() const {
@@ -160,6 +190,11 @@ class ClientManager {
     return num_eval_then_selfplay_;
   }
 
+  size_t getNumSelfplayOnly() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_selfplay_only_;
+  }
+
   size_t getExpectedNumEval() const {
     std::lock_guard<std::mutex> lock(mutex_);
     if (num_expected_clients_ > 0) {
@@ -187,13 +222,44 @@ class ClientManager {
 
   std::function<uint64_t()> timer_ = nullptr;
 
+  struct Client {
+    std::unique_ptr<ClientInfo> info;
+    // Whether the client has an entry in the timer wheel of its shard (at
+    // most one, for its deadline when it was added).
+    bool in_wheel = false;
+  };
+
+  // Seconds covered by a timer wheel. Clients with a later deadline are
+  // visited once per turn of the wheel, and put back.
+  static constexpr uint64_t kWheelSlots = 256;
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Client> clients;
+    // The alive clients, in the slot of their deadline (mod kWheelSlots).
+    std::vector<std::vector<Client*>> wheel{kWheelSlots};
+    // When the liveness of its clients was last updated (the wheel has
+    // been advanced up to it).
+    std::atomic<uint64_t> last_update{0};
+  };
+
+  // A shard without messages still updates the liveness of its clients
+  // that often, from the messages of other shards.
+  static constexpr uint64_t kIdleShardUpdateSec = 10;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  // Guards the counts of client types (taken after the lock of a shard).
   mutable std::mutex mutex_;
-  std::unordered_map<std::string, std::unique_ptr<ClientInfo>> clients_;
   int num_selfplay_only_ = 0;
   int num_eval_then_selfplay_ = 0;
 
   std::shared_ptr<spdlog::logger> logger_;
 
+  Shard& shardOf(const std::string& identity) const {
+    return *shards_[elf_utils::consistent_shard(identity, shards_.size())];
+  }
+
   std::string _info() const {
     std::stringstream ss;
     int n = num_selfplay_only_ + num_eval_then_selfplay_;
@@ -232,23 +298,65 @@ class ClientManager {
       num_selfplay_only_--;
   }
 
-  void updateClients() {
-    std::vector<std::string> newly_dead;
-    std::vector<std::string> newly_alive;
+  // Needs the lock of shard.
+  void schedule(Shard& shard, Client& c) {
+    if (!c.in_wheel) {
+      c.in_wheel = true;
+      shard.wheel[c.info->deadline() % kWheelSlots].push_back(&c);
+    }
+  }
 
-    for (auto& p : clients_) {
-      auto& c = *p.second;
-      auto status = c.updateActive();
-      if (status == ClientInfo::ALIVE2DEAD) {
-        newly_dead.push_back(p.first);
-        dealloc_type(c.type());
-      } else if (status == ClientInfo::DEAD2ALIVE) {
-        newly_alive.push_back(p.first);
-        c.set_type(alloc_type());
+  // Applies the change of liveness of c, if any. Needs the lock of shard.
+  void onUpdate(
+      Shard& shard,
+      Client& c,
+      std::vector<std::string>* newly_dead,
+      std::vector<std::string>* newly_alive) {
+    ClientInfo& info = *c.info;
+    const auto status = info.updateActive();
+    if (status == ClientInfo::ALIVE2DEAD) {
+      newly_dead->push_back(info.id());
+      std::lock_guard<std::mutex> lock(mutex_);
+      dealloc_type(info.type());
+    } else if (status == ClientInfo::DEAD2ALIVE) {
+      newly_alive->push_back(info.id());
+      std::lock_guard<std::mutex> lock(mutex_);
+      info.set_type(alloc_type());
+    }
+    if (info.IsActive()) {
+      schedule(shard, c);
+    }
+  }
+
+  // Visits the clients in the slots of the seconds since the last update
+  // of shard. Needs its lock.
+  void advanceWheel(
+      Shard& shard,
+      std::vector<std::string>* newly_dead,
+      std::vector<std::string>* newly_alive) {
+    const uint64_t now = getCurrTimeStamp();
+    const uint64_t last = shard.last_update;
+    if (now <= last) {
+      return;
+    }
+    shard.last_update = now;
+
+    const uint64_t n = std::min(now - last, kWheelSlots);
+    for (uint64_t t = now - n + 1; t <= now; ++t) {
+      std::vector<Client*> due;
+      due.swap(shard.wheel[t % kWheelSlots]);
+      for (Client* c : due) {
+        c->in_wheel = false;
+        onUpdate(shard, *c, newly_dead, newly_alive);
       }
     }
+  }
 
+  void logChanges(
+      const std::vector<std::string>& newly_dead,
+      const std::vector<std::string>& newly_alive) {
     if (!newly_dead.empty() || !newly_alive.empty()) {
+      std::lock_guard<std::mutex> lock(mutex_);
       logger_->info(
           "{} Client newly dead: {}, newly alive: {}, {}",
           getCurrTimeStamp(),
@@ -264,15 +372,39 @@ class ClientManager {
     }
   }
 
-  ClientInfo& _getClient(const std::string& identity) {
-    auto it = clients_.find(identity);
-    if (it != clients_.end())
-      return *it->second;
+  // Other shards than current, not updated for a while (and not busy).
+  void updateIdleShards(const Shard* current) {
+    if (shards_.size() == 1) {
+      return;
+    }
+    const uint64_t now = getCurrTimeStamp();
+    for (auto& s : shards_) {
+      if (s.get() == current || now - s->last_update < kIdleShardUpdateSec) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(s->mutex, std::try_to_lock);
+      if (lock.owns_lock()) {
+        std::vector<std::string> newly_dead, newly_alive;
+        advanceWheel(*s, &newly_dead, &newly_alive);
+        logChanges(newly_dead, newly_alive);
+      }
+    }
+  }
+
+  // Needs the lock of shard.
+  Client& _getClientEntry(Shard& shard, const std::string& identity) {
+    auto it = shard.clients.find(identity);
+    if (it != shard.clients.end())
+      return it->second;
 
-    auto& e = clients_[identity];
-    e.reset(new ClientInfo(
+    Client& c = shard.clients[identity];
+    c.info.reset(new ClientInfo(
         *this, identity, max_num_threads_, max_client_delay_sec_));
-    e->set_type(alloc_type());
-    return *e;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      c.info->set_type(alloc_type());
+    }
+    schedule(shard, c);
+    return c;
   }
 };
@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Cost of ClientManager::updateStates, the bookkeeping of the server for
+// each message, with num_clients simulated clients sending their thread
+// states from num_threads threads.
+//
+// Time is simulated: each client sends a message every kSendIntervalSec,
+// and one client in kFlakyEvery stops for 2 * kMaxDelaySec now and then,
+// so that clients die and come back.
+//
+// Usage: client_manager_bench [num_clients] [num_messages] [num_shards]
+//                             [num_threads]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "elfgames/go/train/client_manager.h"
+
+static constexpr int kGameThreads = 8;
+static constexpr uint64_t kMaxDelaySec = 60;
+static constexpr uint64_t kSendIntervalSec = 10;
+static constexpr int kFlakyEvery = 100;
+
+int main(int argc, char** argv) {
+  const int num_clients = argc > 1 ? atoi(argv[1]) : 10000;
+  const int64_t num_messages = argc > 2 ? atoll(argv[2]) : 2000000;
+  const int num_shards = argc > 3 ? atoi(argv[3]) : 1;
+  const int num_threads = argc > 4 ? atoi(argv[4]) : 1;
+
+  // Flaky clients dying is expected.
+  spdlog::set_level(spdlog::level::err);
+
+  // A simulated second passes every messages_per_sec messages.
+  const int64_t messages_per_sec =
+      std::max<int64_t>(num_clients / kSendIntervalSec, 1);
+  std::atomic<int64_t> sent{0};
+  auto timer = [&]() { return 1000 + sent / messages_per_sec; };
+
+  ClientManager mgr(
+      kGameThreads, kMaxDelaySec, -1, 0.6, -1, timer, num_shards);
+
+  std::vector<std::string> ids;
+  for (int i = 0; i < num_clients; ++i) {
+    ids.push_back("client-" + std::to_string(i));
+  }
+
+  auto run = [&](int k) {
+    std::unordered_map<int, ThreadState> states;
+    int64_t n = 0;
+    for (int i = k;; i += num_threads) {
+      const int c = i % num_clients;
+      const uint64_t now = timer();
+      // Flaky clients are away one period of 4 * kMaxDelaySec in two.
+      if (c % kFlakyEvery == 0 && (now / (4 * kMaxDelaySec)) % 2 == 1) {
+        continue;
+      }
+      if (sent++ >= num_messages) {
+        break;
+      }
+      states.clear();
+      ThreadState& ts = states[n % kGameThreads];
+      ts.thread_id = n % kGameThreads;
+      ts.seq = i / num_clients;
+      ts.move_idx = n;
+      mgr.updateStates(ids[c], states);
+      n++;
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int k = 0; k < num_threads; ++k) {
+    threads.emplace_back(run, k);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  const double sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+  printf(
+      "%d clients, %d shards, %d threads: %ld messages (%lu simulated s) in "
+      "%.2f s, %.2f us/msg, %.0f msg/s\n",
+      num_clients,
+      num_shards,
+      num_threads,
+      (long)num_messages,
+      (unsigned long)(timer() - 1000),
+      sec,
+      sec * 1e6 / num_messages,
+      num_messages / sec);
+  printf("%s\n", mgr.info().c_str());
+  return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "elfgames/go/train/client_manager.h"
+
+namespace {
+
+constexpr int kNumThreads = 2;
+
+// ClientManager on a fake clock, with each client sending a new state of
+// its thread 0 (so that it counts as progress) at will.
+class ClientManagerTest : public ::testing::Test {
+ protected:
+  uint64_t now_ = 1000;
+  std::unordered_map<std::string, int> seqs_;
+
+  std::unique_ptr<ClientManager> create(
+      uint64_t max_delay_sec,
+      int num_shards = 1) {
+    return std::unique_ptr<ClientManager>(new ClientManager(
+        kNumThreads,
+        max_delay_sec,
+        -1,
+        0.5,
+        -1,
+        [this]() { return now_; },
+        num_shards));
+  }
+
+  void update(ClientManager& mgr, const std::string& id) {
+    ThreadState ts;
+    ts.thread_id = 0;
+    ts.seq = ++seqs_[id];
+    mgr.updateStates(id, {{0, ts}});
+  }
+
+  // Someone else's message, which advances the wheel.
+  void tick(ClientManager& mgr) {
+    update(mgr, "ticker");
+  }
+
+  static bool alive(const ClientManager& mgr, const std::string& id) {
+    const ClientInfo* info = mgr.getClientC(id);
+    return info != nullptr && info->IsActive();
+  }
+
+  // The counts of types match those of the alive clients.
+  static void expectCounts(
+      const ClientManager& mgr,
+      const std::vector<std::string>& ids) {
+    size_t eval = 0, selfplay = 0;
+    for (const auto& id : ids) {
+      if (alive(mgr, id)) {
+        const ClientType t = mgr.getClientC(id)->type();
+        eval += t == CLIENT_EVAL_THEN_SELFPLAY;
+        selfplay += t == CLIENT_SELFPLAY_ONLY;
+      }
+    }
+    EXPECT_EQ(mgr.getNumEval(), eval);
+    EXPECT_EQ(mgr.getNumSelfplayOnly(), selfplay);
+  }
+};
+
+} // namespace
+
+TEST_F(ClientManagerTest, ExpiresAfterMaxDelay) {
+  auto mgr = create(60);
+  update(*mgr, "a");
+  const uint64_t t0 = now_;
+
+  for (now_ = t0 + 1; now_ < t0 + 60; ++now_) {
+    tick(*mgr);
+    ASSERT_TRUE(alive(*mgr, "a")) << now_ - t0;
+  }
+  now_ = t0 + 60;
+  tick(*mgr);
+  EXPECT_FALSE(alive(*mgr, "a"));
+  EXPECT_TRUE(alive(*mgr, "ticker"));
+  expectCounts(*mgr, {"a", "ticker"});
+}
+
+TEST_F(ClientManagerTest, AliveAgainAfterNewState) {
+  auto mgr = create(60);
+  update(*mgr, "a");
+  now_ += 100;
+  tick(*mgr);
+  ASSERT_FALSE(alive(*mgr, "a"));
+  expectCounts(*mgr, {"a", "ticker"});
+
+  now_ += 1;
+  update(*mgr, "a");
+  EXPECT_TRUE(alive(*mgr, "a"));
+  expectCounts(*mgr, {"a", "ticker"});
+
+  // And the wheel has it again: it dies once more without updates.
+  now_ += 59;
+  tick(*mgr);
+  EXPECT_TRUE(alive(*mgr, "a"));
+  now_ += 1;
+  tick(*mgr);
+  EXPECT_FALSE(alive(*mgr, "a"));
+  expectCounts(*mgr, {"a", "ticker"});
+}
+
+TEST_F(ClientManagerTest, DeadlinesBeyondTheWheel) {
+  // Deadlines several turns of the wheel ahead.
+  const uint64_t kMaxDelay = 1000;
+  auto mgr = create(kMaxDelay);
+  update(*mgr, "a");
+  const uint64_t t0 = now_;
+  now_ += 300;
+  update(*mgr, "b");
+  const uint64_t t1 = now_;
+
+  for (now_ = t1 + 1; now_ < t0 + kMaxDelay; ++now_) {
+    tick(*mgr);
+    ASSERT_TRUE(alive(*mgr, "a")) << now_ - t0;
+  }
+  now_ = t0 + kMaxDelay;
+  tick(*mgr);
+  EXPECT_FALSE(alive(*mgr, "a"));
+  EXPECT_TRUE(alive(*mgr, "b"));
+
+  // Jumps of more than a turn visit every slot.
+  now_ = t1 + kMaxDelay - 1;
+  tick(*mgr);
+  EXPECT_TRUE(alive(*mgr, "b"));
+  now_ = t1 + 2 * kMaxDelay;
+  update(*mgr, "c");
+  EXPECT_FALSE(alive(*mgr, "b"));
+  EXPECT_FALSE(alive(*mgr, "ticker"));
+  expectCounts(*mgr, {"a", "b", "c", "ticker"});
+}
+
+TEST_F(ClientManagerTest, CountsWithShards) {
+  auto mgr = create(60, 4);
+  std::vector<std::string> ids;
+  for (int i = 0; i < 40; ++i) {
+    ids.push_back("client-" + std::to_string(i));
+    update(*mgr, ids.back());
+  }
+  expectCounts(*mgr, ids);
+  EXPECT_EQ(mgr->getNumEval() + mgr->getNumSelfplayOnly(), ids.size());
+
+  // Half of them stop; every shard gets a message after their deadline.
+  for (uint64_t t = 0; t < 61; t += 10) {
+    now_ += 10;
+    for (size_t i = 0; i < ids.size(); i += 2) {
+      update(*mgr, ids[i]);
+    }
+  }
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(alive(*mgr, ids[i]), i % 2 == 0) << ids[i];
+  }
+  expectCounts(*mgr, ids);
+  EXPECT_EQ(mgr->getNumEval() + mgr->getNumSelfplayOnly(), ids.size() / 2);
+
+  // They come back.
+  now_ += 1;
+  for (size_t i = 1; i < ids.size(); i += 2) {
+    update(*mgr, ids[i]);
+  }
+  for (const auto& id : ids) {
+    EXPECT_TRUE(alive(*mgr, id)) << id;
+  }
+  expectCounts(*mgr, ids);
+  EXPECT_EQ(mgr->getNumEval() + mgr->getNumSelfplayOnly(), ids.size());
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -8,7 +8,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
 #include "../common/record.h"
+#include "elf/concurrency/Counter.h"
 #include "elf/distributed/shared_reader.h"
 #include "elf/distributed/shared_rw_buffer2.h"
 
@@ -53,8 +58,17 @@ class DataInterface {
       const std::string& identity,
       const std::string& msg) = 0;
   virtual bool OnReply(const std::string& identity, std::string* msg) = 0;
+  // A Heartbeat, in binary.
+  virtual void OnHeartbeat(
+      const std::string& identity,
+      const std::string& msg) {
+    (void)identity;
+    (void)msg;
+  }
 };
 
+// One Reader per ingest shard (see elf::shared::Options::num_shards), all
+// feeding the same DataInterface.
 class DataOnlineLoader {
  public:
   DataOnlineLoader(const elf::shared::Options& net_options)
@@ -62,10 +76,17 @@ class DataOnlineLoader {
             "elfgames::go::train::DataOnlineLoader-",
             "")) {
     auto curr_timestamp = time(NULL);
-    const std::string database_name =
-        "data-" + std::to_string(curr_timestamp) + ".db";
-    reader_.reset(new elf::shared::Reader(database_name, net_options));
-    logger_->info(reader_->info());
+    for (int i = 0; i < std::max(net_options.num_shards, 1); ++i) {
+      elf::shared::Options shard_options = net_options;
+      shard_options.port += i;
+      std::string database_name = "data-" + std::to_string(curr_timestamp);
+      if (i > 0) {
+        database_name += "-" + std::to_string(i);
+      }
+      readers_.emplace_back(
+          new elf::shared::Reader(database_name + ".db", shard_options));
+      logger_->info(readers_.back()->info());
+    }
   }
 
   void start(DataInterface* interface) {
@@ -87,7 +108,8 @@ class DataOnlineLoader {
         }
         return info.success;
       } catch (...) {
-        logger_->error("Data malformed! String is {}", msg);
+        logger_->error(
+            "Data malformed from {}! {}", identity, describePayload(msg));
         return false;
       }
     };
@@ -105,20 +127,71 @@ class DataOnlineLoader {
             "Replier: about to send: recipient {}; msg {}; reader {}",
             identity,
             *msg,
-            reader_->info());
+            reader->info());
       }
       return true;
     };
 
-    reader_->startReceiving(
-        proc_func, replier_func, [interface]() { interface->OnStart(); });
+    auto heartbeat_func = [&, interface](
+                              elf::shared::Reader* reader,
+                              const std::string& identity,
+                              const std::string& msg) {
+      (void)reader;
+
+      try {
+        interface->OnHeartbeat(identity, msg);
+      } catch (const std::exception& e) {
+        logger_->warn("Malformed heartbeat from {}: {}", identity, e.what());
+      }
+    };
+
+    // OnStart is called once, before any message of any shard.
+    for (size_t i = 0; i < readers_.size(); ++i) {
+      elf::shared::Reader::StartFunc start_func;
+      if (i == 0) {
+        start_func = [this, interface]() {
+          interface->OnStart();
+          started_.set(true);
+        };
+      } else {
+        start_func = [this]() { started_.waitUntilTrue(); };
+      }
+      readers_[i]->startReceiving(
+          proc_func, replier_func, start_func, heartbeat_func);
+    }
+  }
+
+  // Over all shards.
+  int numHeartbeats() const {
+    int n = 0;
+    for (const auto& reader : readers_) {
+      n += reader->numHeartbeats();
+    }
+    return n;
   }
 
   ~DataOnlineLoader() {}
 
  private:
-  std::unique_ptr<elf::shared::Reader> reader_;
+  std::vector<std::unique_ptr<elf::shared::Reader>> readers_;
+  elf::concurrency::Switch started_;
   Stats stats_;
 
   std::shared_ptr<spdlog::logger> logger_;
+
+  // The size and first bytes of msg, in hex: it is often binary (records
+  // or zstd frames).
+  static std::string describePayload(const std::string& msg) {
+    constexpr size_t kMaxBytes = 16;
+    std::string s = std::to_string(msg.size()) + " bytes:";
+    char buf[4];
+    for (size_t i = 0; i < std::min(msg.size(), kMaxBytes); ++i) {
+      snprintf(buf, sizeof(buf), " %02x", (unsigned char)msg[i]);
+      s += buf;
+    }
+    if (msg.size() > kMaxBytes) {
+      s += " ...";
+    }
+    return s;
+  }
 };
@@ -18,9 +18,18 @@ inline elf::shared::Options getNetOptions(
   netOptions.addr =
       options.server_addr == "" ? "localhost" : options.server_addr;
   netOptions.port = options.port;
+  netOptions.transport = options.transport;
   netOptions.use_ipv6 = true;
   netOptions.verbose = options.verbose;
   netOptions.identity = contextOptions.job_id;
+  // Self-play records go out in binary once both ends agree on it.
+  netOptions.formats = {kRecordsBinaryFormat};
+  netOptions.compression = options.compression;
+  netOptions.compression_dict = options.compression_dict;
+  netOptions.num_decode_workers = options.num_decode_workers;
+  netOptions.stream_credits = options.stream_credits;
+  netOptions.num_shards = options.num_ingest_shards;
+  netOptions.heartbeat_sec = options.heartbeat_sec;
 
   return netOptions;
 }
@@ -7,6 +7,25 @@
 
 using ThreadedCtrlBase = elf::ThreadedCtrlBase;
 
+// Content for the server, from GameNotifier: the records of the games
+// finished since the last call, and the states of the game threads.
+struct RecordsContent {
+  // If set, nothing is dumped unless a game has finished.
+  bool skip_empty = false;
+  int num_records = 0;
+  std::string content;
+};
+
+// A Heartbeat for the server, from GameNotifier: the current states of the
+// game threads.
+struct HeartbeatContent {
+  std::string content;
+};
+
+// Sends the records to the server. When the server agrees to stream (see
+// elf::shared::Options::stream_credits), games are sent as soon as they
+// finish and there is a credit left, otherwise one batch per reply. In
+// between, it sends heartbeats if the server has agreed to.
 class ThreadedWriterCtrl : public ThreadedCtrlBase {
  public:
   ThreadedWriterCtrl(
@@ -33,13 +52,25 @@ class ThreadedWriterCtrl : public ThreadedCtrlBase {
     return writer_->identity();
   }
 
+  // Whether the server takes records in binary (see Records).
+  bool binaryRecords() const {
+    return writer_->format() == kRecordsBinaryFormat;
+  }
+
  protected:
   std::unique_ptr<elf::shared::Writer> writer_;
   int64_t seq_ = 0;
   uint64_t ts_since_last_sent_ = elf_utils::sec_since_epoch_from_now();
+  uint64_t ts_last_reply_ = elf_utils::sec_since_epoch_from_now();
+  uint64_t ts_last_heartbeat_ = elf_utils::sec_since_epoch_from_now();
   std::shared_ptr<spdlog::logger> logger_;
 
   static constexpr uint64_t kMaxSecSinceLastSent = 900;
+  // When streaming: how long to wait for a reply before looking for
+  // finished games again, and how often to send (maybe empty) content
+  // anyway, to get the current request of the server.
+  static constexpr long kStreamPollMs = 100;
+  static constexpr uint64_t kStreamKeepAliveSec = 30;
 
   void on_thread() {
     std::string smsg;
@@ -48,6 +79,18 @@ class ThreadedWriterCtrl : public ThreadedCtrlBase {
 
     // Will block..
     if (!writer_->getReplyNoblock(&smsg)) {
+      if (writer_->streaming()) {
+        stream(now);
+        return;
+      }
+      if (writer_->negotiating() &&
+          now - ts_since_last_sent_ < kMaxSecSinceLastSent) {
+        // The server may yet agree to stream: poll as if streaming, so
+        // that the first credits are used right away.
+        heartbeat(now);
+        writer_->waitReply(kStreamPollMs);
+        return;
+      }
       logger_->info(
           "{}, WriterCtrl: no message, seq={}, since_last_sec={}",
           elf_utils::now(),
@@ -57,7 +100,7 @@ class ThreadedWriterCtrl : public ThreadedCtrlBase {
       // 900s = 15min
       if (now - ts_since_last_sent_ < kMaxSecSinceLastSent) {
         logger_->info("Sleep for 10 sec .. ");
-        std::this_thread::sleep_for(std::chrono::seconds(10));
+        sleepSec(10);
       } else {
         logger_->warn(
             "No reply for too long ({}>{} sec), resending",
@@ -79,8 +122,70 @@ class ThreadedWriterCtrl : public ThreadedCtrlBase {
     MsgRequestSeq msg = MsgRequestSeq::createFromJson(j);
 
     ctrl_.sendMail("dispatcher", msg.request);
+    ts_last_reply_ = now;
+
+    if (writer_->streaming()) {
+      // Replies come once per message in flight, not in lockstep.
+      seq_ = msg.seq + 1;
+      stream(now);
+    } else {
+      getContentAndSend(msg.seq, msg.request.vers.wait());
+    }
+  }
+
+  void stream(uint64_t now) {
+    if (writer_->credits() > 0) {
+      RecordsContent content;
+      content.skip_empty = now - ts_since_last_sent_ < kStreamKeepAliveSec;
+      ctrl_.call(content);
+      if (!content.content.empty()) {
+        writer_->Insert(content.content);
+        ts_since_last_sent_ = now;
+        ts_last_heartbeat_ = now;
+      }
+    } else if (now - ts_last_reply_ >= kMaxSecSinceLastSent) {
+      // Our messages or the credits may have been lost (e.g. the server
+      // restarted): start over.
+      logger_->warn(
+          "No credit and no reply for too long ({}>{} sec), reconnecting",
+          now - ts_last_reply_,
+          kMaxSecSinceLastSent);
+      writer_->Ctrl(std::to_string(time(NULL)));
+      ts_last_reply_ = now;
+      ts_since_last_sent_ = now;
+    }
+    heartbeat(now);
+    writer_->waitReply(kStreamPollMs);
+  }
+
+  // Sends a heartbeat if one is due (content has the states as well).
+  void heartbeat(uint64_t now) {
+    const int sec = writer_->heartbeatSec();
+    if (sec <= 0 || now - ts_last_heartbeat_ < (uint64_t)sec) {
+      return;
+    }
+    HeartbeatContent hb;
+    ctrl_.call(hb);
+    writer_->Heartbeat(hb.content);
+    ts_last_heartbeat_ = now;
+  }
 
-    getContentAndSend(msg.seq, msg.request.vers.wait());
+  // Sleeps, still sending heartbeats.
+  void sleepSec(int sec) {
+    const auto end =
+        std::chrono::steady_clock::now() + std::chrono::seconds(sec);
+    while (true) {
+      heartbeat(elf_utils::sec_since_epoch_from_now());
+      const auto left = end - std::chrono::steady_clock::now();
+      if (left <= std::chrono::steady_clock::duration::zero()) {
+        return;
+      }
+      const int hb_sec = writer_->heartbeatSec();
+      std::this_thread::sleep_for(
+          hb_sec > 0 ? std::min<std::chrono::steady_clock::duration>(
+                           left, std::chrono::seconds(hb_sec))
+                     : left);
+    }
   }
 
   void getContentAndSend(int64_t msg_seq, bool iswait) {
@@ -91,19 +196,20 @@ class ThreadedWriterCtrl : public ThreadedCtrlBase {
           seq_);
     }
 
-    std::pair<int, std::string> content;
+    RecordsContent content;
     ctrl_.call(content);
 
     if (iswait) {
-      std::this_thread::sleep_for(std::chrono::seconds(30));
+      sleepSec(30);
     } else {
-      if (content.first == 0)
-        std::this_thread::sleep_for(std::chrono::seconds(60));
+      if (content.num_records == 0)
+        sleepSec(60);
     }
 
-    writer_->Insert(content.second);
+    writer_->Insert(content.content);
     seq_ = msg_seq + 1;
     ts_since_last_sent_ = elf_utils::sec_since_epoch_from_now();
+    ts_last_heartbeat_ = ts_since_last_sent_;
   }
 };
 
@@ -125,6 +231,7 @@ struct GuardedRecords {
 
     auto now = elf_utils::sec_since_epoch_from_now();
     records_.updateState(ts);
+    heartbeat_.states[ts.thread_id] = ts;
 
     last_states_.push_back(std::make_pair(now, ts));
     if (last_states_.size() > 100) {
@@ -153,7 +260,14 @@ struct GuardedRecords {
     return records_.records.size();
   }
 
-  std::string dumpAndClear() {
+  // The current states of all the threads (unlike those of the Records,
+  // cleared once sent).
+  std::string dumpHeartbeat() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return heartbeat_.dumpBinaryString();
+  }
+
+  std::string dumpAndClear(bool binary) {
     // send data.
     std::lock_guard<std::mutex> lock(mutex_);
     logger_->info(
@@ -162,7 +276,8 @@ struct GuardedRecords {
         records_.records.size(),
         visStates(records_.states));
 
-    std::string s = records_.dumpJsonString();
+    std::string s =
+        binary ? records_.dumpBinaryString() : records_.dumpJsonString();
     records_.clear();
     return s;
   }
@@ -170,6 +285,7 @@ struct GuardedRecords {
  private:
   std::mutex mutex_;
   Records records_;
+  Heartbeat heartbeat_;
   std::deque<std::pair<uint64_t, ThreadState>> last_states_;
   uint64_t last_state_vis_time_ = 0;
   std::shared_ptr<spdlog::logger> logger_;
@@ -214,15 +330,21 @@ class GameNotifier : public GameNotifierBase {
  public:
   GameNotifier(
       Ctrl& ctrl,
-      const std::string& identity,
+      const ThreadedWriterCtrl* writer_ctrl,
       const GameOptions& options,
       elf::GameClient* client)
-      : ctrl_(ctrl), records_(identity), options_(options), client_(client) {
+      : ctrl_(ctrl),
+        writer_ctrl_(writer_ctrl),
+        records_(writer_ctrl->identity()),
+        options_(options),
+        client_(client) {
     using std::placeholders::_1;
     using std::placeholders::_2;
 
-    ctrl.RegCallback<std::pair<int, std::string>>(
+    ctrl.RegCallback<RecordsContent>(
         std::bind(&GameNotifier::dump_records, this, _1, _2));
+    ctrl.RegCallback<HeartbeatContent>(
+        std::bind(&GameNotifier::dump_heartbeat, this, _1, _2));
   }
 
   void OnGameEnd(const GoStateExt& s) override {
@@ -258,15 +380,24 @@ class GameNotifier : public GameNotifierBase {
 
  private:
   Ctrl& ctrl_;
+  const ThreadedWriterCtrl* writer_ctrl_;
   GameStats game_stats_;
   GuardedRecords records_;
   const GameOptions options_;
   elf::GameClient* client_ = nullptr;
   const std::string end_target_ = "game_end";
 
-  bool dump_records(const Addr&, std::pair<int, std::string>& data) {
-    data.first = records_.size();
-    data.second = records_.dumpAndClear();
+  bool dump_records(const Addr&, RecordsContent& data) {
+    data.num_records = records_.size();
+    if (data.skip_empty && data.num_records == 0) {
+      return true;
+    }
+    data.content = records_.dumpAndClear(writer_ctrl_->binaryRecords());
+    return true;
+  }
+
+  bool dump_heartbeat(const Addr&, HeartbeatContent& data) {
+    data.content = records_.dumpHeartbeat();
     return true;
   }
 };
@@ -288,7 +419,7 @@ class Client {
       writer_ctrl_.reset(
           new ThreadedWriterCtrl(ctrl_, contextOptions, options));
       game_notifier_.reset(
-          new GameNotifier(ctrl_, writer_ctrl_->identity(), options, client));
+          new GameNotifier(ctrl_, writer_ctrl_.get(), options, client));
     } else if (options_.mode == "online") {
     } else {
       throw std::range_error("options.mode not recognized! " + options_.mode);
@@ -48,6 +48,11 @@ class Server {
     return trainCtrl_->getReplayBuffer();
   }
 
+  // Heartbeats received from the clients (in train mode).
+  int numHeartbeats() const {
+    return onlineLoader_ != nullptr ? onlineLoader_->numHeartbeats() : 0;
+  }
+
   void waitForSufficientSelfplay(int64_t selfplay_ver) {
     trainCtrl_->getThreadedCtrl()->waitForSufficientSelfplay(selfplay_ver);
   }
@@ -67,8 +72,9 @@ class Server {
   }
 
   ~Server() {
-    trainCtrl_.reset(nullptr);
+    // The readers call into trainCtrl_ until they stop.
     onlineLoader_.reset(nullptr);
+    trainCtrl_.reset(nullptr);
   }
 
   void loadOfflineSelfplayData() {
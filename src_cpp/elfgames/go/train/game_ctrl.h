@@ -8,11 +8,14 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -31,9 +34,10 @@
 #include "../common/go_game_specific.h"
 #include "../common/go_state_ext.h"
 #include "../common/notifier.h"
+#include "../common/position_index.h"
 
 using namespace std::chrono_literals;
-using ReplayBuffer = elf::shared::ReaderQueuesT<Record>;
+using ReplayBuffer = elf::shared::ReaderQueuesT<IndexedRecord>;
 using ThreadedCtrlBase = elf::ThreadedCtrlBase;
 using Ctrl = elf::Ctrl;
 using Addr = elf::Addr;
@@ -69,6 +73,14 @@ class ThreadedCtrl : public ThreadedCtrlBase {
     start<std::pair<Addr, int64_t>>();
   }
 
+  // Lets the calling thread call updateModel (and so checkNewModel).
+  void regThread() {
+    if (!ctrl_.isRegistered()) {
+      ctrl_.reg();
+      ctrl_.addMailbox<_ModelUpdateStatus>();
+    }
+  }
+
   void waitForSufficientSelfplay(int64_t selfplay_ver) {
     SelfPlaySubCtrl::CtrlResult res;
     while ((res = selfplay_->needWaitForMoreSample(selfplay_ver)) ==
@@ -241,7 +253,8 @@ class TrainCtrl : public DataInterface {
       const GameOptions& options,
       const elf::ai::tree_search::TSOptions& mcts_opt)
       : ctrl_(ctrl),
-        rng_(time(NULL)),
+        num_games_(num_games),
+        position_snapshot_interval_(options.position_snapshot_interval),
         selfplay_record_("tc_selfplay"),
         logger_(elf::logging::getIndexedLogger(
             "elfgames::go::train::TrainCtrl-",
@@ -261,11 +274,17 @@ class TrainCtrl : public DataInterface {
         num_games,
         options.client_max_delay_sec,
         options.expected_num_clients,
-        0.5));
+        0.5,
+        -1,
+        elf_utils::sec_since_epoch_from_now,
+        options.num_ingest_shards));
+    for (int i = 0; i < std::max(options.num_ingest_shards, 1); ++i) {
+      shards_.emplace_back(new Shard(time(NULL) + i));
+    }
   }
 
   void OnStart() override {
-    // Call by shared_rw thread or any thread that will call OnReceive.
+    // Called by the receiving thread of the Reader, before any OnReceive.
     ctrl_.reg("train_ctrl");
     ctrl_.addMailbox<int>();
     threaded_ctrl_->Start();
@@ -285,9 +304,26 @@ class TrainCtrl : public DataInterface {
     return true;
   }
 
+  // Called by the decode workers of the Readers, possibly concurrently:
+  // decoding runs in parallel, the rest one message at a time per shard.
   elf::shared::InsertInfo OnReceive(const std::string&, const std::string& s)
       override {
-    Records rs = Records::createFromJsonString(s);
+    Records rs = Records::createFromString(s);
+    threaded_ctrl_->regThread();
+
+    // Decode the selfplay games, the only ones for the replay buffer, for
+    // the sampler (see PositionIndex), before taking the shard lock.
+    std::vector<std::shared_ptr<const PositionIndex>> indices(
+        rs.records.size());
+    for (size_t i = 0; i < rs.records.size(); ++i) {
+      if (rs.records[i].request.vers.is_selfplay()) {
+        indices[i] = std::make_shared<PositionIndex>(
+            rs.records[i], position_snapshot_interval_);
+      }
+    }
+
+    Shard& shard = shardOf(rs.identity);
+    std::lock_guard<std::mutex> lock(shard.mutex);
     const ClientInfo& info = client_mgr_->updateStates(rs.identity, rs.states);
 
     if (rs.identity.size() == 0) {
@@ -307,8 +343,10 @@ class TrainCtrl : public DataInterface {
         const Record& r = rs.records[i];
 
         bool black_win = r.result.reward > 0;
-        insert_info +=
-            replay_buffer_->InsertWithParity(Record(r), &rng_, black_win);
+        insert_info += replay_buffer_->InsertWithParity(
+            IndexedRecord{std::make_shared<Record>(r), std::move(indices[i])},
+            &shard.rng,
+            black_win);
         selfplay_record_.feed(r);
         selfplay_record_.saveAndClean(1000);
       }
@@ -316,10 +354,14 @@ class TrainCtrl : public DataInterface {
 
     std::vector<FeedResult> eval_res =
         threaded_ctrl_->onEvalGames(info, rs.records);
-    threaded_ctrl_->checkNewModel(client_mgr_.get());
+    {
+      // A new model must be seen by the other shards before they check.
+      std::lock_guard<std::mutex> lock(model_mutex_);
+      threaded_ctrl_->checkNewModel(client_mgr_.get());
+    }
 
-    recv_count_++;
-    if (recv_count_ % 1000 == 0) {
+    const int recv_count = ++recv_count_;
+    if (recv_count % 1000 == 0) {
       int valid_selfplay = 0, valid_eval = 0;
       for (size_t i = 0; i < rs.records.size(); ++i) {
         if (selfplay_res[i] == FeedResult::FEEDED)
@@ -331,7 +373,7 @@ class TrainCtrl : public DataInterface {
       logger_->info(
           "TrainCtrl: Receive data[{}] from {}, #state_update: {}, "
           "#records: {}, #valid_selfplay: {}, #valid_eval: {}",
-          recv_count_,
+          recv_count,
           rs.identity,
           rs.states.size(),
           rs.records.size(),
@@ -341,7 +383,23 @@ class TrainCtrl : public DataInterface {
     return insert_info;
   }
 
+  // Called by the decode workers of the Readers, like OnReceive: only the
+  // liveness and progress of the client, without touching the records.
+  void OnHeartbeat(const std::string& identity, const std::string& msg)
+      override {
+    Heartbeat hb = Heartbeat::createFromBinaryString(msg);
+    for (auto it = hb.states.begin(); it != hb.states.end();) {
+      if (it->first < 0 || it->first >= num_games_) {
+        it = hb.states.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    client_mgr_->updateStates(identity, hb.states);
+  }
+
   bool OnReply(const std::string& identity, std::string* msg) override {
+    std::lock_guard<std::mutex> lock(shardOf(identity).mutex);
     ClientInfo& info = client_mgr_->getClient(identity);
 
     if (info.justAllocated()) {
@@ -358,16 +416,32 @@ class TrainCtrl : public DataInterface {
 
  private:
   Ctrl& ctrl_;
+  const int num_games_;
+  const int position_snapshot_interval_;
 
   std::unique_ptr<ReplayBuffer> replay_buffer_;
   std::unique_ptr<ClientManager> client_mgr_;
   std::unique_ptr<ThreadedCtrl> threaded_ctrl_;
 
-  int recv_count_ = 0;
-  std::mt19937 rng_;
+  // The clients of an ingest shard (see ClientManager). Its lock
+  // serializes OnReceive (but decoding) and OnReply for them.
+  struct Shard {
+    std::mutex mutex;
+    std::mt19937 rng;
+
+    explicit Shard(unsigned seed) : rng(seed) {}
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::mutex model_mutex_;
+  std::atomic<int> recv_count_{0};
 
   // SelfCtrl has its own record buffer to save EVERY game it has received.
   RecordBufferSimple selfplay_record_;
 
   std::shared_ptr<spdlog::logger> logger_;
+
+  Shard& shardOf(const std::string& identity) {
+    return *shards_[elf_utils::consistent_shard(identity, shards_.size())];
+  }
 };
@@ -13,7 +13,7 @@ GoGameTrain::GoGameTrain(
     elf::GameClient* client,
     const ContextOptions& context_options,
     const GameOptions& options,
-    elf::shared::ReaderQueuesT<Record>* reader)
+    elf::shared::ReaderQueuesT<IndexedRecord>* reader)
     : GoGameBase(game_idx, client, context_options, options), reader_(reader) {
   for (size_t i = 0; i < kNumState; ++i) {
     _state_ext.emplace_back(new GoStateExtOffline(game_idx, options));
@@ -27,7 +27,7 @@ void GoGameTrain::act() {
     while (true) {
       int q_idx;
       auto sampler = reader_->getSamplerWithParity(&_rng, &q_idx);
-      const Record* r = sampler.sample();
+      const IndexedRecord* r = sampler.sample();
       if (r == nullptr) {
         continue;
       }
@@ -7,6 +7,7 @@
  */
 
 #include "../common/game_base.h"
+#include "../common/position_index.h"
 #include "elf/distributed/shared_reader.h"
 
 class GoGameTrain : public GoGameBase {
@@ -16,12 +17,12 @@ class GoGameTrain : public GoGameBase {
       elf::GameClient* client,
       const ContextOptions& context_options,
       const GameOptions& options,
-      elf::shared::ReaderQueuesT<Record>* reader);
+      elf::shared::ReaderQueuesT<IndexedRecord>* reader);
 
   void act() override;
 
  private:
-  elf::shared::ReaderQueuesT<Record>* reader_ = nullptr;
+  elf::shared::ReaderQueuesT<IndexedRecord>* reader_ = nullptr;
 
   static constexpr size_t kNumState = 64;
   std::vector<std::unique_ptr<GoStateExtOffline>> _state_ext;
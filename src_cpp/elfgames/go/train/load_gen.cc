@@ -0,0 +1,301 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Load generator for the training server: runs a Server (distri_server.h)
+// and num_clients simulated self-play clients in this process, over inproc
+// by default (see elf::distri::endpoint). As with ThreadedWriterCtrl, a
+// client announces itself, then sends a finished game (a synthetic record,
+// with the states of its game threads) every interval_ms. It streams if
+// stream_credits > 0 and otherwise waits for the reply to each message,
+// and reads the replies carrying its requests. In between, it sends a
+// heartbeat with the states of its game threads every heartbeat_sec (0 for
+// none), as ThreadedWriterCtrl does.
+//
+// Reports the ingest rate of the server, the heartbeats it received, and
+// the latency of the replies (from a message to its reply). It also
+// reports the CPU time of the server per message: that of the process,
+// minus that of the client threads.
+//
+// Run it in a scratch directory: as a training server, it saves the
+// records it receives.
+//
+// Usage: load_gen [num_clients] [seconds] [interval_ms] [transport]
+//                 [num_shards] [stream_credits] [num_decode_workers]
+//                 [heartbeat_sec]
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "elfgames/go/common/go_game_specific.h"
+#include "elfgames/go/common/record_samples.h"
+#include "elfgames/go/train/distri_server.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Game threads of a simulated client.
+static constexpr int kNumGameThreads = 8;
+// Distinct synthetic records sent by the clients.
+static constexpr int kNumSamples = 64;
+// Threads simulating the clients.
+static constexpr int kNumDrivers = 4;
+
+static double cpuSec(clockid_t clock) {
+  timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double msec(Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+struct SimClient {
+  std::unique_ptr<elf::shared::Writer> writer;
+  // Send times of the messages waiting for their reply, which come in
+  // order.
+  std::deque<Clock::time_point> in_flight;
+  Clock::time_point next_send;
+  Clock::time_point next_heartbeat;
+  int seq = 0;
+};
+
+struct LoadStats {
+  std::atomic<int64_t> sent{0};
+  std::atomic<int64_t> replies{0};
+  std::atomic<int64_t> heartbeats{0};
+  std::mutex mutex;
+  std::vector<double> latencies_ms;
+  double client_cpu_sec = 0;
+};
+
+static ThreadState makeState(const SimClient& c, int i, std::mt19937& rng) {
+  ThreadState ts;
+  ts.thread_id = i;
+  ts.seq = c.seq;
+  ts.move_idx = rng() % 200;
+  ts.black = 0;
+  return ts;
+}
+
+static std::string makeContent(
+    SimClient& c,
+    const std::vector<Record>& samples,
+    std::mt19937& rng) {
+  Records rs(c.writer->identity());
+  Record r = samples[rng() % samples.size()];
+  r.thread_id = rng() % kNumGameThreads;
+  rs.addRecord(std::move(r));
+  for (int i = 0; i < kNumGameThreads; ++i) {
+    rs.updateState(makeState(c, i, rng));
+  }
+  c.seq++;
+  return c.writer->format() == kRecordsBinaryFormat ? rs.dumpBinaryString()
+                                                    : rs.dumpJsonString();
+}
+
+static std::string makeHeartbeat(const SimClient& c, std::mt19937& rng) {
+  Heartbeat hb;
+  for (int i = 0; i < kNumGameThreads; ++i) {
+    hb.states[i] = makeState(c, i, rng);
+  }
+  return hb.dumpBinaryString();
+}
+
+// Simulates clients [begin, end) until stop.
+static void drive(
+    std::vector<SimClient>* clients,
+    size_t begin,
+    size_t end,
+    const std::vector<Record>& samples,
+    Clock::duration interval,
+    Clock::time_point stop,
+    LoadStats* stats) {
+  const double cpu_start = cpuSec(CLOCK_THREAD_CPUTIME_ID);
+  std::mt19937 rng(begin);
+  std::vector<double> latencies;
+  std::string reply;
+
+  while (Clock::now() < stop) {
+    bool busy = false;
+    for (size_t i = begin; i < end; ++i) {
+      SimClient& c = (*clients)[i];
+      while (c.writer->getReplyNoblock(&reply)) {
+        if (!c.in_flight.empty()) {
+          latencies.push_back(msec(Clock::now() - c.in_flight.front()));
+          c.in_flight.pop_front();
+        }
+        stats->replies++;
+        busy = true;
+      }
+
+      const auto now = Clock::now();
+      // Once agreed with the server, see Writer::Ctrl.
+      const int heartbeat_sec = c.writer->heartbeatSec();
+      if (heartbeat_sec > 0 && now >= c.next_heartbeat) {
+        c.writer->Heartbeat(makeHeartbeat(c, rng));
+        c.next_heartbeat = std::max(
+            c.next_heartbeat + std::chrono::seconds(heartbeat_sec), now);
+        stats->heartbeats++;
+        busy = true;
+      }
+
+      const bool can_send = c.writer->streaming() ? c.writer->credits() > 0
+                                                  : c.in_flight.empty();
+      if (now < c.next_send || !can_send) {
+        continue;
+      }
+      c.writer->Insert(makeContent(c, samples, rng));
+      c.in_flight.push_back(now);
+      // Catch up at most one interval when held back.
+      c.next_send = std::max(c.next_send + interval, now);
+      stats->sent++;
+      busy = true;
+    }
+    if (!busy) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(stats->mutex);
+  stats->latencies_ms.insert(
+      stats->latencies_ms.end(), latencies.begin(), latencies.end());
+  stats->client_cpu_sec += cpuSec(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+  const int num_clients = argc > 1 ? atoi(argv[1]) : 1000;
+  const int seconds = argc > 2 ? atoi(argv[2]) : 20;
+  const int interval_ms = argc > 3 ? atoi(argv[3]) : 1000;
+
+  GameOptions options;
+  options.mode = "train";
+  options.port = 5556;
+  options.transport = argc > 4 ? argv[4] : "inproc";
+  options.num_ingest_shards = argc > 5 ? atoi(argv[5]) : 1;
+  options.stream_credits = argc > 6 ? atoi(argv[6]) : 8;
+  options.num_decode_workers = argc > 7 ? atoi(argv[7]) : 4;
+  if (argc > 8) {
+    options.heartbeat_sec = atoi(argv[8]);
+  }
+
+  ContextOptions context_options;
+  context_options.num_games = kNumGameThreads;
+  context_options.job_id = "load_gen";
+
+  spdlog::set_level(spdlog::level::warn);
+
+  std::mt19937 rng(0);
+  MsgRequest request;
+  request.vers.black_ver = 0;
+  std::vector<Record> samples;
+  for (int i = 0; i < kNumSamples; ++i) {
+    samples.push_back(randomRecord(rng, request));
+  }
+
+  Server server(context_options, options, nullptr);
+
+  std::vector<SimClient> clients(num_clients);
+  const auto interval = std::chrono::milliseconds(interval_ms);
+  const auto start = Clock::now();
+  for (int i = 0; i < num_clients; ++i) {
+    elf::shared::Options net_options =
+        getNetOptions(context_options, options);
+    // Writers made in the same second would get the same random suffix.
+    net_options.identity += "-" + std::to_string(i);
+    SimClient& c = clients[i];
+    c.writer.reset(new elf::shared::Writer(net_options));
+    c.writer->Ctrl(std::to_string(time(NULL)));
+    c.in_flight.push_back(Clock::now());
+    c.next_send = start + interval * i / num_clients;
+    c.next_heartbeat =
+        start + std::chrono::seconds(options.heartbeat_sec) * i / num_clients;
+  }
+  printf(
+      "%d clients (%d ms apart) over %s, %d shards, %d credits, "
+      "%d decode workers, heartbeat every %d s, %d s\n",
+      num_clients,
+      interval_ms,
+      options.transport.c_str(),
+      options.num_ingest_shards,
+      options.stream_credits,
+      options.num_decode_workers,
+      options.heartbeat_sec,
+      seconds);
+
+  LoadStats stats;
+  // The Ctrl messages.
+  stats.sent = num_clients;
+  const double cpu_start = cpuSec(CLOCK_PROCESS_CPUTIME_ID);
+  const auto stop = Clock::now() + std::chrono::seconds(seconds);
+  std::vector<std::thread> drivers;
+  for (int k = 0; k < kNumDrivers; ++k) {
+    drivers.emplace_back(
+        drive,
+        &clients,
+        (size_t)num_clients * k / kNumDrivers,
+        (size_t)num_clients * (k + 1) / kNumDrivers,
+        std::cref(samples),
+        interval,
+        stop,
+        &stats);
+  }
+  for (auto& t : drivers) {
+    t.join();
+  }
+  const double elapsed = msec(Clock::now() - start) / 1000;
+  const double server_cpu_sec =
+      cpuSec(CLOCK_PROCESS_CPUTIME_ID) - cpu_start - stats.client_cpu_sec;
+
+  std::vector<double>& l = stats.latencies_ms;
+  std::sort(l.begin(), l.end());
+  const int64_t replies = stats.replies;
+  printf(
+      "sent %ld, replies %ld: %.1f msg/s\n",
+      (long)stats.sent,
+      (long)replies,
+      replies / elapsed);
+  printf(
+      "heartbeats: sent %ld (%.1f/s), received %d\n",
+      (long)stats.heartbeats,
+      stats.heartbeats / elapsed,
+      server.numHeartbeats());
+  printf(
+      "reply latency (ms): p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n",
+      percentile(l, 0.5),
+      percentile(l, 0.9),
+      percentile(l, 0.99),
+      l.empty() ? 0 : l.back());
+  printf(
+      "server cpu: %.2f s, %.1f us/msg (clients: %.2f s)\n",
+      server_cpu_sec,
+      replies > 0 ? server_cpu_sec * 1e6 / replies : 0,
+      stats.client_cpu_sec);
+  printf("replay buffer: %s\n", server.getReplayBuffer()->info().c_str());
+
+  clients.clear();
+  return 0;
+}
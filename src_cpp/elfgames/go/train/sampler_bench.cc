@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2018-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Throughput of the training sampler: positions drawn at random from a
+// replay buffer of num_records synthetic games, as GoGameTrain::act() does,
+// for several intervals between the snapshots of PositionIndex (0 replays
+// each position from the start). Also reports the cost of decoding a game
+// on insertion, and the memory of its snapshots.
+//
+// Usage: sampler_bench [num_records] [num_samples] [use_feature_cache]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "elfgames/go/common/go_state_ext.h"
+#include "elfgames/go/common/record_samples.h"
+
+#include "elf/distributed/shared_reader.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double usSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+int main(int argc, char** argv) {
+  const int num_records = argc > 1 ? atoi(argv[1]) : 1000;
+  const int num_samples = argc > 2 ? atoi(argv[2]) : 100000;
+
+  GameOptions options;
+  options.use_feature_cache = argc > 3 && atoi(argv[3]) != 0;
+
+  spdlog::set_level(spdlog::level::warn);
+
+  std::mt19937 rng(0);
+  MsgRequest request;
+  request.vers.black_ver = 0;
+  std::vector<Record> records;
+  size_t num_moves = 0;
+  for (int i = 0; i < num_records; ++i) {
+    records.push_back(randomRecord(rng, request));
+    num_moves += records.back().result.num_move;
+  }
+  printf(
+      "%d records, %.1f moves on average, %d samples, feature cache: %d\n",
+      num_records,
+      (double)num_moves / num_records,
+      num_samples,
+      options.use_feature_cache);
+
+  for (int snapshot_interval : {0, 64, 32, 16, 8}) {
+    elf::shared::RQCtrl rq_ctrl;
+    rq_ctrl.num_reader = 2;
+    rq_ctrl.ctrl.queue_min_size = 1;
+    rq_ctrl.ctrl.queue_max_size = num_records;
+    elf::shared::ReaderQueuesT<IndexedRecord> buffer(rq_ctrl);
+
+    size_t num_snapshots = 0;
+    auto start = Clock::now();
+    for (const Record& r : records) {
+      auto index = std::make_shared<PositionIndex>(r, snapshot_interval);
+      if (snapshot_interval > 0 && !index->moves().empty()) {
+        num_snapshots += (index->moves().size() - 1) / snapshot_interval;
+      }
+      buffer.InsertWithParity(
+          IndexedRecord{std::make_shared<Record>(r), std::move(index)},
+          &rng,
+          r.result.reward > 0);
+    }
+    const double decode_us = usSince(start) / num_records;
+
+    GoStateExtOffline s(0, options);
+    start = Clock::now();
+    for (int i = 0; i < num_samples;) {
+      auto sampler = buffer.getSamplerWithParity(&rng);
+      const IndexedRecord* r = sampler.sample();
+      if (r == nullptr) {
+        continue;
+      }
+      s.fromRecord(*r);
+      if (s.switchRandomMove(&rng)) {
+        ++i;
+      }
+    }
+    const double sample_us = usSince(start) / num_samples;
+
+    printf(
+        "snapshot interval %2d: decode %7.1f us/record, snapshots %4.1f "
+        "KB/record, sample %6.2f us/position (%.0f positions/s)\n",
+        snapshot_interval,
+        decode_us,
+        num_snapshots * sizeof(GoState::Snapshot) / 1024.0 / num_records,
+        sample_us,
+        1e6 / sample_us);
+  }
+  return 0;
+}
@@ -10,5 +10,5 @@ from _elf import *
 # Other imports
 from .context_utils import ContextArgs
 from .more_labels import MoreLabels
-from .utils_elf import GCWrapper, Batch
+from .utils_elf import GCWrapper, Batch, unpack_bit_planes
 from .zmq_util import ZMQSender, ZMQReceiver
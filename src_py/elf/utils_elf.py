@@ -10,6 +10,8 @@ from collections import defaultdict
 import numpy as np
 import torch
 
+from _elf import Priority
+
 
 class Allocator(object):
     ''' A wrapper class for batch data'''
@@ -17,6 +19,7 @@ class Allocator(object):
         "int32_t": torch.IntTensor,
         "int64_t": torch.LongTensor,
         "float": torch.FloatTensor,
+        "uint8_t": torch.ByteTensor,
         "unsigned char": torch.ByteTensor,
         "char": torch.ByteTensor
     }
@@ -24,6 +27,7 @@ class Allocator(object):
         "int32_t": 'i4',
         'int64_t': 'i8',
         'float': 'f4',
+        'uint8_t': 'u1',
         'unsigned char': 'byte',
         'char': 'byte'
     }
@@ -78,25 +82,80 @@ class Allocator(object):
 
             smem_opts = ctx.createSharedMemOptions(name, this_batchsize)
             smem_opts.setTimeout(v.get("timeout_usec", 0))
+            smem_opts.setNumBuffers(v.get("num_buffers", 1))
+            if v.get("transfer_threads", 0) > 0:
+                smem_opts.setParallelTransfer(v["transfer_threads"])
+
+            adaptive = v.get("adaptive")
+            if adaptive is not None:
+                smem_opts.setAdaptive(
+                    adaptive.get("min_batchsize", 1),
+                    adaptive.get("min_timeout_usec", 0),
+                    adaptive.get("max_timeout_usec", 10000),
+                    adaptive.get("target_latency_usec", 0))
+
+            # Batches of high priority labels are served first.
+            if v.get("priority") == "high":
+                smem_opts.setPriority(Priority.HIGH)
+
+            # Each allocation is a collector of its own (a shard of the
+            # label); every game thread sticks to one of them.
+            for _ in range(v.get("num_shards", num_recv)):
+                first = ctx.allocateSharedMem(smem_opts, keys)
+                first_idx = first.getSharedMemOptions().idx()
+
+                # Each buffer of the collector has its own memory.
+                for i in range(smem_opts.numBuffers()):
+                    smem = ctx.getSharedMem(first_idx + i)
+                    spec = dict((
+                        Allocator._alloc(smem[field], gpu, use_numpy=use_numpy)
+                        for field in keys
+                    ))
+
+                    # Split spec.
+                    spec_input = {key: spec[key] for key in v["input"]}
+                    spec_reply = {key: spec[key] for key in v["reply"]}
+
+                    batch_spec.append(
+                        dict(input=spec_input, reply=spec_reply))
+
+                    idx = smem.getSharedMemOptions().idx()
+                    name2idx[name].append(idx)
+                    idx2name[idx] = name
+
+        return batch_spec, name2idx, idx2name
 
-            for _ in range(num_recv):
-                smem = ctx.allocateSharedMem(smem_opts, keys)
-                spec = dict((
-                    Allocator._alloc(smem[field], gpu, use_numpy=use_numpy)
-                    for field in keys
-                ))
 
-                # Split spec.
-                spec_input = {key: spec[key] for key in v["input"]}
-                spec_reply = {key: spec[key] for key in v["reply"]}
+_bit_table = {}
 
-                batch_spec.append(dict(input=spec_input, reply=spec_reply))
 
-                idx = smem.getSharedMemOptions().idx()
-                name2idx[name].append(idx)
-                idx2name[idx] = name
+def unpack_bit_planes(packed, num_points):
+    ''' Expand bit-packed planes to float planes.
 
-        return batch_spec, name2idx, idx2name
+    Point i of a plane is bit (i % 8) of byte (i / 8), as written by e.g.
+    ``BoardFeature::extractAGZPacked``. The unpack is one table lookup, so
+    it runs on whatever device ``packed`` lives on.
+
+    Args:
+        packed(ByteTensor): of shape (..., num_bytes)
+        num_points(int): number of valid points per plane
+
+    Returns:
+        FloatTensor of shape (..., num_points)
+    '''
+    key = (packed.is_cuda, packed.get_device() if packed.is_cuda else -1)
+    table = _bit_table.get(key)
+    if table is None:
+        table = torch.FloatTensor(
+            [[(b >> k) & 1 for k in range(8)] for b in range(256)])
+        if packed.is_cuda:
+            table = table.cuda(packed.get_device())
+        _bit_table[key] = table
+
+    sz = packed.size()
+    bits = table.index_select(0, packed.contiguous().view(-1).long())
+    bits = bits.view(*(list(sz[:-1]) + [sz[-1] * 8]))
+    return bits[..., :num_points]
 
 
 def tensor_slice(t, dim, b, e=None):
@@ -10,6 +10,7 @@ import torch
 import torch.nn as nn
 import torch.distributed as dist
 
+from elf import unpack_bit_planes
 from elf.options import auto_import_options, PyOptionSpec
 from rlpytorch import Model
 
@@ -286,7 +287,12 @@ class Model_PolicyValue(Model):
                   "(for cooldown = 50) in this case")
 
     def forward(self, x):
-        s = self._var(x["s"])
+        if "s_packed" in x:
+            s = unpack_bit_planes(x["s_packed"], self.board_size ** 2)
+            s = self._var(s.view(
+                -1, self.num_planes, self.board_size, self.board_size))
+        else:
+            s = self._var(x["s"])
 
         s = self.init_conv(s)
         s = self.resnet(s)
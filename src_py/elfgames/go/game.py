@@ -40,6 +40,10 @@ class Loader(object):
             'port',
             'TODO: fill this help message in',
             5556)
+        spec.addStrOption(
+            'transport',
+            'transport to the server: tcp, or ipc if on the same host',
+            'tcp')
         spec.addStrOption(
             'server_addr',
             'TODO: fill this help message in',
@@ -48,6 +52,16 @@ class Loader(object):
             'server_id',
             'TODO: fill this help message in',
             '')
+        spec.addStrOption(
+            'compression',
+            'compress the records sent to the server ("zstd"), once the '
+            'server has agreed; empty for none',
+            '')
+        spec.addStrOption(
+            'compression_dict',
+            'zstd dictionary file trained on sample records, used if the '
+            'server has loaded the same one',
+            '')
         spec.addIntOption(
             'q_min_size',
             'TODO: fill this help message in',
@@ -60,6 +74,34 @@ class Loader(object):
             'num_reader',
             'TODO: fill this help message in',
             50)
+        spec.addIntOption(
+            'num_decode_workers',
+            'number of server threads decoding and processing the records '
+            'received from clients',
+            4)
+        spec.addIntOption(
+            'stream_credits',
+            'batches of records a client may send before the server has '
+            'processed them (both ends must set it); 0 to wait for a reply '
+            'to each batch',
+            8)
+        spec.addIntOption(
+            'num_ingest_shards',
+            'number of server endpoints receiving records, on consecutive '
+            'ports from --port (clients need the same value)',
+            1)
+        spec.addIntOption(
+            'heartbeat_sec',
+            'seconds between the small messages a client sends with the '
+            'states of its games, between records (both ends must set it; '
+            'the longer interval wins); 0 for none',
+            5)
+        spec.addIntOption(
+            'position_snapshot_interval',
+            'moves between the snapshots kept for each game of the replay '
+            'buffer, so that a sampled position is restored from the last '
+            'snapshot before it; 0 to replay it from the start',
+            32)
         spec.addIntOption(
             'num_reset_ranking',
             'TODO: fill this help message in',
@@ -158,6 +200,21 @@ class Loader(object):
             'use_df_feature',
             'TODO: fill this help message in',
             False)
+        spec.addIntOption(
+            'num_symmetries',
+            'evaluate each MCTS leaf under this many of the 8 board '
+            'symmetries in one batch and average policy and value',
+            1)
+        spec.addBoolOption(
+            'use_feature_cache',
+            'maintain the input planes incrementally in each game state '
+            'instead of rebuilding them for every request',
+            False)
+        spec.addBoolOption(
+            'use_packed_feature',
+            'send the AGZ input planes bit-packed ("s_packed") instead of '
+            'as floats ("s"), and unpack them on the model side',
+            False)
         spec.addStrOption(
             'dump_record_prefix',
             'TODO: fill this help message in',
@@ -178,6 +235,35 @@ class Loader(object):
             'selfplay_timeout_usec',
             'TODO: fill this help message in',
             0)
+        spec.addIntOption(
+            'selfplay_num_buffers',
+            'number of shared memory buffers per selfplay actor, so that '
+            'the next batch is gathered while the current one is evaluated',
+            1)
+        spec.addIntOption(
+            'selfplay_transfer_threads',
+            'if > 0, selfplay actors copy features to and from the batch '
+            'with this many threads instead of on each game thread',
+            0)
+        spec.addIntOption(
+            'selfplay_num_shards',
+            'if > 0, number of collectors per selfplay actor, each serving '
+            'a fixed share of the game threads (default: 2)',
+            0)
+        spec.addBoolOption(
+            'selfplay_adaptive_batch',
+            'let selfplay actors adapt batchsize (up to --batchsize) and '
+            'timeout to the request rate and evaluation time',
+            False)
+        spec.addIntOption(
+            'selfplay_target_latency_usec',
+            'with --selfplay_adaptive_batch, target request latency; '
+            '0 to maximize throughput instead',
+            0)
+        spec.addIntOption(
+            'selfplay_max_timeout_usec',
+            'with --selfplay_adaptive_batch, upper bound of the timeout',
+            10000)
         spec.addIntOption(
             'gpu',
             'TODO: fill this help message in',
@@ -288,10 +374,15 @@ class Loader(object):
                 opt.server_id = ""
 
         opt.port = self.options.port
+        opt.transport = self.options.transport
+        opt.compression = self.options.compression
+        opt.compression_dict = self.options.compression_dict
         opt.mode = self.options.mode
         opt.use_mcts = self.options.use_mcts
         opt.use_mcts_ai2 = self.options.use_mcts_ai2
         opt.use_df_feature = self.options.use_df_feature
+        opt.use_feature_cache = self.options.use_feature_cache
+        opt.num_symmetries = self.options.num_symmetries
         opt.dump_record_prefix = self.options.dump_record_prefix
         opt.policy_distri_training_for_all = \
             self.options.policy_distri_training_for_all
@@ -305,6 +396,12 @@ class Loader(object):
         opt.q_min_size = self.options.q_min_size
         opt.q_max_size = self.options.q_max_size
         opt.num_reader = self.options.num_reader
+        opt.num_decode_workers = self.options.num_decode_workers
+        opt.stream_credits = self.options.stream_credits
+        opt.num_ingest_shards = self.options.num_ingest_shards
+        opt.heartbeat_sec = self.options.heartbeat_sec
+        opt.position_snapshot_interval = \
+            self.options.position_snapshot_interval
         opt.start_ratio_pre_moves = self.options.start_ratio_pre_moves
         opt.ply_pass_enabled = self.options.ply_pass_enabled
         opt.num_future_actions = self.options.num_future_actions
@@ -368,22 +465,38 @@ class Loader(object):
                 input=["s"],
                 reply=["pi", "a", "V"],
                 batchsize=1,
+                priority="high",
             )
             # Used for MCTS/Direct play.
             desc["actor_black"] = dict(
                 input=["s"],
                 reply=["pi", "V", "a", "rv"],
                 timeout_usec=10,
-                batchsize=co.mcts_options.num_rollouts_per_batch
+                batchsize=co.mcts_options.num_rollouts_per_batch,
+                priority="high",
             )
         elif self.options.mode == "selfplay":
+            adaptive = None
+            if self.options.selfplay_adaptive_batch:
+                adaptive = dict(
+                    max_timeout_usec=self.options.selfplay_max_timeout_usec,
+                    target_latency_usec=(
+                        self.options.selfplay_target_latency_usec),
+                )
+
             # Used for MCTS/Direct play.
             desc["actor_black"] = dict(
                 input=["s"],
                 reply=["pi", "V", "a", "rv"],
                 batchsize=self.options.batchsize,
                 timeout_usec=self.options.selfplay_timeout_usec,
+                num_buffers=self.options.selfplay_num_buffers,
+                transfer_threads=self.options.selfplay_transfer_threads,
+                adaptive=adaptive,
             )
+            if self.options.selfplay_num_shards > 0:
+                desc["actor_black"]["num_shards"] = \
+                    self.options.selfplay_num_shards
             desc["actor_white"] = dict(
                 input=["s"],
                 reply=["pi", "V", "a", "rv"],
@@ -391,7 +504,13 @@ class Loader(object):
                 if self.options.batchsize2 > 0
                 else self.options.batchsize,
                 timeout_usec=self.options.selfplay_timeout_usec,
+                num_buffers=self.options.selfplay_num_buffers,
+                transfer_threads=self.options.selfplay_transfer_threads,
+                adaptive=adaptive,
             )
+            if self.options.selfplay_num_shards > 0:
+                desc["actor_white"]["num_shards"] = \
+                    self.options.selfplay_num_shards
             desc["game_end"] = dict(
                 batchsize=1,
             )
@@ -415,6 +534,14 @@ class Loader(object):
         else:
             raise "No such mode: " + self.options.mode
 
+        if self.options.use_packed_feature:
+            if self.options.use_df_feature:
+                raise ValueError("use_packed_feature requires AGZ features")
+            for v in desc.values():
+                if "s" in v.get("input", []):
+                    v["input"] = [
+                        "s_packed" if k == "s" else k for k in v["input"]]
+
         params.update(dict(
             num_group=1 if self.options.actor_only else 2,
             T=self.options.T,
@@ -87,6 +87,16 @@ class Loader(object):
             'use_df_feature',
             'TODO: fill this help message in',
             False)
+        spec.addIntOption(
+            'num_symmetries',
+            'evaluate each MCTS leaf under this many of the 8 board '
+            'symmetries in one batch and average policy and value',
+            1)
+        spec.addBoolOption(
+            'use_feature_cache',
+            'maintain the input planes incrementally in each game state '
+            'instead of rebuilding them for every request',
+            False)
         spec.addStrOption(
             'dump_record_prefix',
             'TODO: fill this help message in',
@@ -146,6 +156,8 @@ class Loader(object):
         opt.mode = self.options.mode
         opt.use_mcts = self.options.use_mcts
         opt.use_df_feature = self.options.use_df_feature
+        opt.use_feature_cache = self.options.use_feature_cache
+        opt.num_symmetries = self.options.num_symmetries
         opt.dump_record_prefix = self.options.dump_record_prefix
         opt.verbose = self.options.verbose
         opt.black_use_policy_network_only = \